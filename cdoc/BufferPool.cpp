@@ -0,0 +1,285 @@
+/*
+ * libcdoc
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "BufferPool.h"
+
+#include "Configuration.h"
+#include "Crypto.h"
+#include "ILogger.h"
+#include "ZStream.h"
+
+#include <openssl/evp.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <new>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace libcdoc {
+
+static constexpr char const *CHUNK_SIZE_KEYS[] = {
+    Configuration::IO_CHUNK_SIZE,
+    Configuration::ZLIB_CHUNK_SIZE,
+    Configuration::CIPHER_CHUNK_SIZE
+};
+
+namespace {
+
+struct Pool {
+    std::mutex mutex;
+    std::map<size_t,std::vector<uint8_t *>> free;
+    // The total size of free buffers
+    size_t free_bytes = 0;
+    std::atomic<size_t> chunk_size[BufferPool::N_STAGES] = {64 * 1024, 16 * 1024, 16 * 1024};
+
+    static Pool& instance() {
+        // Never destroyed, buffers of static objects may be returned during static destruction
+        static Pool *pool = new Pool;
+        return *pool;
+    }
+};
+
+struct NullConsumer : public DataConsumer {
+    result_t write(const uint8_t *src, size_t size) override { return size; }
+    result_t close() override { return OK; }
+    bool isError() override { return false; }
+};
+
+} // namespace
+
+BufferPool::Buffer::Buffer(Buffer&& other) noexcept
+    : _data(other._data), _size(other._size)
+{
+    other._data = nullptr;
+    other._size = 0;
+}
+
+BufferPool::Buffer::~Buffer()
+{
+    if (!_data) return;
+    Pool& pool = Pool::instance();
+    {
+        std::lock_guard lock(pool.mutex);
+        if (pool.free_bytes + _size <= MAX_FREE_BYTES) {
+            std::vector<uint8_t *>& list = pool.free[_size];
+            if (list.size() < MAX_FREE_BUFFERS) {
+                list.push_back(_data);
+                pool.free_bytes += _size;
+                return;
+            }
+        }
+    }
+    ::operator delete(_data, std::align_val_t(ALIGNMENT));
+}
+
+BufferPool::Buffer&
+BufferPool::Buffer::operator=(Buffer&& other) noexcept
+{
+    if (this != &other) {
+        Buffer tmp(std::move(*this));
+        std::swap(_data, other._data);
+        std::swap(_size, other._size);
+    }
+    return *this;
+}
+
+BufferPool::Buffer
+BufferPool::get(size_t size)
+{
+    size = std::max(ALIGNMENT, (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1));
+    Pool& pool = Pool::instance();
+    {
+        std::lock_guard lock(pool.mutex);
+        auto it = pool.free.find(size);
+        if (it != pool.free.end()) {
+            uint8_t *data = it->second.back();
+            it->second.pop_back();
+            if (it->second.empty()) pool.free.erase(it);
+            pool.free_bytes -= size;
+            return Buffer(data, size);
+        }
+    }
+    return Buffer((uint8_t *) ::operator new(size, std::align_val_t(ALIGNMENT)), size);
+}
+
+size_t
+BufferPool::getChunkSize(Stage stage)
+{
+    return Pool::instance().chunk_size[stage];
+}
+
+void
+BufferPool::setChunkSize(Stage stage, size_t size)
+{
+    size = std::clamp((size + ALIGNMENT - 1) & ~(ALIGNMENT - 1), MIN_CHUNK_SIZE, MAX_CHUNK_SIZE);
+    Pool::instance().chunk_size[stage] = size;
+}
+
+void
+BufferPool::configure(const Configuration& conf)
+{
+    for (int stage = 0; stage < N_STAGES; stage++) {
+        int size = conf.getInt(CHUNK_SIZE_KEYS[stage]);
+        if (size > 0) setChunkSize(Stage(stage), size_t(size));
+    }
+}
+
+void
+BufferPool::clear()
+{
+    Pool& pool = Pool::instance();
+    std::lock_guard lock(pool.mutex);
+    for (auto& [size, list] : pool.free) {
+        for (uint8_t *data : list) ::operator delete(data, std::align_val_t(ALIGNMENT));
+    }
+    pool.free.clear();
+    pool.free_bytes = 0;
+}
+
+size_t
+BufferPool::getFreeSize()
+{
+    Pool& pool = Pool::instance();
+    std::lock_guard lock(pool.mutex);
+    return pool.free_bytes;
+}
+
+#ifndef _WIN32
+static double
+measureIO(size_t chunk, size_t total, int fd)
+{
+    BufferPool::Buffer buf = BufferPool::get(chunk);
+    std::fill(buf.data(), buf.data() + chunk, 0x5a);
+    if ((ftruncate(fd, 0) != 0) || (lseek(fd, 0, SEEK_SET) != 0)) return 0;
+    auto start = std::chrono::steady_clock::now();
+    {
+        FdConsumer dst(fd, false, chunk);
+        for (size_t n = 0; n < total; n += chunk) {
+            if (dst.write(buf.data(), std::min(chunk, total - n)) < 0) return 0;
+        }
+        if (dst.close() != OK) return 0;
+    }
+    // Write the file out and drop it from page cache, so that it is read back from the device
+    if (fsync(fd) != 0) return 0;
+#ifdef POSIX_FADV_DONTNEED
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+    if (lseek(fd, 0, SEEK_SET) != 0) return 0;
+    {
+        FdSource src(fd, false, chunk);
+        while (!src.isEof()) {
+            result_t n_read = src.read(buf.data(), chunk);
+            if (n_read < 0) return 0;
+            if (size_t(n_read) < chunk) break;
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return 2.0 * total / elapsed.count();
+}
+#endif
+
+static double
+measureStage(BufferPool::Stage stage, size_t total, const std::vector<uint8_t>& data)
+{
+    NullConsumer null;
+    std::vector<uint8_t> key = Crypto::random(32);
+    std::vector<uint8_t> iv = Crypto::random(12);
+    Crypto::Cipher cipher(EVP_aes_256_gcm(), key, iv, true);
+    std::unique_ptr<DataConsumer> dst;
+    if (stage == BufferPool::ZLIB) {
+        dst = std::make_unique<ZConsumer>(&null);
+    } else {
+        dst = std::make_unique<CipherConsumer>(&null, false, &cipher);
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (size_t n = 0; n < total; n += data.size()) {
+        if (dst->write(data.data(), std::min(data.size(), total - n)) < 0) return 0;
+    }
+    if (dst->close() != OK) return 0;
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return total / elapsed.count();
+}
+
+std::vector<double>
+BufferPool::benchmark(Stage stage, const std::vector<size_t>& candidates, size_t total, const std::string& dir)
+{
+    // Somewhat compressible sample data, the size is a multiple of cipher block size
+    std::vector<uint8_t> data(1024 * 1024);
+    uint32_t seed = 1;
+    for (size_t i = 0; i < data.size(); i++) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = uint8_t('a' + ((seed >> 16) % 16));
+    }
+    int fd = -1;
+#ifndef _WIN32
+    if (stage == IO) {
+        // Unique file that is removed at once, only the descriptor is used
+        std::filesystem::path path = dir.empty() ? std::filesystem::temp_directory_path() : std::filesystem::path(dir);
+        std::string name = (path / "libcdoc_autotune.XXXXXX").string();
+        fd = mkstemp(name.data());
+        if (fd >= 0) unlink(name.c_str());
+        else LOG_ERROR("Cannot create temporary file in {}: {}", path.string(), strerror(errno));
+    }
+#endif
+
+    size_t old_size = getChunkSize(stage);
+    std::vector<double> result;
+    for (size_t candidate : candidates) {
+        setChunkSize(stage, candidate);
+        size_t chunk = getChunkSize(stage);
+        double speed = 0;
+        if (stage != IO) {
+            speed = measureStage(stage, total, data);
+        } else if (fd >= 0) {
+#ifndef _WIN32
+            speed = measureIO(chunk, total, fd);
+#endif
+        }
+        LOG_DBG("BufferPool: stage {} chunk {} throughput {} MB/s", int(stage), chunk, speed / 1000000);
+        result.push_back(speed);
+    }
+    setChunkSize(stage, old_size);
+#ifndef _WIN32
+    if (fd >= 0) ::close(fd);
+#endif
+    return result;
+}
+
+size_t
+BufferPool::autotune(Stage stage, std::vector<size_t> candidates, size_t total, const std::string& dir)
+{
+    if (candidates.empty()) candidates = {16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024};
+    std::vector<double> speed = benchmark(stage, candidates, total, dir);
+    auto best = std::max_element(speed.cbegin(), speed.cend());
+    if ((best != speed.cend()) && (*best > 0)) {
+        setChunkSize(stage, candidates[best - speed.cbegin()]);
+    }
+    return getChunkSize(stage);
+}
+
+} // namespace libcdoc
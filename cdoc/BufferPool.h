@@ -0,0 +1,169 @@
+/*
+ * libcdoc
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __BUFFERPOOL_H__
+#define __BUFFERPOOL_H__
+
+#include <cdoc/Exports.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace libcdoc {
+
+struct Configuration;
+
+/**
+ * @brief A library-wide pool of aligned working buffers
+ *
+ * Pipeline stages take their buffers from the pool instead of allocating them on every call, and return
+ * them when done. The buffer size of each stage can be set with setChunkSize or from Configuration
+ * (IO_CHUNK_SIZE, ZLIB_CHUNK_SIZE and CIPHER_CHUNK_SIZE) with configure, or measured on the host with autotune.
+ * The sizes are shared by all readers and writers of the process. All methods are thread-safe.
+ */
+class CDOC_EXPORT BufferPool {
+public:
+    /**
+     * @brief Pipeline stages with separately tunable chunk size
+     */
+    enum Stage : int {
+        /**
+         * @brief Plain data transfer (DataConsumer::writeAll, DataSource::skip, file extraction)
+         */
+        IO,
+        /**
+         * @brief Compression and decompression
+         */
+        ZLIB,
+        /**
+         * @brief Encryption
+         */
+        CIPHER,
+        N_STAGES
+    };
+
+    static constexpr size_t ALIGNMENT = 4096;
+    static constexpr size_t MIN_CHUNK_SIZE = 4096;
+    static constexpr size_t MAX_CHUNK_SIZE = 64 * 1024 * 1024;
+    /**
+     * @brief The maximum number of free buffers kept for each size
+     */
+    static constexpr size_t MAX_FREE_BUFFERS = 16;
+    /**
+     * @brief The maximum total size of free buffers kept, larger buffers are released on return
+     */
+    static constexpr size_t MAX_FREE_BYTES = 64 * 1024 * 1024;
+
+    /**
+     * @brief A buffer borrowed from pool, returned to pool on destruction
+     */
+    class CDOC_EXPORT Buffer {
+    public:
+        Buffer() = default;
+        Buffer(Buffer&& other) noexcept;
+        ~Buffer();
+        Buffer& operator=(Buffer&& other) noexcept;
+        Buffer(const Buffer&) = delete;
+        Buffer& operator=(const Buffer&) = delete;
+
+        uint8_t *data() const { return _data; }
+        size_t size() const { return _size; }
+    private:
+        friend class BufferPool;
+        Buffer(uint8_t *data, size_t size) : _data(data), _size(size) {}
+
+        uint8_t *_data = nullptr;
+        size_t _size = 0;
+    };
+
+    /**
+     * @brief get a buffer of the chunk size of given stage
+     * @param stage the pipeline stage
+     * @return a buffer
+     */
+    static Buffer get(Stage stage) { return get(getChunkSize(stage)); }
+    /**
+     * @brief get a buffer of at least given size
+     * @param size the minimum buffer size
+     * @return a buffer
+     */
+    static Buffer get(size_t size);
+
+    /**
+     * @brief get the chunk size of a pipeline stage
+     * @param stage the pipeline stage
+     * @return the chunk size in bytes
+     */
+    static size_t getChunkSize(Stage stage);
+    /**
+     * @brief set the chunk size of a pipeline stage
+     *
+     * The size is rounded up to a multiple of ALIGNMENT and clamped to [MIN_CHUNK_SIZE, MAX_CHUNK_SIZE].
+     * Buffers already taken keep their size.
+     * @param stage the pipeline stage
+     * @param size the chunk size in bytes
+     */
+    static void setChunkSize(Stage stage, size_t size);
+    /**
+     * @brief set the chunk sizes from configuration
+     *
+     * Only the sizes that are set in configuration are changed. The sizes apply to the whole process, so this is
+     * meant to be called once by application at startup. CDocReader and CDocWriter factories do not call it.
+     * @param conf the configuration object
+     */
+    static void configure(const Configuration& conf);
+    /**
+     * @brief release all free buffers
+     */
+    static void clear();
+    /**
+     * @brief get the total size of free buffers kept in pool
+     */
+    static size_t getFreeSize();
+
+    /**
+     * @brief measure the throughput of a pipeline stage with candidate chunk sizes
+     *
+     * IO stage writes, syncs and reads back an unnamed temporary file in given directory, dropping it from page
+     * cache before reading (not measured on Windows, the result is 0). ZLIB and CIPHER stages process in-memory
+     * data. The chunk size of stage is restored after measurement.
+     * @param stage the pipeline stage
+     * @param candidates the chunk sizes to measure
+     * @param total the number of bytes to process for each candidate
+     * @param dir the directory for temporary file (system temporary directory if empty)
+     * @return the throughput (bytes per second) for each candidate, 0 on error
+     */
+    static std::vector<double> benchmark(Stage stage, const std::vector<size_t>& candidates, size_t total = 32 * 1024 * 1024, const std::string& dir = {});
+    /**
+     * @brief set the chunk size of a pipeline stage to the fastest of candidates
+     * @param stage the pipeline stage
+     * @param candidates the chunk sizes to measure (16 KiB to 1 MiB if empty)
+     * @param total the number of bytes to process for each candidate
+     * @param dir the directory for temporary file (system temporary directory if empty)
+     * @return the selected chunk size
+     */
+    static size_t autotune(Stage stage, std::vector<size_t> candidates = {}, size_t total = 32 * 1024 * 1024, const std::string& dir = {});
+
+    BufferPool() = delete;
+};
+
+} // namespace libcdoc
+
+#endif // __BUFFERPOOL_H__
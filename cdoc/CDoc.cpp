@@ -16,6 +16,7 @@
  *
  */
 
+#include "BufferPool.h"
 #include "CDoc1Writer.h"
 #include "CDoc1Reader.h"
 #include "CDoc2Writer.h"
@@ -81,26 +82,39 @@ libcdoc::CDocReader::getCDocFileVersion(DataSource *src)
     return libcdoc::NOT_SUPPORTED;
 }
 
+static DataSource *openFileSource(const std::string& path, Configuration *conf);
+
 int
 libcdoc::CDocReader::getCDocFileVersion(const std::string& path)
 {
-    IStreamSource ifs(path);
-    return getCDocFileVersion(&ifs);
+    std::unique_ptr<DataSource> src(openFileSource(path, nullptr));
+    return getCDocFileVersion(src.get());
 }
 
 libcdoc::CDocReader *
 libcdoc::CDocReader::createReader(DataSource *src, bool take_ownership, Configuration *conf, CryptoBackend *crypto, NetworkBackend *network)
 {
+    std::unique_ptr<CachingSource> cache;
+    int read_cache = conf ? conf->getInt(Configuration::READ_CACHE) : 0;
+    if (read_cache > 0) {
+        // Does not own the source until reader is created, the caller keeps it on failure
+        cache = std::make_unique<CachingSource>(src, false, size_t(read_cache));
+        src = cache.get();
+    }
     int version = getCDocFileVersion(src);
     LOG_DBG("CDocReader::createReader: version {}", version);
     if (src->seek(0) != libcdoc::OK) return nullptr;
+    if ((version != 1) && (version != 2)) return nullptr;
+    if (cache) {
+        cache->setOwnership(take_ownership);
+        cache.release();
+        take_ownership = true;
+    }
     CDocReader *reader;
 	if (version == 1) {
         reader = new CDoc1Reader(src, take_ownership);
-	} else if (version == 2) {
-        reader = new CDoc2Reader(src, take_ownership);
 	} else {
-		return nullptr;
+        reader = new CDoc2Reader(src, take_ownership);
 	}
 	reader->conf = conf;
 	reader->crypto = crypto;
@@ -108,21 +122,39 @@ libcdoc::CDocReader::createReader(DataSource *src, bool take_ownership, Configur
 	return reader;
 }
 
+static DataSource *
+openFileSource(const std::string& path, Configuration *conf)
+{
+#ifndef _WIN32
+    if (conf && conf->getBoolean(Configuration::DIRECT_IO)) return new DirectFileSource(path);
+    if (conf && conf->getBoolean(Configuration::ASYNC_IO)) return new UringFileSource(path);
+    if (conf && conf->getBoolean(Configuration::BULK_IO)) {
+        FdSource *fsrc = new FdSource(path);
+        fsrc->setBulk(true);
+        return fsrc;
+    }
+#endif
+#ifdef __linux__
+    MmapSource *msrc = new MmapSource(path);
+    if (!msrc->isError()) return msrc;
+    LOG_DBG("Cannot map {}, falling back to descriptor input", path);
+    delete msrc;
+#endif
+#ifdef _WIN32
+    return new IStreamSource(path);
+#else
+    return new FdSource(path);
+#endif
+}
+
 libcdoc::CDocReader *
 libcdoc::CDocReader::createReader(const std::string& path, Configuration *conf, CryptoBackend *crypto, NetworkBackend *network)
 {
-    int version = getCDocFileVersion(path);
-    CDocReader *reader;
-    if (version == 1) {
-        reader = new CDoc1Reader(path);
-    } else if (version == 2) {
-        reader = new CDoc2Reader(path);
-    } else {
-        return nullptr;
-    }
-    reader->conf = conf;
-    reader->crypto = crypto;
-    reader->network = network;
+    DataSource *src = openFileSource(path, conf);
+    int read_ahead = conf ? conf->getInt(Configuration::READ_AHEAD) : 0;
+    if (read_ahead > 0) src = new ReadAheadSource(src, true, unsigned(read_ahead));
+    CDocReader *reader = createReader(src, true, conf, crypto, network);
+    if (!reader) delete src;
     return reader;
 }
 
@@ -198,7 +230,6 @@ getDefaultCryptoBackend()
 libcdoc::CDocWriter *
 libcdoc::CDocWriter::createWriter(int version, DataConsumer *dst, bool take_ownership, Configuration *conf, CryptoBackend *crypto, NetworkBackend *network)
 {
-
 	CDocWriter *writer;
 	if (version == 1) {
 		writer = new CDoc1Writer(dst, take_ownership);
@@ -223,7 +254,22 @@ libcdoc::CDocWriter::createWriter(int version, std::ostream& ofs, Configuration
 libcdoc::CDocWriter *
 libcdoc::CDocWriter::createWriter(int version, const std::string& path, Configuration *conf, CryptoBackend *crypto, NetworkBackend *network)
 {
-	libcdoc::DataConsumer *dst = new libcdoc::OStreamConsumer(path);
+	libcdoc::DataConsumer *dst;
+#ifdef _WIN32
+	dst = new libcdoc::OStreamConsumer(path);
+#else
+	if (conf && conf->getBoolean(Configuration::DIRECT_IO)) {
+		dst = new libcdoc::DirectFileConsumer(path);
+	} else if (conf && conf->getBoolean(Configuration::ASYNC_IO)) {
+		dst = new libcdoc::UringFileConsumer(path);
+	} else {
+		libcdoc::WritevConsumer *wdst = new libcdoc::WritevConsumer(path);
+		if (conf && conf->getBoolean(Configuration::BULK_IO)) wdst->setBulk(true);
+		dst = wdst;
+	}
+#endif
+	int write_behind = conf ? conf->getInt(Configuration::WRITE_BEHIND) : 0;
+	if (write_behind > 0) dst = new libcdoc::WriteBehindConsumer(dst, true, unsigned(write_behind));
 	return createWriter(version, dst, true, conf, crypto, network);
 }
 
@@ -20,6 +20,7 @@
 
 #include "CDoc.h"
 #include "Certificate.h"
+#include "Configuration.h"
 #include "Crypto.h"
 #include "CryptoBackend.h"
 #include "DDocReader.h"
@@ -64,7 +65,7 @@ public:
 
     std::vector<DDOCReader::File> files;
     int64_t f_pos = -1;
-    std::unique_ptr<libcdoc::VectorSource> src;
+    libcdoc::DataSource *src = nullptr;
 
     ~Private()
     {
@@ -72,6 +73,13 @@ public:
     }
 };
 
+static size_t
+getMemoryLimit(libcdoc::Configuration *conf)
+{
+    int limit = conf ? conf->getInt(libcdoc::Configuration::SPILL_THRESHOLD) : 0;
+    return (limit > 0) ? size_t(limit) : libcdoc::SpillBuffer::DEFAULT_MEMORY_LIMIT;
+}
+
 const std::vector<Lock>&
 CDoc1Reader::getLocks()
 {
@@ -177,22 +185,22 @@ CDoc1Reader::decrypt(const std::vector<uint8_t>& fmk, libcdoc::MultiDataConsumer
     return result;
 #else
     std::string mime;
-    std::vector<uint8_t> data;
+    std::unique_ptr<libcdoc::SpillBuffer> data;
     if (auto result = CDoc1Reader::decryptData(fmk, mime, data); result != OK) {
         return result;
     }
-	libcdoc::VectorSource vsrc(data);
 	if(mime == MIME_DDOC || mime == MIME_DDOC_OLD) {
         LOG_DBG("Contains DDoc content {}", mime);
-        auto result = DDOCReader::parse(&vsrc, dst);
+        auto result = DDOCReader::parse(data.get(), dst, getMemoryLimit(conf));
         if (result != libcdoc::OK) {
             setLastError("Failed to parse DDOC file");
             LOG_ERROR("{}", last_error);
         }
         return result;
     }
-	dst->open(d->properties["Filename"], data.size());
-	dst->writeAll(vsrc);
+	dst->open(d->properties["Filename"], data->size());
+	dst->reserve(data->size());
+	dst->writeAll(*data);
 	dst->close();
     return libcdoc::OK;
 #endif
@@ -202,13 +210,13 @@ libcdoc::result_t
 CDoc1Reader::beginDecryption(const std::vector<uint8_t>& fmk)
 {
     std::string mime;
-    std::vector<uint8_t> data;
+    std::unique_ptr<libcdoc::SpillBuffer> data;
     if (auto result = CDoc1Reader::decryptData(fmk, mime, data); result != OK) {
         return result;
     }
     if(mime == MIME_DDOC || mime == MIME_DDOC_OLD) {
         LOG_DBG("Contains DDoc content {}", mime);
-        d->files = DDOCReader::files(data);
+        d->files = DDOCReader::files(data.get(), getMemoryLimit(conf));
     } else {
         d->files.push_back({
             d->properties["Filename"],
@@ -228,7 +236,7 @@ CDoc1Reader::beginDecryption(const std::vector<uint8_t>& fmk)
 libcdoc::result_t
 CDoc1Reader::finishDecryption()
 {
-    d->src.reset();
+    d->src = nullptr;
     d->files.clear();
     return libcdoc::OK;
 }
@@ -246,9 +254,9 @@ CDoc1Reader::nextFile(std::string& name, int64_t& size)
         return libcdoc::END_OF_STREAM;
     }
     name = d->files[d->f_pos].name;
-    size = d->files[d->f_pos].data.size();
-    d->src = std::make_unique<libcdoc::VectorSource>(d->files[d->f_pos].data);
-    return libcdoc::OK;
+    size = d->files[d->f_pos].data->size();
+    d->src = d->files[d->f_pos].data.get();
+    return d->src->seek(0);
 }
 
 libcdoc::result_t
@@ -377,7 +385,7 @@ CDoc1Reader::isCDoc1File(libcdoc::DataSource *src)
  * @param mime decrypted mime type
  * @param data decrypted data
  */
-result_t CDoc1Reader::decryptData(const std::vector<uint8_t>& fmk, std::string& mime, std::vector<uint8_t>& data)
+result_t CDoc1Reader::decryptData(const std::vector<uint8_t>& fmk, std::string& mime, std::unique_ptr<libcdoc::SpillBuffer>& data)
 {
     if (fmk.empty()) {
         setLastError("FMK is missing");
@@ -396,6 +404,7 @@ result_t CDoc1Reader::decryptData(const std::vector<uint8_t>& fmk, std::string&
         return result;
     }
 
+    size_t memory_limit = getMemoryLimit(conf);
     XMLReader reader(d->dsrc, false);
     int skipKeyInfo = 0;
     while (reader.read()) {
@@ -409,23 +418,26 @@ result_t CDoc1Reader::decryptData(const std::vector<uint8_t>& fmk, std::string&
         // EncryptedData/CipherData/CipherValue
         else if(reader.isElement("CipherValue"))
         {
-            data = libcdoc::Crypto::decrypt(d->method, fmk, reader.readBase64());
+            libcdoc::SpillBuffer encrypted(memory_limit);
+            if (reader.readBase64(encrypted) < 0) break;
+            data = std::make_unique<libcdoc::SpillBuffer>(memory_limit);
+            if (libcdoc::Crypto::decrypt(d->method, fmk, encrypted, *data) < 0) data.reset();
             break;
         }
     }
 
-    if(data.empty()) {
+    if(!data || !data->size()) {
         setLastError("Failed to decrypt data, verify if FMK is correct");
         return libcdoc::CRYPTO_ERROR;
     }
     setLastError({});
+    data->seek(0);
     if (d->mime == MIME_ZLIB) {
-        libcdoc::VectorSource vsrc(data);
-        libcdoc::ZSource zsrc(&vsrc);
-        std::vector<uint8_t> tmp;
-        libcdoc::VectorConsumer vcons(tmp);
-        vcons.writeAll(zsrc);
-        data = std::move(tmp);
+        libcdoc::ZSource zsrc(data.get());
+        auto inflated = std::make_unique<libcdoc::SpillBuffer>(memory_limit);
+        inflated->writeAll(zsrc);
+        data = std::move(inflated);
+        data->seek(0);
         mime = d->properties["OriginalMimeType"];
     }
     else
@@ -20,6 +20,12 @@
 
 #include "CDocReader.h"
 
+#include <memory>
+
+namespace libcdoc {
+struct SpillBuffer;
+}
+
 class Token;
 
 class CDoc1Reader : public libcdoc::CDocReader
@@ -44,7 +50,7 @@ public:
 private:
 	CDoc1Reader(const CDoc1Reader &) = delete;
 	CDoc1Reader &operator=(const CDoc1Reader &) = delete;
-    libcdoc::result_t decryptData(const std::vector<uint8_t>& fmk, std::string& mime, std::vector<uint8_t>& data);
+    libcdoc::result_t decryptData(const std::vector<uint8_t>& fmk, std::string& mime, std::unique_ptr<libcdoc::SpillBuffer>& data);
 	class Private;
 	Private *d;
 };
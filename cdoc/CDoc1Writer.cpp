@@ -18,9 +18,11 @@
 
 #include "CDoc1Writer.h"
 
+#include "Configuration.h"
 #include "Crypto.h"
 #include "DDocWriter.h"
 #include "ILogger.h"
+#include "Io.h"
 #include "Recipient.h"
 #include "Utils.h"
 #include "XmlWriter.h"
@@ -35,7 +37,7 @@ using namespace libcdoc;
 struct FileEntry {
 	std::string name;
 	size_t size;
-	std::vector<uint8_t> data;
+	std::unique_ptr<libcdoc::SpillBuffer> data;
 };
 
 /**
@@ -54,8 +56,16 @@ public:
 	std::string method, documentFormat = "ENCDOC-XML|1.1", lastError;
 
     bool writeRecipient(XMLWriter *xmlw, const std::vector<uint8_t> &recipient, const libcdoc::Crypto::Key& transportKey);
+    libcdoc::result_t writeCipherValue(const libcdoc::Crypto::Key& transportKey, libcdoc::SpillBuffer& data, size_t memory_limit);
 };
 
+static size_t
+getMemoryLimit(libcdoc::Configuration *conf)
+{
+    int limit = conf ? conf->getInt(libcdoc::Configuration::SPILL_THRESHOLD) : 0;
+    return (limit > 0) ? size_t(limit) : libcdoc::SpillBuffer::DEFAULT_MEMORY_LIMIT;
+}
+
 const XMLWriter::NS CDoc1Writer::Private::DENC{ "denc", "http://www.w3.org/2001/04/xmlenc#" };
 const XMLWriter::NS CDoc1Writer::Private::DS{ "ds", "http://www.w3.org/2000/09/xmldsig#" };
 const XMLWriter::NS CDoc1Writer::Private::XENC11{ "xenc11", "http://www.w3.org/2009/xmlenc11#" };
@@ -184,6 +194,23 @@ bool CDoc1Writer::Private::writeRecipient(XMLWriter *xmlw, const std::vector<uin
 	return true;
 }
 
+/**
+ * Encrypt buffered payload to CipherValue element
+ */
+libcdoc::result_t
+CDoc1Writer::Private::writeCipherValue(const libcdoc::Crypto::Key& transportKey, libcdoc::SpillBuffer& data, size_t memory_limit)
+{
+    libcdoc::SpillBuffer encrypted(memory_limit);
+    data.seek(0);
+    if (auto result = libcdoc::Crypto::encrypt(method, transportKey, data, encrypted); result < 0) {
+        lastError = "Failed to encrypt data";
+        LOG_ERROR("{}", lastError);
+        return result;
+    }
+    data.clear();
+    return _xml->writeBase64Element(Private::DENC, "CipherValue", encrypted);
+}
+
 /**
  * Encrypt data
  */
@@ -215,21 +242,21 @@ CDoc1Writer::encrypt(libcdoc::MultiDataSource& src, const std::vector<libcdoc::R
 
 	std::vector<FileEntry> files;
     int64_t result = libcdoc::OK;
+    size_t memory_limit = getMemoryLimit(conf);
     d->_xml->writeElement(Private::DENC, "CipherData", [&]() -> void {
-        std::vector<uint8_t> data;
+        libcdoc::SpillBuffer data(memory_limit);
         if(use_ddoc) {
-            data.reserve(16384);
-			DDOCWriter ddoc(data);
+			DDOCWriter ddoc(&data);
 			std::string name;
 			int64_t size;
             result = src.next(name, size);
             while (result == libcdoc::OK) {
-				std::vector<uint8_t> contents;
-				libcdoc::VectorConsumer vcons(contents);
-                result = src.readAll(vcons);
+				libcdoc::SpillBuffer contents(memory_limit);
+                if (size > 0) contents.reserve(size);
+                result = src.readAll(contents);
                 if (result < 0) return;
                 files.push_back({name, (size_t) result});
-                ddoc.addFile(name, "application/octet-stream", contents);
+                ddoc.addFile(name, "application/octet-stream", contents, contents.size());
                 result = src.next(name, size);
 			}
 		} else {
@@ -237,12 +264,12 @@ CDoc1Writer::encrypt(libcdoc::MultiDataSource& src, const std::vector<libcdoc::R
 			int64_t size;
             result = src.next(name, size);
             if (result < 0) return;
-			libcdoc::VectorConsumer vcons(data);
-            result = src.readAll(vcons);
+            if (size > 0) data.reserve(size);
+            result = src.readAll(data);
             if (result < 0) return;
             files.push_back({std::move(name), (size_t) result});
         }
-        d->_xml->writeBase64Element(Private::DENC, "CipherValue", libcdoc::Crypto::encrypt(d->method, transportKey, data));
+        if (auto rv = d->writeCipherValue(transportKey, data, memory_limit); rv < 0) result = rv;
     });
     if (result < 0) return result;
 	d->_xml->writeElement(Private::DENC, "EncryptionProperties", [&]{
@@ -279,7 +306,8 @@ CDoc1Writer::addRecipient(const libcdoc::Recipient& rcpt)
 libcdoc::result_t
 CDoc1Writer::addFile(const std::string& name, size_t size)
 {
-	d->files.push_back({name, size, {}});
+	d->files.push_back({name, size, std::make_unique<libcdoc::SpillBuffer>(getMemoryLimit(conf))});
+	if (size > 0) d->files.back().data->reserve(size);
 	return libcdoc::OK;
 }
 
@@ -287,7 +315,7 @@ libcdoc::result_t
 CDoc1Writer::writeData(const uint8_t *src, size_t size)
 {
 	if (d->files.empty()) return libcdoc::WORKFLOW_ERROR;
-	d->files.back().data.insert(d->files.back().data.end(), src, src + size);
+	if (auto result = d->files.back().data->write(src, size); result < 0) return result;
     return libcdoc::OK;
 }
 
@@ -318,19 +346,22 @@ CDoc1Writer::finishEncryption()
 	}
 	d->_xml->writeEndElement(Private::DS); // KeyInfo
 
+	libcdoc::result_t result = libcdoc::OK;
+	size_t memory_limit = getMemoryLimit(conf);
 	d->_xml->writeElement(Private::DENC, "CipherData", [&]{
 		if(use_ddoc) {
-            std::vector<uint8_t> data;
-            data.reserve(4096);
-            for (DDOCWriter ddoc(data); const FileEntry& file : d->files) {
-                std::vector<uint8_t> contents;
-                ddoc.addFile(file.name, "application/octet-stream", file.data);
+            libcdoc::SpillBuffer data(memory_limit);
+            for (DDOCWriter ddoc(&data); const FileEntry& file : d->files) {
+                file.data->seek(0);
+                ddoc.addFile(file.name, "application/octet-stream", *file.data, file.data->size());
+                file.data->clear();
             }
-            d->_xml->writeBase64Element(Private::DENC, "CipherValue", libcdoc::Crypto::encrypt(d->method, transportKey, data));
+            result = d->writeCipherValue(transportKey, data, memory_limit);
 		} else {
-            d->_xml->writeBase64Element(Private::DENC, "CipherValue", libcdoc::Crypto::encrypt(d->method, transportKey, d->files.back().data));
+            result = d->writeCipherValue(transportKey, *d->files.back().data, memory_limit);
 		}
 	});
+	if (result < 0) return result;
 	d->_xml->writeElement(Private::DENC, "EncryptionProperties", [&]{
 		d->_xml->writeTextElement(Private::DENC, "EncryptionProperty", {{"Name", "LibraryVersion"}}, "cdoc|0.0.1");
 		d->_xml->writeTextElement(Private::DENC, "EncryptionProperty", {{"Name", "DocumentFormat"}}, d->documentFormat);
@@ -85,7 +85,11 @@ struct CDoc2Reader::Private {
 
     std::unique_ptr<libcdoc::Crypto::Cipher> cipher;
     std::unique_ptr<TaggedSource> tgs;
+    // Decrypted payload, owned by zsrc
+    libcdoc::DataSource *payload = nullptr;
     std::unique_ptr<libcdoc::ZSource> zsrc;
+    // Read-ahead stage between deflate and tar in pipelined mode
+    std::unique_ptr<libcdoc::ReadAheadSource> ahead;
     std::unique_ptr<libcdoc::TarSource> tar;
 
 };
@@ -346,6 +350,7 @@ CDoc2Reader::decrypt(const std::vector<uint8_t>& fmk, libcdoc::MultiDataConsumer
     result = nextFile(name, size);
     while (result == libcdoc::OK) {
         result = consumer->open(name, size);
+        if ((result == libcdoc::OK) && (size > 0)) result = consumer->reserve(size);
         if (result != libcdoc::OK) {
             setLastError(consumer->getLastErrorStr(result));
             LOG_ERROR("{}", last_error);
@@ -406,9 +411,17 @@ CDoc2Reader::beginDecryption(const std::vector<uint8_t>& fmk)
     }
 
     priv->tgs = std::make_unique<TaggedSource>(priv->_src, false, 16);
-    libcdoc::CipherSource *csrc = new libcdoc::CipherSource(priv->tgs.get(), false, priv->cipher.get());
-    priv->zsrc = std::make_unique<libcdoc::ZSource>(csrc, true);
-    priv->tar = std::make_unique<libcdoc::TarSource>(priv->zsrc.get(), false);
+    priv->payload = new libcdoc::CipherSource(priv->tgs.get(), false, priv->cipher.get());
+    // In pipelined mode cipher and deflate stages run ahead in their own threads
+    int pipeline = conf ? conf->getInt(libcdoc::Configuration::PIPELINE) : 0;
+    if (pipeline > 0) priv->payload = new libcdoc::ReadAheadSource(priv->payload, true, unsigned(pipeline));
+    priv->zsrc = std::make_unique<libcdoc::ZSource>(priv->payload, true);
+    if (pipeline > 0) {
+        priv->ahead = std::make_unique<libcdoc::ReadAheadSource>(priv->zsrc.get(), false, unsigned(pipeline));
+        priv->tar = std::make_unique<libcdoc::TarSource>(priv->ahead.get(), false);
+    } else {
+        priv->tar = std::make_unique<libcdoc::TarSource>(priv->zsrc.get(), false);
+    }
 
     return libcdoc::OK;
 }
@@ -446,10 +459,26 @@ CDoc2Reader::readData(uint8_t *dst, size_t size)
 libcdoc::result_t
 CDoc2Reader::finishDecryption()
 {
-    if (!priv->zsrc->isEof()) {
+    size_t chunk = libcdoc::BufferPool::getChunkSize(libcdoc::BufferPool::IO);
+    // Data left after tar in read-ahead stage is not part of content either
+    uint64_t n_extra = 0;
+    if (priv->ahead) {
+        // Let deflate stage run to the end of stream before its thread is stopped
+        for (result_t result = priv->ahead->skip(chunk); result > 0; result = priv->ahead->skip(chunk)) {
+            n_extra += uint64_t(result);
+        }
+        priv->tar.reset();
+        priv->ahead.reset();
+    }
+    if (n_extra || !priv->zsrc->isEof()) {
         setLastError(t_("CDoc contains additional payload data that is not part of content"));
         LOG_WARN("{}", last_error);
     }
+    // The tag covers the whole payload, pass the rest of it through cipher
+    while (priv->payload->skip(chunk) > 0) {}
+    priv->tar.reset();
+    priv->zsrc.reset();
+    priv->payload = nullptr;
 
     LOG_TRACE_KEY("tag: {}", priv->tgs->tag);
 
@@ -461,8 +490,6 @@ CDoc2Reader::finishDecryption()
     }
     setLastError({});
     priv->tgs.reset();
-    priv->zsrc.reset();
-    priv->tar.reset();
     priv->cipher->clear();
     priv->cipher.reset();
     return OK;
@@ -42,7 +42,7 @@ struct CDoc2Writer::Private {
     //
     // Private holds the keys and cipher, thus is is obligatory to destroy it as soon as the encryption is finished
     //
-    Private(libcdoc::DataConsumer *dst, libcdoc::CryptoBackend *crypto) {
+    Private(libcdoc::DataConsumer *dst, libcdoc::CryptoBackend *crypto, libcdoc::Configuration *conf) {
         std::vector<uint8_t> rnd;
         crypto->random(rnd, libcdoc::CDoc2::KEY_LEN);
         fmk = libcdoc::Crypto::extract(rnd, {libcdoc::CDoc2::SALT.cbegin(), libcdoc::CDoc2::SALT.cend()});
@@ -57,25 +57,59 @@ struct CDoc2Writer::Private {
         LOG_TRACE_KEY("hhk: {}", hhk);
         LOG_TRACE_KEY("nonce: {}", hhk);
 
-        libcdoc::CipherConsumer *ccons = new libcdoc::CipherConsumer(dst, false, cipher.get());
-        libcdoc::ZConsumer *zcons = new libcdoc::ZConsumer(ccons, true);
-        tar = std::make_unique<libcdoc::TarConsumer>(zcons, true);
+        // In pipelined mode deflate and cipher stages run behind write-behind buffers in their own threads
+        int pipeline = conf ? conf->getInt(libcdoc::Configuration::PIPELINE) : 0;
+        libcdoc::DataConsumer *cons = new libcdoc::CipherConsumer(dst, false, cipher.get());
+        if (pipeline > 0) cons = new libcdoc::WriteBehindConsumer(cons, true, unsigned(pipeline));
+        int zlib_threads = conf ? conf->getInt(libcdoc::Configuration::ZLIB_THREADS) : 0;
+        if (zlib_threads > 1) {
+            cons = pzcons = new libcdoc::ParallelZConsumer(cons, true, unsigned(zlib_threads));
+        } else {
+            cons = zcons = new libcdoc::ZConsumer(cons, true);
+        }
+        if (pipeline > 0) cons = behind = new libcdoc::WriteBehindConsumer(cons, true, unsigned(pipeline));
+        tar = std::make_unique<libcdoc::TarConsumer>(cons, true);
+        policy = std::make_unique<libcdoc::ConfigCompressionPolicy>(conf);
+    }
+
+    // Switch compression parameters for the file that was just opened in tar
+    libcdoc::result_t setCompression(const std::string& name, int64_t size, const uint8_t *data, size_t len) {
+        libcdoc::CompressionPolicy::Params p = policy->choose(name, size, data, len);
+        if ((p.level == params.level) && (p.strategy == params.strategy)) return libcdoc::OK;
+        auto apply = [zcons = zcons, pzcons = pzcons, p] {
+            return pzcons ? pzcons->setParams(p.level, p.strategy) : zcons->setParams(p.level, p.strategy);
+        };
+        // In pipelined mode the switch is queued after the data of previous file, errors surface on next write
+        libcdoc::result_t result = behind ? behind->post(apply) : apply();
+        if (result == libcdoc::OK) params = p;
+        return result;
     }
 
     ~Private() {
         std::fill(fmk.begin(), fmk.end(), 0);
         std::fill(hhk.begin(), hhk.end(), 0);
+        // Stop the stage threads before the cipher is destroyed
+        tar.reset();
         cipher->clear();
         cipher.reset();
-        tar.reset();
     }
     std::vector<uint8_t> fmk;
     std::vector<uint8_t> hhk;
     std::vector<uint8_t> nonce;
     std::unique_ptr<libcdoc::Crypto::Cipher> cipher;
     std::unique_ptr<libcdoc::TarConsumer> tar;
+    // Stages of tar chain, owned by tar
+    libcdoc::WriteBehindConsumer *behind = nullptr;
+    libcdoc::ZConsumer *zcons = nullptr;
+    libcdoc::ParallelZConsumer *pzcons = nullptr;
+    std::unique_ptr<libcdoc::CompressionPolicy> policy;
+    libcdoc::CompressionPolicy::Params params;
     std::vector<libcdoc::Recipient> recipients;
     bool header_written = false;
+    // The file added last, compression is chosen on its first data
+    std::string name;
+    int64_t size = 0;
+    bool choose = false;
 };
 
 CDoc2Writer::CDoc2Writer(libcdoc::DataConsumer *dst, bool take_ownership)
@@ -101,8 +135,14 @@ CDoc2Writer::encryptInternal(libcdoc::MultiDataSource& src, const std::vector<li
 
     std::string name;
     int64_t size;
+    libcdoc::BufferPool::Buffer buf = libcdoc::BufferPool::get(libcdoc::CompressionPolicy::PROBE_SIZE);
     while (src.next(name, size) == libcdoc::OK) {
         if (priv->tar->open(name, size) < 0) return libcdoc::IO_ERROR;
+        // The first block of file is given to compression policy
+        libcdoc::result_t n_read = src.read(buf.data(), libcdoc::CompressionPolicy::PROBE_SIZE);
+        if (n_read < 0) return libcdoc::IO_ERROR;
+        if (priv->setCompression(name, size, buf.data(), size_t(n_read)) != libcdoc::OK) return libcdoc::IO_ERROR;
+        if ((n_read > 0) && (priv->tar->write(buf.data(), size_t(n_read)) != n_read)) return libcdoc::IO_ERROR;
         if (priv->tar->writeAll(src) < 0) return libcdoc::IO_ERROR;
     }
     if (priv->tar->close() < 0) return libcdoc::IO_ERROR;
@@ -537,7 +577,7 @@ CDoc2Writer::addRecipient(const libcdoc::Recipient& rcpt)
     if (!priv) {
         LOG_WARN("Encryption workflow not started");
         setLastError("Encryption workflow not started");
-        priv = std::make_unique<Private>(dst, crypto);
+        priv = std::make_unique<Private>(dst, crypto, conf);
     }
     priv->recipients.push_back(rcpt);
     return libcdoc::OK;
@@ -550,7 +590,7 @@ CDoc2Writer::beginEncryption()
         LOG_ERROR("Encryption workflow already started");
         setLastError("Encryption workflow already started");
     } else {
-        priv = std::make_unique<Private>(dst, crypto);
+        priv = std::make_unique<Private>(dst, crypto, conf);
     }
     return libcdoc::OK;
 }
@@ -586,6 +626,9 @@ CDoc2Writer::addFile(const std::string& name, size_t size)
         LOG_ERROR("{}", last_error);
         return result;
     }
+    priv->name = name;
+    priv->size = int64_t(size);
+    priv->choose = true;
     return libcdoc::OK;
 }
 
@@ -603,6 +646,15 @@ CDoc2Writer::writeData(const uint8_t *src, size_t size)
         return libcdoc::WORKFLOW_ERROR;
     }
 
+    if (priv->choose) {
+        priv->choose = false;
+        libcdoc::result_t result = priv->setCompression(priv->name, priv->size, src, std::min(size, libcdoc::CompressionPolicy::PROBE_SIZE));
+        if (result != libcdoc::OK) {
+            setLastError(priv->tar->getLastErrorStr(result));
+            LOG_ERROR("{}", last_error);
+            return result;
+        }
+    }
     int64_t result = priv->tar->write(src, size);
     if (result != size) {
         setLastError(priv->tar->getLastErrorStr(result));
@@ -651,7 +703,7 @@ libcdoc::result_t
 CDoc2Writer::encrypt(libcdoc::MultiDataSource& src, const std::vector<libcdoc::Recipient>& keys)
 {
     last_error.clear();
-    priv = std::make_unique<Private>(dst, crypto);
+    priv = std::make_unique<Private>(dst, crypto, conf);
     int result = encryptInternal(src, keys);
     priv.reset();
     if (owned) dst->close();
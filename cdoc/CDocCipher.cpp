@@ -17,9 +17,11 @@
  */
 
 #include "CDocCipher.h"
+#include "BufferPool.h"
 #include "CDocReader.h"
 #include "CDoc2.h"
 #include "ILogger.h"
+#include "Io.h"
 #include "Lock.h"
 #include "NetworkBackend.h"
 #include "PKCS11Backend.h"
@@ -245,14 +247,14 @@ int CDocCipher::writer_push(CDocWriter& writer, const vector<Recipient>& keys, c
         int result = writer.addFile(file, size);
         if (result != libcdoc::OK) return result;
         libcdoc::IStreamSource src(file);
+        libcdoc::BufferPool::Buffer b = libcdoc::BufferPool::get(libcdoc::BufferPool::IO);
         while (!src.isEof()) {
-            uint8_t b[256];
-            int64_t len = src.read(b, 256);
+            int64_t len = src.read(b.data(), b.size());
             if (len < 0) {
                 LOG_ERROR("IO error: {}", file);
                 return 1;
             }
-            int64_t nbytes = writer.writeData(b, len);
+            int64_t nbytes = writer.writeData(b.data(), len);
             if (nbytes < 0) return (int) nbytes;
         }
     }
@@ -406,7 +408,7 @@ int CDocCipher::Encrypt(ToolConf& conf, RecipientInfoVector& recipients)
     if (PUSH) {
         result = writer_push(*writer, rcpts, conf.input_files);
     } else {
-        libcdoc::FileListSource src({}, conf.input_files);
+        libcdoc::PrefetchFileListSource src({}, conf.input_files);
         result = writer->encrypt(src, rcpts);
     }
     if (result < 0) {
@@ -546,29 +548,59 @@ int CDocCipher::Decrypt(const unique_ptr<CDocReader>& rdr, unsigned int lock_idx
             fpath = fpath.filename();
         }
         fpath = base_path / fpath;
+        int64_t n_copied = 0;
+#ifndef _WIN32
+        // Decrypt directly into the mapped destination file
+        libcdoc::MmapFileConsumer ofs(fpath.string(), size);
+        if (ofs.isError()) {
+            LOG_ERROR("Cannot open file {} for writing", fpath.string());
+            return 1;
+        }
+        while (n_copied < size) {
+            uint8_t *dst;
+            int64_t n_avail = ofs.getBuffer(&dst);
+            if (n_avail <= 0) {
+                LOG_ERROR("Cannot write to {}", fpath.string());
+                return 1;
+            }
+            int64_t n_read = rdr->readData(dst, min<int64_t>((size - n_copied), n_avail));
+            if (n_read < 0) {
+                LOG_ERROR("Cannot read {} from container: {}", name, rdr->getLastErrorStr());
+                return 1;
+            } else if (n_read == 0) {
+                break;
+            }
+            ofs.commit(n_read);
+            n_copied += n_read;
+        }
+        if (ofs.close() != libcdoc::OK) {
+            LOG_ERROR("Cannot write to {}", fpath.string());
+            return 1;
+        }
+#else
         std::ofstream ofs(fpath.string(), std::ios_base::binary);
         if (ofs.bad()) {
             LOG_ERROR("Cannot open file {} for writing", fpath.string());
             return 1;
         }
-        int64_t n_copied = 0;
+        libcdoc::BufferPool::Buffer b = libcdoc::BufferPool::get(libcdoc::BufferPool::IO);
         while (n_copied < size) {
-            uint8_t b[4096];
-            int64_t n_to_read = min<int64_t>((size - n_copied), 4096);
-            int64_t n_read = rdr->readData(b, n_to_read);
+            int64_t n_to_read = min<int64_t>((size - n_copied), b.size());
+            int64_t n_read = rdr->readData(b.data(), n_to_read);
             if (n_read < 0) {
                 LOG_ERROR("Cannot read {} from container: {}", name, rdr->getLastErrorStr());
                 return 1;
             } else if (n_read == 0) {
                 break;
             }
-            ofs.write((const char *) b, n_read);
+            ofs.write((const char *) b.data(), n_read);
             if (ofs.bad()) {
                 LOG_ERROR("Cannot write to  {}", fpath.string());
                 return 1;
             }
             n_copied += n_read;
         }
+#endif
         if (n_copied != size) {
             LOG_ERROR("Cannot extract full {}: {}", name, rdr->getLastErrorStr());
             return 1;
@@ -609,6 +641,8 @@ CDocCipher::ReEncrypt(ToolConf& conf, int lock_idx_base_1, const std::string& lo
         crypto.connectLibrary(conf.library);
     }
 
+    // Both containers are streamed once, keep them out of page cache
+    conf.bulk_io = true;
     unique_ptr<CDocReader> rdr(CDocReader::createReader(conf.input_files[0], &conf, &crypto, &network));
     if (!rdr) {
         LOG_ERROR("Cannot create reader (invalid file?)");
@@ -701,17 +735,17 @@ CDocCipher::ReEncrypt(ToolConf& conf, int lock_idx_base_1, const std::string& lo
             return 1;
         }
         int64_t n_copied = 0;
+        libcdoc::BufferPool::Buffer b = libcdoc::BufferPool::get(libcdoc::BufferPool::IO);
         while (n_copied < size) {
-            uint8_t b[4096];
-            int64_t n_to_read = min<int64_t>((size - n_copied), 4096);
-            int64_t n_read = rdr->readData(b, n_to_read);
+            int64_t n_to_read = min<int64_t>((size - n_copied), b.size());
+            int64_t n_read = rdr->readData(b.data(), n_to_read);
             if (n_read < 0) {
                 LOG_ERROR("Cannot read {} from container: {}", name, rdr->getLastErrorStr());
                 return 1;
             } else if (n_read == 0) {
                 break;
             }
-            int64_t nbytes = wrtr->writeData(b, n_read);
+            int64_t nbytes = wrtr->writeData(b.data(), n_read);
             if (nbytes < 0) {
                 LOG_ERROR("Error writing data: {} {}", result, wrtr->getLastErrorStr());
                 return 1;
@@ -165,6 +165,7 @@ public:
      *
      * Creates a new document reader if source is a valid CDoc container (either version 1 or 2).
      * Configuration and NetworkBackend may be null if keyservers are not used.
+     * If Configuration::READ_CACHE is set, the source is read through a page cache (see CachingSource).
      * @param src the container source
      * @param take_ownership if true the source is deleted in reader destructor
      * @param conf a configuration object
@@ -178,6 +179,10 @@ public:
      *
      * Creates a new document reader if file is a valid CDoc container (either version 1 or 2)
      * Configuration and NetworkBackend may be null if keyservers are not used.
+     * On Linux the file is memory-mapped if possible, otherwise it is read through a file descriptor.
+     * If Configuration::DIRECT_IO is set, the file is read with direct I/O instead (not on Windows).
+     * If Configuration::ASYNC_IO is set, the file is read with io_uring instead (see UringFileSource, not on Windows).
+     * If Configuration::READ_AHEAD is set, the file is read ahead in background thread (see ReadAheadSource).
      * @param path the path to file
      * @param conf a configuration object
      * @param crypto a cryptographic backend implementation
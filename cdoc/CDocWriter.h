@@ -144,6 +144,9 @@ public:
      *
      * Creates a new CDoc document writer for file.
      * Configuration and NetworkBackend may be null if keyservers are not used.
+     * If Configuration::DIRECT_IO is set, the file is written with direct I/O (not on Windows).
+     * If Configuration::ASYNC_IO is set, the file is written with io_uring (see UringFileConsumer, not on Windows).
+     * If Configuration::WRITE_BEHIND is set, the file is written in background thread (see WriteBehindConsumer).
      * @param version (1 or 2)
      * @param path output file path
      * @param conf a configuration object
@@ -74,6 +74,74 @@ struct CDOC_EXPORT Configuration {
      * @brief Mobile ID phone number (domain is MOBILE_ID)
      */
     static constexpr char const *PHONE_NUMBER = "PHONE_NUMBER";
+    /**
+     * @brief Read and write container files opened or created by path with io_uring (boolean, see UringFileSource)
+     */
+    static constexpr char const *ASYNC_IO = "ASYNC_IO";
+    /**
+     * @brief Use direct (uncached) I/O for container files opened by path (boolean)
+     */
+    static constexpr char const *DIRECT_IO = "DIRECT_IO";
+    /**
+     * @brief The number of buffers to read ahead in background for container files opened by path (integer, 0 disables)
+     */
+    static constexpr char const *READ_AHEAD = "READ_AHEAD";
+    /**
+     * @brief The number of 64 KiB pages of container source to keep in cache (integer, 0 disables, see CachingSource)
+     */
+    static constexpr char const *READ_CACHE = "READ_CACHE";
+    /**
+     * @brief The number of buffers to write behind in background for container files created by path (integer, 0 disables)
+     */
+    static constexpr char const *WRITE_BEHIND = "WRITE_BEHIND";
+    /**
+     * @brief The number of buffers between tar, deflate and cipher stages of CDoc2 containers (integer, 0 disables)
+     *
+     * If set, each stage runs in its own thread, so that compression overlaps with encryption and I/O.
+     */
+    static constexpr char const *PIPELINE = "PIPELINE";
+    /**
+     * @brief Stream container files opened or created by path without keeping them in page cache (boolean, see FdSource and FdConsumer)
+     */
+    static constexpr char const *BULK_IO = "BULK_IO";
+    /**
+     * @brief Buffer size for plain data transfer in bytes (integer, process-wide, applied by BufferPool::configure)
+     */
+    static constexpr char const *IO_CHUNK_SIZE = "IO_CHUNK_SIZE";
+    /**
+     * @brief Buffer size for compression and decompression in bytes (integer, process-wide, applied by BufferPool::configure)
+     */
+    static constexpr char const *ZLIB_CHUNK_SIZE = "ZLIB_CHUNK_SIZE";
+    /**
+     * @brief The number of threads compressing CDoc2 payload in parallel blocks (integer, 0 or 1 compresses in a single stream)
+     */
+    static constexpr char const *ZLIB_THREADS = "ZLIB_THREADS";
+    /**
+     * @brief Compression level of CDoc2 payload, 0-9 or -1 for zlib default (integer)
+     */
+    static constexpr char const *ZLIB_LEVEL = "ZLIB_LEVEL";
+    /**
+     * @brief Compression strategy of CDoc2 payload (DEFAULT, FILTERED, HUFFMAN_ONLY, RLE or FIXED)
+     */
+    static constexpr char const *ZLIB_STRATEGY = "ZLIB_STRATEGY";
+    /**
+     * @brief Store files that are unlikely to compress without compression (boolean, default true)
+     *
+     * Files are stored if their extension is in ZLIB_STORED_EXTENSIONS or the first block of data looks random.
+     */
+    static constexpr char const *ZLIB_ADAPTIVE = "ZLIB_ADAPTIVE";
+    /**
+     * @brief Comma-separated list of file extensions to store without compression (replaces built-in list of compressed formats)
+     */
+    static constexpr char const *ZLIB_STORED_EXTENSIONS = "ZLIB_STORED_EXTENSIONS";
+    /**
+     * @brief Buffer size for encryption in bytes (integer, process-wide, applied by BufferPool::configure)
+     */
+    static constexpr char const *CIPHER_CHUNK_SIZE = "CIPHER_CHUNK_SIZE";
+    /**
+     * @brief Memory limit in bytes for each whole-payload buffer of CDoc1 containers, larger data is moved to temporary file (integer, see SpillBuffer)
+     */
+    static constexpr char const *SPILL_THRESHOLD = "SPILL_THRESHOLD";
 
 	Configuration() = default;
 	virtual ~Configuration() noexcept = default;
@@ -20,9 +20,11 @@
 #include <windows.h>
 #endif
 
+#include "BufferPool.h"
 #include "CDoc.h"
 #include "Crypto.h"
 #include "ILogger.h"
+#include "Io.h"
 #include "Utils.h"
 
 #define OPENSSL_SUPPRESS_DEPRECATED
@@ -71,6 +73,20 @@ Crypto::Cipher::update(uint8_t *data, int size) const
     return !SSL_FAILED(EVP_CipherUpdate(ctx, data, &len, data, size), "EVP_CipherUpdate");
 }
 
+bool
+Crypto::Cipher::update(uint8_t *dst, const uint8_t *src, size_t size) const
+{
+    // EVP length is int, larger data is processed in 1 GiB steps
+    static constexpr size_t MAX_STEP = 1U << 30;
+    for (size_t pos = 0; pos < size; pos += MAX_STEP) {
+        int len = 0;
+        int n = int(std::min(size - pos, MAX_STEP));
+        if (SSL_FAILED(EVP_CipherUpdate(ctx, dst + pos, &len, src + pos, n), "EVP_CipherUpdate"))
+            return false;
+    }
+    return true;
+}
+
 bool Crypto::Cipher::result() const
 {
 	std::vector<uint8_t> result(EVP_CIPHER_CTX_block_size(ctx), 0);
@@ -311,6 +327,87 @@ std::vector<uint8_t> Crypto::decrypt(const std::string &method, const std::vecto
 	return result;
 }
 
+int64_t
+Crypto::encrypt(const std::string &method, const Key &key, DataSource &src, DataConsumer &dst)
+{
+    const EVP_CIPHER *c = cipher(method);
+    auto ctx = make_unique_ptr<EVP_CIPHER_CTX_free>(EVP_CIPHER_CTX_new());
+    if (!ctx || SSL_FAILED(EVP_CipherInit(ctx.get(), c, key.key.data(), key.iv.data(), 1), "EVP_CipherInit"))
+        return CRYPTO_ERROR;
+    int64_t total = dst.write(key.iv);
+    if (total < 0) return total;
+    BufferPool::Buffer in = BufferPool::get(BufferPool::CIPHER);
+    BufferPool::Buffer out = BufferPool::get(in.size() + size_t(EVP_CIPHER_CTX_block_size(ctx.get())));
+    int size = 0;
+    while (!src.isEof()) {
+        int64_t n_read = src.read(in.data(), in.size());
+        if (n_read < 0) return n_read;
+        if (n_read == 0) break;
+        if (SSL_FAILED(EVP_CipherUpdate(ctx.get(), out.data(), &size, in.data(), int(n_read)), "EVP_CipherUpdate"))
+            return CRYPTO_ERROR;
+        if (int64_t n_written = dst.write(out.data(), size_t(size)); n_written < 0) return n_written;
+        total += size;
+    }
+    if (SSL_FAILED(EVP_CipherFinal(ctx.get(), out.data(), &size), "EVP_CipherFinal"))
+        return CRYPTO_ERROR;
+    if (int64_t n_written = dst.write(out.data(), size_t(size)); n_written < 0) return n_written;
+    total += size;
+    if (EVP_CIPHER_mode(c) == EVP_CIPH_GCM_MODE) {
+        std::vector<uint8_t> tag(16, 0);
+        if (SSL_FAILED(EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_GCM_GET_TAG, int(tag.size()), tag.data()), "EVP_CIPHER_CTX_ctrl"))
+            return CRYPTO_ERROR;
+        if (int64_t n_written = dst.write(tag); n_written < 0) return n_written;
+        total += tag.size();
+        LOG_DBG("GCM TAG {}", toHex(tag));
+    }
+    return total;
+}
+
+int64_t
+Crypto::decrypt(const std::string &method, const std::vector<uint8_t> &key, DataSource &src, DataConsumer &dst)
+{
+    const EVP_CIPHER *c = cipher(method);
+    std::vector<uint8_t> iv(size_t(EVP_CIPHER_iv_length(c)));
+    if (src.read(iv.data(), iv.size()) != int64_t(iv.size()))
+        return CRYPTO_ERROR;
+
+    auto ctx = make_unique_ptr<EVP_CIPHER_CTX_free>(EVP_CIPHER_CTX_new());
+    if (!ctx || SSL_FAILED(EVP_CipherInit(ctx.get(), c, key.data(), iv.data(), 0), "EVP_CipherInit"))
+        return CRYPTO_ERROR;
+
+    // GCM tag is at the end of data, keep the last bytes back until the end is reached
+    size_t tag_len = (EVP_CIPHER_mode(c) == EVP_CIPH_GCM_MODE) ? 16 : 0;
+    BufferPool::Buffer in = BufferPool::get(BufferPool::CIPHER);
+    BufferPool::Buffer out = BufferPool::get(in.size() + size_t(EVP_CIPHER_CTX_block_size(ctx.get())));
+    size_t n_held = 0;
+    int64_t total = 0;
+    int size = 0;
+    while (!src.isEof()) {
+        int64_t n_read = src.read(in.data() + n_held, in.size() - n_held);
+        if (n_read < 0) return n_read;
+        if (n_read == 0) break;
+        size_t n_avail = n_held + size_t(n_read);
+        size_t n_process = (n_avail > tag_len) ? n_avail - tag_len : 0;
+        if (SSL_FAILED(EVP_CipherUpdate(ctx.get(), out.data(), &size, in.data(), int(n_process)), "EVP_CipherUpdate"))
+            return CRYPTO_ERROR;
+        if (int64_t n_written = dst.write(out.data(), size_t(size)); n_written < 0) return n_written;
+        total += size;
+        n_held = n_avail - n_process;
+        std::memmove(in.data(), in.data() + n_process, n_held);
+    }
+    if (n_held != tag_len)
+        return CRYPTO_ERROR;
+    if (tag_len) {
+        LOG_DBG("GCM TAG {}", toHex(std::vector<uint8_t>(in.data(), in.data() + tag_len)));
+        if (SSL_FAILED(EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_GCM_SET_TAG, int(tag_len), in.data()), "EVP_CIPHER_CTX_ctrl"))
+            return CRYPTO_ERROR;
+    }
+    if (SSL_FAILED(EVP_CipherFinal(ctx.get(), out.data(), &size), "EVP_CipherFinal"))
+        return CRYPTO_ERROR;
+    if (int64_t n_written = dst.write(out.data(), size_t(size)); n_written < 0) return n_written;
+    return total + size;
+}
+
 std::vector<uint8_t> Crypto::decodeBase64(const uint8_t *data)
 {
 	std::vector<uint8_t> result;
@@ -344,6 +441,42 @@ std::vector<uint8_t> Crypto::decodeBase64(const uint8_t *data)
 	return result;
 }
 
+int64_t
+Crypto::decodeBase64(const uint8_t *data, DataConsumer &dst)
+{
+    if (!data)
+    {
+        LOG_ERROR("decodeBase64: null pointer was provided as input data");
+        return WRONG_ARGUMENTS;
+    }
+    auto ctx = make_unique_ptr<EVP_ENCODE_CTX_free>(EVP_ENCODE_CTX_new());
+    if (!ctx)
+    {
+        LOG_SSL_ERROR("EVP_ENCODE_CTX_new");
+        return CRYPTO_ERROR;
+    }
+    // Output of each update is at most 3/4 of input plus the bytes kept from previous update
+    static constexpr size_t CHUNK = 64 * 1024;
+    BufferPool::Buffer out = BufferPool::get(CHUNK);
+    EVP_DecodeInit(ctx.get());
+    size_t len = strlen((const char *) data);
+    int64_t total = 0;
+    int size = 0;
+    for (size_t pos = 0; pos < len; pos += CHUNK) {
+        if (EVP_DecodeUpdate(ctx.get(), out.data(), &size, data + pos, int(std::min(CHUNK, len - pos))) == -1)
+        {
+            LOG_SSL_ERROR("EVP_DecodeUpdate");
+            return CRYPTO_ERROR;
+        }
+        if (int64_t n_written = dst.write(out.data(), size_t(size)); n_written < 0) return n_written;
+        total += size;
+    }
+    if (SSL_FAILED(EVP_DecodeFinal(ctx.get(), out.data(), &size), "EVP_DecodeFinal"))
+        return CRYPTO_ERROR;
+    if (int64_t n_written = dst.write(out.data(), size_t(size)); n_written < 0) return n_written;
+    return total + size;
+}
+
 std::vector<uint8_t> Crypto::deriveSharedSecret(EVP_PKEY *pkey, EVP_PKEY *peerPKey)
 {
 	std::vector<uint8_t> sharedSecret;
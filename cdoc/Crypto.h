@@ -31,6 +31,9 @@ typedef struct x509_st X509;
 
 namespace libcdoc {
 
+struct DataConsumer;
+struct DataSource;
+
 #define SSL_FAILED(retval,func) Crypto::isError((retval), (func), __FILE__, __LINE__)
 #define LOG_SSL_ERROR(func) Crypto::LogSslError((func), __FILE__, __LINE__)
 
@@ -45,6 +48,7 @@ public:
 		~Cipher();
 		bool updateAAD(const std::vector<uint8_t> &data) const;
 		bool update(uint8_t *data, int size) const;
+		bool update(uint8_t *dst, const uint8_t *src, size_t size) const;
 		bool result() const;
 		static constexpr int tagLen() { return 16; }
 		std::vector<uint8_t> tag() const;
@@ -81,8 +85,12 @@ public:
 		const std::vector<uint8_t> &AlgorithmID, const std::vector<uint8_t> &PartyUInfo, const std::vector<uint8_t> &PartyVInfo);
     static std::vector<uint8_t> encrypt(const std::string &method, const Key &key, const std::vector<uint8_t> &data);
 	static std::vector<uint8_t> decrypt(const std::string &method, const std::vector<uint8_t> &key, const std::vector<uint8_t> &data);
+	// Streaming variants with the same data layout (IV, ciphertext, GCM tag), return the number of bytes written or error code
+	static int64_t encrypt(const std::string &method, const Key &key, DataSource &src, DataConsumer &dst);
+	static int64_t decrypt(const std::string &method, const std::vector<uint8_t> &key, DataSource &src, DataConsumer &dst);
 	static std::vector<uint8_t> encrypt(EVP_PKEY *pub, int padding, const std::vector<uint8_t> &data);
 	static std::vector<uint8_t> decodeBase64(const uint8_t *data);
+	static int64_t decodeBase64(const uint8_t *data, DataConsumer &dst);
 	static std::vector<uint8_t> deriveSharedSecret(EVP_PKEY *pkey, EVP_PKEY *peerPKey);
 	static Key generateKey(const std::string &method);
 	static uint32_t keySize(const std::string &algo);
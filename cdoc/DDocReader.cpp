@@ -21,10 +21,14 @@
 #include "Io.h"
 #include "XmlReader.h"
 
+#include <functional>
+
 using namespace libcdoc;
 
-int
-DDOCReader::parse(libcdoc::DataSource *src, libcdoc::MultiDataConsumer *dst)
+using ParseCallback = std::function<int(const std::string& name, std::unique_ptr<libcdoc::SpillBuffer> content)>;
+
+static int
+parseFiles(libcdoc::DataSource *src, size_t memory_limit, const ParseCallback& f)
 {
 	XMLReader reader(src);
 	while(reader.read()) {
@@ -32,39 +36,35 @@ DDOCReader::parse(libcdoc::DataSource *src, libcdoc::MultiDataConsumer *dst)
 		// EncryptedData
 		if(!reader.isElement("DataFile")) continue;
 		std::string name = reader.attribute("Filename");
-		std::vector<uint8_t> content = reader.readBase64();
-        int result = dst->open(name, content.size());
-        if (result != libcdoc::OK) return result;
-        int64_t n_written = dst->write(content.data(), content.size());
-        if (n_written < 0) return (int) n_written;
-        result = dst->close();
-        if (result != libcdoc::OK) return result;
-    }
-    return (dst->isError()) ? libcdoc::IO_ERROR : libcdoc::OK;
+		auto content = std::make_unique<libcdoc::SpillBuffer>(memory_limit);
+		if (auto result = reader.readBase64(*content); result < 0) return (int) result;
+		if (int result = f(name, std::move(content)); result != libcdoc::OK) return result;
+	}
+	return libcdoc::OK;
 }
 
-struct DDocFileListConsumer : public libcdoc::MultiDataConsumer {
-	std::vector<DDOCReader::File> files;
-
-	explicit DDocFileListConsumer() = default;
-	int64_t write(const uint8_t *src, size_t size) override final {
-		DDOCReader::File& file = files.back();
-		file.data.insert(file.data.end(), src, src + size);
-		return size;
-	}
-    libcdoc::result_t close() override final { return libcdoc::OK; }
-	bool isError() override final { return false; }
-    libcdoc::result_t open(const std::string& name, int64_t size) override final {
-		files.push_back({name, "application/octet-stream", {}});
-		return libcdoc::OK;
-	}
-};
+int
+DDOCReader::parse(libcdoc::DataSource *src, libcdoc::MultiDataConsumer *dst, size_t memory_limit)
+{
+	int result = parseFiles(src, memory_limit, [dst](const std::string& name, std::unique_ptr<libcdoc::SpillBuffer> content) {
+		int result = dst->open(name, content->size());
+		if (result == libcdoc::OK) result = dst->reserve(content->size());
+		if (result != libcdoc::OK) return result;
+		int64_t n_written = dst->writeAll(*content);
+		if (n_written < 0) return (int) n_written;
+		return (int) dst->close();
+	});
+	if (result != libcdoc::OK) return result;
+	return (dst->isError()) ? libcdoc::IO_ERROR : libcdoc::OK;
+}
 
 std::vector<DDOCReader::File>
-DDOCReader::files(const std::vector<uint8_t> &data)
+DDOCReader::files(libcdoc::DataSource *src, size_t memory_limit)
 {
-	libcdoc::VectorSource src(data);
-	DDocFileListConsumer list;
-	parse(&src, &list);
-	return std::move(list.files);
+	std::vector<File> files;
+	parseFiles(src, memory_limit, [&files](const std::string& name, std::unique_ptr<libcdoc::SpillBuffer> content) {
+		files.push_back({name, "application/octet-stream", std::move(content)});
+		return libcdoc::OK;
+	});
+	return files;
 }
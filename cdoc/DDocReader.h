@@ -18,26 +18,25 @@
 
 #pragma once
 
+#include "Io.h"
+
 #include <string>
 #include <vector>
 #include <cstdint>
 
 namespace libcdoc {
 
-struct DataSource;
-struct MultiDataConsumer;
-
 class DDOCReader
 {
 public:
 	struct File
 	{
 		std::string name, mime;
-		std::vector<uint8_t> data;
+		std::unique_ptr<SpillBuffer> data;
 	};
-	static int parse(libcdoc::DataSource *src, libcdoc::MultiDataConsumer *dst);
+	static int parse(libcdoc::DataSource *src, libcdoc::MultiDataConsumer *dst, size_t memory_limit = SpillBuffer::DEFAULT_MEMORY_LIMIT);
 
-	static std::vector<File> files(const std::vector<uint8_t> &data);
+	static std::vector<File> files(libcdoc::DataSource *src, size_t memory_limit = SpillBuffer::DEFAULT_MEMORY_LIMIT);
 };
 
 } // namespace libcdoc
\ No newline at end of file
@@ -43,6 +43,12 @@ DDOCWriter::DDOCWriter(std::vector<uint8_t>& vec)
     writeStartElement(DDOC, "SignedDoc", {{"format", "DIGIDOC-XML"}, {"version", "1.3"}});
 }
 
+DDOCWriter::DDOCWriter(DataConsumer *dst)
+    : XMLWriter(dst)
+{
+    writeStartElement(DDOC, "SignedDoc", {{"format", "DIGIDOC-XML"}, {"version", "1.3"}});
+}
+
 DDOCWriter::~DDOCWriter()
 {
     writeEndElement(DDOC); // SignedDoc
@@ -64,3 +70,21 @@ uint64_t DDOCWriter::addFile(const std::string &file, const std::string &mime, c
 		{"Size", std::to_string(data.size())}
 	});
 }
+
+/**
+ * Add File to container
+ * @param file Filename
+ * @param mime File mime type
+ * @param src File content, read until the end
+ * @param size File size
+ */
+uint64_t DDOCWriter::addFile(const std::string &file, const std::string &mime, DataSource &src, uint64_t size)
+{
+    return writeBase64Element(DDOC, "DataFile", src, {
+        {"ContentType", "EMBEDDED_BASE64"},
+        {"Filename", file},
+        {"Id", "D" + std::to_string(fileCount++)},
+        {"MimeType", mime},
+        {"Size", std::to_string(size)}
+    });
+}
@@ -27,9 +27,11 @@ class DDOCWriter: public XMLWriter
 public:
 	DDOCWriter(const std::string &path);
 	DDOCWriter(std::vector<uint8_t>& vec);
+	DDOCWriter(DataConsumer *dst);
 	~DDOCWriter();
 
     uint64_t addFile(const std::string &name, const std::string &mime, const std::vector<unsigned char> &data);
+    uint64_t addFile(const std::string &name, const std::string &mime, DataSource &src, uint64_t size);
 
 private:
 	DDOCWriter(const DDOCWriter &) = delete;
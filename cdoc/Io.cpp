@@ -17,10 +17,40 @@
  */
 
 #include "Io.h"
+#include "BufferPool.h"
+#include "ILogger.h"
 
-namespace libcdoc {
+#ifdef _WIN32
+#include "Utils.h"
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#endif
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
 
-static constexpr size_t BLOCK_SIZE = 65536;
+namespace libcdoc {
 
 std::string
 DataConsumer::getLastErrorStr(result_t code) const
@@ -57,14 +87,27 @@ DataSource::getLastErrorStr(result_t code) const
 int64_t
 DataConsumer::writeAll(DataSource& src)
 {
-	static const size_t BUF_SIZE = 64 * 1024;
-	uint8_t buf[BUF_SIZE];
+	size_t chunk_size = BufferPool::getChunkSize(BufferPool::IO);
 	size_t total_read = 0;
+	const uint8_t *ptr = nullptr;
+	int64_t n_avail = src.peek(&ptr, chunk_size);
+	if (n_avail != NOT_IMPLEMENTED) {
+		// Borrowing source, write directly from its buffers
+		while (n_avail > 0) {
+			int64_t n_written = write(ptr, n_avail);
+			if (n_written < 0) return n_written;
+			if (auto result = src.consume(n_avail); result != OK) return result;
+			total_read += n_written;
+			n_avail = src.peek(&ptr, chunk_size);
+		}
+		return (n_avail < 0) ? n_avail : total_read;
+	}
+	BufferPool::Buffer buf = BufferPool::get(chunk_size);
 	while (!src.isEof()) {
-		int64_t n_read = src.read(buf, BUF_SIZE);
+		int64_t n_read = src.read(buf.data(), buf.size());
 		if (n_read < 0) return n_read;
 		if (n_read > 0) {
-			int64_t n_written = write(buf, n_read);
+			int64_t n_written = write(buf.data(), n_read);
 			if (n_written < 0) return n_written;
 			total_read += n_written;
 		}
@@ -74,14 +117,31 @@ DataConsumer::writeAll(DataSource& src)
 
 int64_t
 DataSource::skip(size_t size) {
-	uint8_t b[BLOCK_SIZE];
+	if (!size) return 0;
+	// Seekable sources jump over data, if seek fails the end of data is found by reading
+	result_t pos = tell();
+	if ((pos >= 0) && (seek(pos + size) == OK)) return size;
+	// Borrowing sources advance without copying
+	const uint8_t *ptr;
+	result_t n_avail = peek(&ptr, size);
+	if (n_avail != NOT_IMPLEMENTED) {
+		size_t total_skipped = 0;
+		while (n_avail > 0) {
+			if (auto result = consume(n_avail); result != OK) return result;
+			total_skipped += n_avail;
+			if (total_skipped >= size) break;
+			n_avail = peek(&ptr, size - total_skipped);
+		}
+		return (n_avail < 0) ? n_avail : total_skipped;
+	}
+	BufferPool::Buffer b = BufferPool::get(std::min(size, BufferPool::getChunkSize(BufferPool::IO)));
 	size_t total_read = 0;
 	while (total_read < size) {
-		size_t to_read = std::min<size_t>(size - total_read, BLOCK_SIZE);
-		int64_t n_read = read(b, to_read);
+		size_t to_read = std::min<size_t>(size - total_read, b.size());
+		int64_t n_read = read(b.data(), to_read);
 		if (n_read < 0) return n_read;
 		total_read += n_read;
-        if (n_read < to_read) break;
+        if (size_t(n_read) < to_read) break;
 	}
 	return total_read;
 }
@@ -91,58 +151,2673 @@ IStreamSource::IStreamSource(const std::string& path)
 {
 }
 
-OStreamConsumer::OStreamConsumer(const std::string& path)
-	: OStreamConsumer(new std::ofstream(path, std::ios_base::binary), true)
+MmapSource::MmapSource(const std::string& path)
 {
+#ifdef _WIN32
+    HANDLE file = CreateFileW(toWide(path).c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        _error = INPUT_STREAM_ERROR;
+        return;
+    }
+    LARGE_INTEGER fsize;
+    if (!GetFileSizeEx(file, &fsize)) {
+        CloseHandle(file);
+        _error = INPUT_STREAM_ERROR;
+        return;
+    }
+    _size = size_t(fsize.QuadPart);
+    if (_size > 0) {
+        _mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (_mapping) _data = (const uint8_t *) MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!_data) _error = INPUT_STREAM_ERROR;
+    }
+    CloseHandle(file);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        _error = INPUT_STREAM_ERROR;
+        return;
+    }
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || !S_ISREG(st.st_mode)) {
+        ::close(fd);
+        _error = INPUT_STREAM_ERROR;
+        return;
+    }
+    _size = size_t(st.st_size);
+    if (_size > 0) {
+        void *map = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            _data = (const uint8_t *) map;
+        } else {
+            _error = INPUT_STREAM_ERROR;
+        }
+    }
+    // The mapping stays valid after the descriptor is closed
+    ::close(fd);
+#endif
+    if (_error != OK) _size = 0;
 }
 
-FileListSource::FileListSource(const std::string& base, const std::vector<std::string>& files)
-	: _base(base), _files(files), _current(-1)
+MmapSource::~MmapSource()
 {
+#ifdef _WIN32
+    if (_data) UnmapViewOfFile(_data);
+    if (_mapping) CloseHandle(_mapping);
+#else
+    if (_data) munmap((void *) _data, _size);
+#endif
 }
 
-int64_t
-FileListSource::read(uint8_t *dst, size_t size)
+result_t
+MmapSource::seek(size_t pos)
 {
-	if ((_current < 0) || (_current >= _files.size())) return WORKFLOW_ERROR;
-	_ifs.read((char *) dst, size);
-	return (_ifs.bad()) ? INPUT_STREAM_ERROR : _ifs.gcount();
+    if (_error != OK) return _error;
+    if (pos > _size) return INPUT_STREAM_ERROR;
+    _ptr = pos;
+    return OK;
+}
+
+result_t
+MmapSource::tell()
+{
+    if (_error != OK) return _error;
+    return _ptr;
+}
+
+result_t
+MmapSource::read(uint8_t *dst, size_t size)
+{
+    if (_error != OK) return _error;
+    size = std::min<size_t>(size, _size - _ptr);
+    if (size) std::memcpy(dst, _data + _ptr, size);
+    _ptr += size;
+    return size;
+}
+
+result_t
+MmapSource::peek(const uint8_t **ptr, size_t max)
+{
+    if (_error != OK) return _error;
+    *ptr = _data + _ptr;
+    return std::min<size_t>(max, _size - _ptr);
+}
+
+result_t
+MmapSource::consume(size_t size)
+{
+    if (_error != OK) return _error;
+    if (size > _size - _ptr) return WRONG_ARGUMENTS;
+    _ptr += size;
+    return OK;
+}
+
+#ifndef _WIN32
+MmapFileConsumer::MmapFileConsumer(const std::string& path, uint64_t size)
+{
+    _fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (_fd < 0) {
+        LOG_ERROR("Cannot open {}: {}", path, strerror(errno));
+        _error = OUTPUT_STREAM_ERROR;
+        return;
+    }
+    if (size > 0) _error = map(size);
+}
+
+MmapFileConsumer::~MmapFileConsumer()
+{
+    close();
+}
+
+result_t
+MmapFileConsumer::map(uint64_t size)
+{
+    if (size > uint64_t(std::numeric_limits<size_t>::max())) return OUTPUT_ERROR;
+    if (_data) {
+        munmap(_data, _size);
+        _data = nullptr;
+        _size = 0;
+    }
+    if (ftruncate(_fd, off_t(size)) != 0) {
+        LOG_ERROR("Cannot resize file: {}", strerror(errno));
+        return OUTPUT_ERROR;
+    }
+    void *map = mmap(nullptr, size_t(size), PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+    if (map == MAP_FAILED) {
+        LOG_ERROR("Cannot map file: {}", strerror(errno));
+        return OUTPUT_ERROR;
+    }
+    _data = (uint8_t *) map;
+    _size = size;
+    return OK;
+}
+
+result_t
+MmapFileConsumer::reserve(uint64_t size)
+{
+    if (_error != OK) return _error;
+    if (_fd < 0) return WORKFLOW_ERROR;
+    if (size <= _size - _pos) return OK;
+    // Grow geometrically to keep the number of remaps low for unknown sizes
+    _error = map(std::max(_pos + size, 2 * _size));
+    return _error;
+}
+
+result_t
+MmapFileConsumer::write(const uint8_t *src, size_t size)
+{
+    if (_error != OK) return _error;
+    if (!size) return 0;
+    if (auto result = reserve(size); result != OK) return result;
+    std::memcpy(_data + _pos, src, size);
+    _pos += size;
+    return size;
+}
+
+result_t
+MmapFileConsumer::getBuffer(uint8_t **ptr)
+{
+    if (_error != OK) return _error;
+    if (_fd < 0) return WORKFLOW_ERROR;
+    *ptr = _data + _pos;
+    return _size - _pos;
+}
+
+result_t
+MmapFileConsumer::commit(size_t size)
+{
+    if (_error != OK) return _error;
+    if (size > _size - _pos) return WRONG_ARGUMENTS;
+    _pos += size;
+    return OK;
+}
+
+result_t
+MmapFileConsumer::close()
+{
+    if (_fd < 0) return _error;
+    if (_data) munmap(_data, _size);
+    _data = nullptr;
+    // Drop the preallocated tail if less data was written than expected
+    if ((_pos != _size) && (ftruncate(_fd, off_t(_pos)) != 0) && (_error == OK)) _error = OUTPUT_ERROR;
+    if ((::close(_fd) != 0) && (_error == OK)) _error = OUTPUT_ERROR;
+    _fd = -1;
+    _size = 0;
+    return _error;
+}
+
+// Open file for direct I/O, falling back to normal I/O if not supported by the filesystem
+static int
+openDirect(const std::string& path, int flags, bool& direct)
+{
+    int fd = -1;
+#ifdef O_DIRECT
+    fd = ::open(path.c_str(), flags | O_DIRECT | O_CLOEXEC, 0666);
+    direct = fd >= 0;
+    if ((fd >= 0) || (errno != EINVAL)) return fd;
+#endif
+    fd = ::open(path.c_str(), flags | O_CLOEXEC, 0666);
+    direct = false;
+#ifdef F_NOCACHE
+    if (fd >= 0) direct = fcntl(fd, F_NOCACHE, 1) == 0;
+#endif
+    return fd;
+}
+
+// Clear O_DIRECT from file status flags
+static bool
+clearDirect(int fd)
+{
+#ifdef O_DIRECT
+    int flags = fcntl(fd, F_GETFL);
+    return (flags >= 0) && (fcntl(fd, F_SETFL, flags & ~O_DIRECT) == 0);
+#else
+    return true;
+#endif
+}
+
+static size_t
+alignedSize(size_t size, size_t alignment)
+{
+    return std::max(alignment, (size + alignment - 1) & ~(alignment - 1));
+}
+
+DirectFileConsumer::DirectFileConsumer(const std::string& path, size_t buffer_size)
+    : _buf_size(alignedSize(buffer_size, ALIGNMENT))
+{
+    void *buf = nullptr;
+    if (posix_memalign(&buf, ALIGNMENT, _buf_size) != 0) {
+        _error = OUTPUT_ERROR;
+        return;
+    }
+    _buf = (uint8_t *) buf;
+    _fd = openDirect(path, O_WRONLY | O_CREAT | O_TRUNC, _direct);
+    if (_fd < 0) _error = OUTPUT_STREAM_ERROR;
+}
+
+DirectFileConsumer::~DirectFileConsumer()
+{
+    if (_fd >= 0) close();
+    free(_buf);
+}
+
+result_t
+DirectFileConsumer::writeBuffer(size_t len)
+{
+    size_t n_written = 0;
+    while (n_written < len) {
+        ssize_t result = ::write(_fd, _buf + n_written, len - n_written);
+        if (result < 0) {
+            if (errno == EINTR) continue;
+            // Some filesystems accept O_DIRECT at open but not for writes
+            if ((errno == EINVAL) && _direct && clearDirect(_fd)) {
+                _direct = false;
+                continue;
+            }
+            _error = OUTPUT_STREAM_ERROR;
+            return _error;
+        }
+        n_written += result;
+    }
+    return OK;
+}
+
+result_t
+DirectFileConsumer::write(const uint8_t *src, size_t size)
+{
+    if (_error != OK) return _error;
+    if (_fd < 0) return WORKFLOW_ERROR;
+    size_t n_copied = 0;
+    while (n_copied < size) {
+        size_t n = std::min(size - n_copied, _buf_size - _buf_len);
+        std::memcpy(_buf + _buf_len, src + n_copied, n);
+        _buf_len += n;
+        n_copied += n;
+        if (_buf_len == _buf_size) {
+            if (writeBuffer(_buf_size) != OK) return _error;
+            _buf_len = 0;
+        }
+    }
+    return size;
+}
+
+result_t
+DirectFileConsumer::close()
+{
+    if (_fd < 0) return _error;
+    if ((_error == OK) && _buf_len) {
+        // Write whole blocks directly, the unaligned tail has to go through the page cache
+        size_t aligned = _buf_len & ~(ALIGNMENT - 1);
+        if (aligned && (writeBuffer(aligned) == OK)) {
+            std::memmove(_buf, _buf + aligned, _buf_len - aligned);
+            _buf_len -= aligned;
+        }
+        if ((_error == OK) && _buf_len) {
+            if (!clearDirect(_fd)) _error = OUTPUT_STREAM_ERROR;
+            else writeBuffer(_buf_len);
+        }
+        _buf_len = 0;
+    }
+    if ((::close(_fd) != 0) && (_error == OK)) _error = OUTPUT_STREAM_ERROR;
+    _fd = -1;
+    return _error;
+}
+
+DirectFileSource::DirectFileSource(const std::string& path, size_t buffer_size)
+    : _buf_size(alignedSize(buffer_size, ALIGNMENT))
+{
+    void *buf = nullptr;
+    if (posix_memalign(&buf, ALIGNMENT, _buf_size) != 0) {
+        _error = INPUT_ERROR;
+        return;
+    }
+    _buf = (uint8_t *) buf;
+    _fd = openDirect(path, O_RDONLY, _direct);
+    struct stat st;
+    if ((_fd < 0) || (fstat(_fd, &st) != 0) || !S_ISREG(st.st_mode)) {
+        _error = INPUT_STREAM_ERROR;
+        return;
+    }
+    _size = uint64_t(st.st_size);
+}
+
+DirectFileSource::~DirectFileSource()
+{
+    if (_fd >= 0) ::close(_fd);
+    free(_buf);
+}
+
+result_t
+DirectFileSource::fill(uint64_t offset)
+{
+    _buf_offset = offset;
+    _buf_len = 0;
+    _buf_pos = 0;
+    while (_buf_len < _buf_size) {
+        ssize_t result = pread(_fd, _buf + _buf_len, _buf_size - _buf_len, off_t(offset + _buf_len));
+        if (result < 0) {
+            if (errno == EINTR) continue;
+            // Some filesystems accept O_DIRECT at open but not for reads
+            if ((errno == EINVAL) && _direct && clearDirect(_fd)) {
+                _direct = false;
+                continue;
+            }
+            _error = INPUT_STREAM_ERROR;
+            return _error;
+        }
+        if (result == 0) break;
+        _buf_len += result;
+    }
+    return OK;
+}
+
+result_t
+DirectFileSource::seek(size_t pos)
+{
+    if (_error != OK) return _error;
+    if (pos > _size) return INPUT_STREAM_ERROR;
+    if ((pos >= _buf_offset) && (pos <= _buf_offset + _buf_len)) {
+        _buf_pos = size_t(pos - _buf_offset);
+        return OK;
+    }
+    uint64_t offset = pos & ~uint64_t(ALIGNMENT - 1);
+    if (fill(offset) != OK) return _error;
+    _buf_pos = size_t(pos - offset);
+    return OK;
+}
+
+result_t
+DirectFileSource::tell()
+{
+    if (_error != OK) return _error;
+    return _buf_offset + _buf_pos;
+}
+
+result_t
+DirectFileSource::read(uint8_t *dst, size_t size)
+{
+    if (_error != OK) return _error;
+    size_t n_copied = 0;
+    while (n_copied < size) {
+        if (_buf_pos >= _buf_len) {
+            uint64_t pos = _buf_offset + _buf_pos;
+            if (pos >= _size) break;
+            if (fill(pos) != OK) return _error;
+            if (!_buf_len) break;
+        }
+        size_t n = std::min(size - n_copied, _buf_len - _buf_pos);
+        std::memcpy(dst + n_copied, _buf + _buf_pos, n);
+        _buf_pos += n;
+        n_copied += n;
+    }
+    return n_copied;
+}
+
+result_t
+DirectFileSource::peek(const uint8_t **ptr, size_t max)
+{
+    if (_error != OK) return _error;
+    if (_buf_pos >= _buf_len) {
+        uint64_t pos = _buf_offset + _buf_pos;
+        if (pos >= _size) return 0;
+        if (fill(pos) != OK) return _error;
+    }
+    *ptr = _buf + _buf_pos;
+    return std::min(max, _buf_len - _buf_pos);
+}
+
+result_t
+DirectFileSource::consume(size_t size)
+{
+    if (_error != OK) return _error;
+    if (size > _buf_len - _buf_pos) return WRONG_ARGUMENTS;
+    _buf_pos += size;
+    return OK;
+}
+
+FdSource::FdSource(int fd, bool take_ownership, size_t buffer_size)
+    : _fd(fd), _owned(take_ownership), _buf(std::max<size_t>(buffer_size, 1))
+{
+    if (_fd < 0) {
+        _error = INPUT_STREAM_ERROR;
+        return;
+    }
+    off_t offset = lseek(_fd, 0, SEEK_CUR);
+    if (offset < 0) return;
+    // Pipes and sockets fail above, character devices may accept lseek without seeking
+    struct stat st;
+    if (fstat(_fd, &st) != 0) return;
+    if (S_ISREG(st.st_mode)) {
+        _size = int64_t(st.st_size);
+    } else if (!S_ISBLK(st.st_mode)) {
+        return;
+    }
+    _seekable = true;
+    _offset = uint64_t(offset);
+}
+
+FdSource::FdSource(const std::string& path, size_t buffer_size)
+    : FdSource(::open(path.c_str(), O_RDONLY | O_CLOEXEC), true, buffer_size)
+{
+    if (_fd < 0) _errno = errno;
+}
+
+FdSource::~FdSource()
+{
+    if (_owned && (_fd >= 0)) ::close(_fd);
+}
+
+// Drop the range [start, end) of file from page cache, writing out dirty pages first
+static void
+dropCache(int fd, uint64_t start, uint64_t end, bool dirty)
+{
+    if (end <= start) return;
+    if (dirty) {
+#ifdef SYNC_FILE_RANGE_WRITE
+        sync_file_range(fd, off_t(start), off_t(end - start), SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+#elif defined(POSIX_FADV_DONTNEED)
+        fdatasync(fd);
+#endif
+    }
+#ifdef POSIX_FADV_DONTNEED
+    posix_fadvise(fd, off_t(start), off_t(end - start), POSIX_FADV_DONTNEED);
+#endif
+}
+
+void
+FdSource::setBulk(bool bulk)
+{
+    _bulk = bulk;
+    _dropped = _offset;
+#ifdef POSIX_FADV_SEQUENTIAL
+    if (_fd >= 0) posix_fadvise(_fd, 0, 0, bulk ? POSIX_FADV_SEQUENTIAL : POSIX_FADV_NORMAL);
+#endif
+}
+
+void
+FdSource::advance(size_t size)
+{
+    _offset += size;
+    if (_bulk && (_offset - _dropped >= BULK_WINDOW)) {
+        dropCache(_fd, _dropped, _offset, false);
+        _dropped = _offset;
+    }
+}
+
+result_t
+FdSource::fill()
+{
+    _buf_len = 0;
+    _buf_pos = 0;
+    while (true) {
+        ssize_t result = ::read(_fd, _buf.data(), _buf.size());
+        if (result < 0) {
+            if (errno == EINTR) continue;
+            _errno = errno;
+            _error = INPUT_STREAM_ERROR;
+            return _error;
+        }
+        if (result == 0) _eof = true;
+        _buf_len = result;
+        advance(result);
+        return OK;
+    }
+}
+
+result_t
+FdSource::seek(size_t pos)
+{
+    if (_error != OK) return _error;
+    // Seeking inside the buffer works on pipes and sockets too
+    uint64_t start = _offset - _buf_len;
+    if ((pos >= start) && (pos <= _offset)) {
+        _buf_pos = size_t(pos - start);
+        return OK;
+    }
+    if (!_seekable) return NOT_IMPLEMENTED;
+    if ((_size >= 0) && (pos > uint64_t(_size))) return INPUT_STREAM_ERROR;
+    if (lseek(_fd, off_t(pos), SEEK_SET) < 0) return INPUT_STREAM_ERROR;
+    _offset = pos;
+    _dropped = pos;
+    _buf_len = 0;
+    _buf_pos = 0;
+    _eof = false;
+    return OK;
+}
+
+result_t
+FdSource::tell()
+{
+    if (_error != OK) return _error;
+    return _offset - _buf_len + _buf_pos;
+}
+
+result_t
+FdSource::read(uint8_t *dst, size_t size)
+{
+    if (_error != OK) return _error;
+    size_t n_copied = 0;
+    while (n_copied < size) {
+        if (_buf_pos < _buf_len) {
+            size_t n = std::min(size - n_copied, _buf_len - _buf_pos);
+            std::memcpy(dst + n_copied, _buf.data() + _buf_pos, n);
+            _buf_pos += n;
+            n_copied += n;
+            continue;
+        }
+        if (_eof) break;
+        if ((size - n_copied) >= _buf.size()) {
+            // Large read, bypass the buffer
+            ssize_t result = ::read(_fd, dst + n_copied, size - n_copied);
+            if (result < 0) {
+                if (errno == EINTR) continue;
+                _errno = errno;
+                _error = INPUT_STREAM_ERROR;
+                return _error;
+            }
+            if (result == 0) _eof = true;
+            _buf_len = 0;
+            _buf_pos = 0;
+            advance(result);
+            n_copied += result;
+        } else if (fill() != OK) {
+            return _error;
+        }
+    }
+    return n_copied;
+}
+
+result_t
+FdSource::peek(const uint8_t **ptr, size_t max)
+{
+    if (_error != OK) return _error;
+    if ((_buf_pos >= _buf_len) && !_eof) {
+        if (fill() != OK) return _error;
+    }
+    *ptr = _buf.data() + _buf_pos;
+    return std::min(max, _buf_len - _buf_pos);
+}
+
+result_t
+FdSource::consume(size_t size)
+{
+    if (_error != OK) return _error;
+    if (size > _buf_len - _buf_pos) return WRONG_ARGUMENTS;
+    _buf_pos += size;
+    return OK;
+}
+
+FdConsumer::FdConsumer(int fd, bool take_ownership, size_t buffer_size)
+    : _fd(fd), _owned(take_ownership), _buf(std::max<size_t>(buffer_size, 1))
+{
+    if (_fd < 0) _error = OUTPUT_STREAM_ERROR;
+}
+
+FdConsumer::FdConsumer(const std::string& path, size_t buffer_size)
+    : FdConsumer(::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666), true, buffer_size)
+{
+    if (_fd < 0) _errno = errno;
+}
+
+FdConsumer::~FdConsumer()
+{
+    if (_owned && (_fd >= 0)) close();
+}
+
+void
+FdConsumer::setBulk(bool bulk)
+{
+    if (_bulk && !bulk) dropCache(_fd, _dropped, _bulk_pos, true);
+    _bulk = bulk;
+    off_t pos = (_fd >= 0) ? lseek(_fd, 0, SEEK_CUR) : -1;
+    _bulk_pos = _synced = _dropped = (pos > 0) ? uint64_t(pos) : 0;
+}
+
+void
+FdConsumer::written(size_t size)
+{
+    if (!_bulk) return;
+    _bulk_pos += size;
+    if (_bulk_pos - _synced < BULK_WINDOW) return;
+    // Start writeback of the new window and drop the previous one, that has had time to complete
+#ifdef SYNC_FILE_RANGE_WRITE
+    sync_file_range(_fd, off_t(_synced), off_t(_bulk_pos - _synced), SYNC_FILE_RANGE_WRITE);
+#endif
+    dropCache(_fd, _dropped, _synced, true);
+    _dropped = _synced;
+    _synced = _bulk_pos;
+}
+
+result_t
+FdConsumer::writeFully(const uint8_t *src, size_t size)
+{
+    size_t n_written = 0;
+    while (n_written < size) {
+        ssize_t result = ::write(_fd, src + n_written, size - n_written);
+        if (result < 0) {
+            if (errno == EINTR) continue;
+            _errno = errno;
+            _error = OUTPUT_STREAM_ERROR;
+            return _error;
+        }
+        if (result == 0) {
+            _errno = ENOSPC;
+            _error = OUTPUT_STREAM_ERROR;
+            return _error;
+        }
+        n_written += result;
+        written(result);
+    }
+    return OK;
+}
+
+result_t
+FdConsumer::flush()
+{
+    if (!_buf_len) return OK;
+    result_t result = writeFully(_buf.data(), _buf_len);
+    _buf_len = 0;
+    return result;
+}
+
+result_t
+FdConsumer::write(const uint8_t *src, size_t size)
+{
+    if (_error != OK) return _error;
+    if (_fd < 0) return WORKFLOW_ERROR;
+    if ((_buf_len + size) > _buf.size()) {
+        if (flush() != OK) return _error;
+        if (size >= _buf.size()) {
+            // Large write, bypass the buffer
+            if (writeFully(src, size) != OK) return _error;
+            return size;
+        }
+    }
+    std::memcpy(_buf.data() + _buf_len, src, size);
+    _buf_len += size;
+    return size;
+}
+
+result_t
+FdConsumer::close()
+{
+    if (_fd < 0) return _error;
+    if (_error == OK) flush();
+    if (_bulk) {
+        dropCache(_fd, _dropped, _bulk_pos, true);
+        _dropped = _synced = _bulk_pos;
+    }
+    if (_owned) {
+        if ((::close(_fd) != 0) && (_error == OK)) {
+            _errno = errno;
+            _error = OUTPUT_STREAM_ERROR;
+        }
+        _fd = -1;
+    }
+    return _error;
+}
+
+WritevConsumer::WritevConsumer(int fd, bool take_ownership, size_t buffer_size, int64_t offset)
+    : FdConsumer(fd, take_ownership, buffer_size), _offset(offset)
+{
+}
+
+WritevConsumer::WritevConsumer(const std::string& path, size_t buffer_size)
+    : FdConsumer(path, buffer_size), _offset(-1)
+{
+}
+
+WritevConsumer::~WritevConsumer()
+{
+    // Has to be closed here, base destructor would not use our flush
+    if (_owned && (_fd >= 0)) close();
+}
+
+result_t
+WritevConsumer::writeGathered(const uint8_t *src, size_t size)
+{
+    struct iovec iov[2];
+    int n_iov = 0;
+    if (_buf_len) iov[n_iov++] = {_buf.data(), _buf_len};
+    if (size) iov[n_iov++] = {(void *) src, size};
+    _buf_len = 0;
+    int first = 0;
+    while (first < n_iov) {
+        ssize_t result = (_offset >= 0) ? pwritev(_fd, iov + first, n_iov - first, off_t(_offset)) : ::writev(_fd, iov + first, n_iov - first);
+        _n_calls += 1;
+        if (result < 0) {
+            if (errno == EINTR) continue;
+            _errno = errno;
+            _error = OUTPUT_STREAM_ERROR;
+            return _error;
+        }
+        if (result == 0) {
+            _errno = ENOSPC;
+            _error = OUTPUT_STREAM_ERROR;
+            return _error;
+        }
+        if (_offset >= 0) _offset += result;
+        written(result);
+        // Skip fully written segments and continue the partially written one
+        while ((first < n_iov) && (size_t(result) >= iov[first].iov_len)) {
+            result -= iov[first].iov_len;
+            first += 1;
+        }
+        if (first < n_iov) {
+            iov[first].iov_base = (uint8_t *) iov[first].iov_base + result;
+            iov[first].iov_len -= result;
+        }
+    }
+    return OK;
+}
+
+void
+WritevConsumer::setBulk(bool bulk)
+{
+    FdConsumer::setBulk(bulk);
+    if (_offset >= 0) _bulk_pos = _synced = _dropped = uint64_t(_offset);
+}
+
+result_t
+WritevConsumer::flush()
+{
+    if (!_buf_len) return OK;
+    return writeGathered(nullptr, 0);
+}
+
+result_t
+WritevConsumer::write(const uint8_t *src, size_t size)
+{
+    if (_error != OK) return _error;
+    if (_fd < 0) return WORKFLOW_ERROR;
+    if ((_buf_len + size) > _buf.size()) {
+        if (writeGathered(src, size) != OK) return _error;
+        return size;
+    }
+    std::memcpy(_buf.data() + _buf_len, src, size);
+    _buf_len += size;
+    return size;
+}
+
+struct SocketConsumer::Private {
+    struct Slot {
+        BufferPool::Buffer buf;
+        size_t len = 0;
+        // The number of zero-copy sends not yet completed
+        unsigned int n_pending = 0;
+    };
+
+    int fd;
+    bool owned;
+    std::vector<Slot> slots;
+    size_t current = 0;
+    bool zerocopy = false;
+    // Id of the next zero-copy send and the ids of sends in flight with their slots
+    uint32_t next_id = 0;
+    std::deque<std::pair<uint32_t,size_t>> inflight;
+    int err = 0;
+    result_t error = OK;
+
+    Private(int _fd, bool _owned, unsigned int num_buffers) : fd(_fd), owned(_owned), slots(std::max(num_buffers, 1U)) {}
+
+    result_t fail(int _err) {
+        err = _err;
+        error = OUTPUT_STREAM_ERROR;
+        return error;
+    }
+    result_t waitSocket(short events, short *revents = nullptr);
+    result_t readCompletions();
+    result_t sendSlot(Slot& slot);
+    result_t waitSlot(Slot& slot);
+};
+
+result_t
+SocketConsumer::Private::waitSocket(short events, short *revents)
+{
+    struct pollfd pfd = {fd, events, 0};
+    while (::poll(&pfd, 1, -1) < 0) {
+        if (errno != EINTR) return fail(errno);
+    }
+    if (pfd.revents & POLLNVAL) return fail(EBADF);
+    if (revents) *revents = pfd.revents;
+    return OK;
+}
+
+result_t
+SocketConsumer::Private::readCompletions()
+{
+#ifdef SO_EE_ORIGIN_ZEROCOPY
+    while (!inflight.empty()) {
+        uint8_t control[128];
+        struct msghdr msg = {};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (::recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            if (errno == EINTR) continue;
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) return OK;
+            return fail(errno);
+        }
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!((cm->cmsg_level == SOL_IP) && (cm->cmsg_type == IP_RECVERR)) &&
+                !((cm->cmsg_level == SOL_IPV6) && (cm->cmsg_type == IPV6_RECVERR))) continue;
+            struct sock_extended_err serr;
+            std::memcpy(&serr, CMSG_DATA(cm), sizeof(serr));
+            if (serr.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                if (serr.ee_errno) return fail(serr.ee_errno);
+                continue;
+            }
+            // The kernel had to copy, zero-copy only adds overhead for this socket
+            if (serr.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) zerocopy = false;
+            uint32_t lo = serr.ee_info, n = serr.ee_data - serr.ee_info;
+            for (auto it = inflight.begin(); it != inflight.end();) {
+                if (uint32_t(it->first - lo) <= n) {
+                    slots[it->second].n_pending -= 1;
+                    it = inflight.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+    }
+#endif
+    return OK;
+}
+
+result_t
+SocketConsumer::Private::sendSlot(Slot& slot)
+{
+    size_t n_sent = 0;
+    // Set when out of pinned memory quota, the next chunk is sent by copying
+    bool copy = false;
+    while (n_sent < slot.len) {
+        int flags = MSG_NOSIGNAL;
+#ifdef MSG_ZEROCOPY
+        if (zerocopy && !copy) flags |= MSG_ZEROCOPY;
+#endif
+        ssize_t result = ::send(fd, slot.buf.data() + n_sent, slot.len - n_sent, flags);
+        if (result < 0) {
+            if (errno == EINTR) continue;
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                if (waitSocket(POLLOUT) != OK) return error;
+                continue;
+            }
+            if ((flags != MSG_NOSIGNAL) && (errno == ENOBUFS)) {
+                if (readCompletions() != OK) return error;
+                copy = true;
+                continue;
+            }
+            return fail(errno);
+        }
+        if (flags != MSG_NOSIGNAL) {
+            inflight.emplace_back(next_id++, &slot - slots.data());
+            slot.n_pending += 1;
+        }
+        copy = false;
+        n_sent += result;
+    }
+    slot.len = 0;
+    return OK;
+}
+
+result_t
+SocketConsumer::Private::waitSlot(Slot& slot)
+{
+    while (slot.n_pending) {
+        if (readCompletions() != OK) return error;
+        if (!slot.n_pending) break;
+        // Completions are signalled as error condition
+        short revents = 0;
+        if (waitSocket(0, &revents) != OK) return error;
+        if (revents & POLLHUP) {
+            // Hang up stays signalled and poll would not block again, take the last completions and give up
+            if (readCompletions() != OK) return error;
+            if (slot.n_pending) return fail(EPIPE);
+        } else if (revents & POLLERR) {
+            // Error condition without pending socket error means that completions are queued
+            int soerr = 0;
+            socklen_t len = sizeof(soerr);
+            if (::getsockopt(fd, SOL_SOCKET, SO_ERROR, &soerr, &len) < 0) return fail(errno);
+            if (soerr) return fail(soerr);
+        }
+    }
+    return OK;
+}
+
+SocketConsumer::SocketConsumer(int fd, bool take_ownership, unsigned int num_buffers, size_t buffer_size)
+    : d(new Private(fd, take_ownership, num_buffers))
+{
+    if (!buffer_size) buffer_size = BufferPool::getChunkSize(BufferPool::IO);
+    for (Private::Slot& slot : d->slots) slot.buf = BufferPool::get(buffer_size);
+    if (fd < 0) {
+        d->error = OUTPUT_STREAM_ERROR;
+        return;
+    }
+#ifdef SO_ZEROCOPY
+    int one = 1;
+    d->zerocopy = ::setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+#endif
+    LOG_DBG("SocketConsumer: zero-copy {}", d->zerocopy);
+}
+
+SocketConsumer::~SocketConsumer()
+{
+    close();
+    delete d;
+}
+
+result_t
+SocketConsumer::write(const uint8_t *src, size_t size)
+{
+    if (d->error != OK) return d->error;
+    if (d->fd < 0) return WORKFLOW_ERROR;
+    size_t n_copied = 0;
+    while (n_copied < size) {
+        Private::Slot& slot = d->slots[d->current];
+        size_t n = std::min(size - n_copied, slot.buf.size() - slot.len);
+        std::memcpy(slot.buf.data() + slot.len, src + n_copied, n);
+        slot.len += n;
+        n_copied += n;
+        if (slot.len < slot.buf.size()) break;
+        if (d->sendSlot(slot) != OK) return d->error;
+        d->current = (d->current + 1) % d->slots.size();
+        if (d->waitSlot(d->slots[d->current]) != OK) return d->error;
+    }
+    return size;
+}
+
+result_t
+SocketConsumer::close()
+{
+    if (d->fd < 0) return d->error;
+    if (d->error == OK) {
+        Private::Slot& slot = d->slots[d->current];
+        if (slot.len) d->sendSlot(slot);
+        for (Private::Slot& s : d->slots) {
+            if (d->waitSlot(s) != OK) break;
+        }
+    }
+    if (d->owned) {
+        if ((::close(d->fd) != 0) && (d->error == OK)) d->fail(errno);
+    }
+    d->fd = -1;
+    return d->error;
 }
 
 bool
-FileListSource::isError()
+SocketConsumer::isError()
 {
-    if ((_current < 0) || (_current >= _files.size())) return OK;
-	return _ifs.bad();
+    return d->error != OK;
 }
 
 bool
-FileListSource::isEof()
+SocketConsumer::isZeroCopy() const
 {
-	if (_current < 0) return false;
-	if (_current >= _files.size()) return true;
-	return _ifs.eof();
+    return d->zerocopy;
 }
 
-libcdoc::result_t
-FileListSource::getNumComponents()
+int
+SocketConsumer::getErrno() const
 {
-	return _files.size();
+    return d->err;
 }
+#endif
 
-libcdoc::result_t
-FileListSource::next(std::string& name, int64_t& size)
+OStreamConsumer::OStreamConsumer(const std::string& path)
+	: OStreamConsumer(new std::ofstream(path, std::ios_base::binary), true)
 {
-	_ifs.close();
-	_current += 1;
-	if (_current >= _files.size()) return END_OF_STREAM;
-	std::filesystem::path path(_base);
-	path.append(_files[_current]);
-	if (!std::filesystem::exists(path)) return IO_ERROR;
-	_ifs.open(path, std::ios_base::in | std::ios_base::binary);
-	if (_ifs.bad()) return IO_ERROR;
-	name = _files[_current];
-	size = std::filesystem::file_size(path);
+}
+
+result_t
+SegmentedConsumer::write(const uint8_t *src, size_t size)
+{
+    size_t n_written = 0;
+    while (n_written < size) {
+        if (_segments.empty() || (_segments.back().len == _segments.back().capacity)) {
+            size_t capacity = std::max(_segment_size, size - n_written);
+            _segments.push_back({std::make_unique_for_overwrite<uint8_t[]>(capacity), capacity, 0});
+        }
+        Segment& seg = _segments.back();
+        size_t n = std::min(size - n_written, seg.capacity - seg.len);
+        std::memcpy(seg.data.get() + seg.len, src + n_written, n);
+        seg.len += n;
+        n_written += n;
+    }
+    _size += size;
+    return size;
+}
+
+result_t
+SegmentedConsumer::reserve(uint64_t size)
+{
+    if (!size) return OK;
+    if (!_segments.empty() && ((_segments.back().capacity - _segments.back().len) >= size)) return OK;
+    if (size > SIZE_MAX) return OUTPUT_ERROR;
+    // The free tail of the last segment is abandoned so that the reserved data stays contiguous
+    _segments.push_back({std::make_unique_for_overwrite<uint8_t[]>(size_t(size)), size_t(size), 0});
+    return OK;
+}
+
+std::vector<std::span<const uint8_t>>
+SegmentedConsumer::getSpans() const
+{
+    std::vector<std::span<const uint8_t>> spans;
+    for (const Segment& seg : _segments) {
+        if (seg.len) spans.emplace_back(seg.data.get(), seg.len);
+    }
+    return spans;
+}
+
+std::vector<uint8_t>
+SegmentedConsumer::toVector() const
+{
+    std::vector<uint8_t> data;
+    data.reserve(_size);
+    for (const Segment& seg : _segments) data.insert(data.end(), seg.data.get(), seg.data.get() + seg.len);
+    return data;
+}
+
+void
+SegmentedConsumer::clear()
+{
+    _segments.clear();
+    _size = 0;
+}
+
+struct SpillBuffer::Private {
+    size_t limit;
+    std::string dir;
+    std::vector<uint8_t> mem;
+#ifdef _WIN32
+    FILE *file = nullptr;
+#else
+    int fd = -1;
+#endif
+    uint64_t size = 0;
+    uint64_t pos = 0;
+    result_t error = OK;
+
+    Private(size_t _limit, const std::string& _dir) : limit(_limit), dir(_dir) {}
+
+    bool spilled() const {
+#ifdef _WIN32
+        return file != nullptr;
+#else
+        return fd >= 0;
+#endif
+    }
+    result_t spill();
+    result_t writeFile(uint64_t offset, const uint8_t *src, size_t len);
+    result_t readFile(uint64_t offset, uint8_t *dst, size_t len);
+    void release() {
+#ifdef _WIN32
+        if (file) std::fclose(file);
+        file = nullptr;
+#else
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+#endif
+        mem = {};
+    }
+};
+
+result_t
+SpillBuffer::Private::spill()
+{
+    std::filesystem::path path = dir.empty() ? std::filesystem::temp_directory_path() : std::filesystem::path(dir);
+#ifdef _WIN32
+    // Deleted automatically on close
+    file = std::tmpfile();
+    if (!file) return OUTPUT_STREAM_ERROR;
+#else
+#ifdef O_TMPFILE
+    fd = ::open(path.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+#endif
+    if (fd < 0) {
+        std::string tmpl = (path / "libcdoc-XXXXXX").string();
+        fd = ::mkstemp(tmpl.data());
+        if (fd < 0) return OUTPUT_STREAM_ERROR;
+        ::unlink(tmpl.c_str());
+    }
+#endif
+    LOG_DBG("SpillBuffer: moving {} bytes to temporary file", size);
+    if (auto result = writeFile(0, mem.data(), mem.size()); result != OK) return result;
+    mem = {};
+    return OK;
+}
+
+result_t
+SpillBuffer::Private::writeFile(uint64_t offset, const uint8_t *src, size_t len)
+{
+#ifdef _WIN32
+    if (_fseeki64(file, int64_t(offset), SEEK_SET) || (std::fwrite(src, 1, len, file) != len)) return OUTPUT_STREAM_ERROR;
+#else
+    size_t n_written = 0;
+    while (n_written < len) {
+        ssize_t result = ::pwrite(fd, src + n_written, len - n_written, off_t(offset + n_written));
+        if (result < 0) {
+            if (errno == EINTR) continue;
+            return OUTPUT_STREAM_ERROR;
+        }
+        n_written += size_t(result);
+    }
+#endif
+    return OK;
+}
+
+result_t
+SpillBuffer::Private::readFile(uint64_t offset, uint8_t *dst, size_t len)
+{
+#ifdef _WIN32
+    if (_fseeki64(file, int64_t(offset), SEEK_SET) || (std::fread(dst, 1, len, file) != len)) return INPUT_STREAM_ERROR;
+#else
+    size_t n_read = 0;
+    while (n_read < len) {
+        ssize_t result = ::pread(fd, dst + n_read, len - n_read, off_t(offset + n_read));
+        if (result < 0) {
+            if (errno == EINTR) continue;
+            return INPUT_STREAM_ERROR;
+        }
+        if (result == 0) return INPUT_STREAM_ERROR;
+        n_read += size_t(result);
+    }
+#endif
+    return OK;
+}
+
+SpillBuffer::SpillBuffer(size_t memory_limit, const std::string& dir)
+    : d(new Private(memory_limit, dir))
+{
+}
+
+SpillBuffer::~SpillBuffer()
+{
+    d->release();
+    delete d;
+}
+
+result_t
+SpillBuffer::write(const uint8_t *src, size_t size)
+{
+    if (d->error != OK) return d->error;
+    if (!d->spilled() && ((d->size + size) > d->limit)) {
+        if (auto result = d->spill(); result != OK) return d->error = result;
+    }
+    if (d->spilled()) {
+        if (auto result = d->writeFile(d->size, src, size); result != OK) return d->error = result;
+    } else {
+        d->mem.insert(d->mem.end(), src, src + size);
+    }
+    d->size += size;
+    return size;
+}
+
+result_t
+SpillBuffer::reserve(uint64_t size)
+{
+    if (d->error != OK) return d->error;
+    if (d->spilled()) return OK;
+    if ((d->size + size) > d->limit) {
+        if (auto result = d->spill(); result != OK) return d->error = result;
+        return OK;
+    }
+    d->mem.reserve(d->size + size);
+    return OK;
+}
+
+result_t
+SpillBuffer::seek(size_t pos)
+{
+    if (pos > d->size) return INPUT_STREAM_ERROR;
+    d->pos = pos;
+    return OK;
+}
+
+result_t
+SpillBuffer::tell()
+{
+    return d->pos;
+}
+
+result_t
+SpillBuffer::read(uint8_t *dst, size_t size)
+{
+    if (d->error != OK) return d->error;
+    size = size_t(std::min<uint64_t>(size, d->size - d->pos));
+    if (d->spilled()) {
+        if (auto result = d->readFile(d->pos, dst, size); result != OK) return d->error = result;
+    } else {
+        std::memcpy(dst, d->mem.data() + d->pos, size);
+    }
+    d->pos += size;
+    return size;
+}
+
+result_t
+SpillBuffer::peek(const uint8_t **ptr, size_t max)
+{
+    if (d->spilled()) return NOT_IMPLEMENTED;
+    *ptr = d->mem.data() + d->pos;
+    return std::min<uint64_t>(max, d->size - d->pos);
+}
+
+result_t
+SpillBuffer::consume(size_t size)
+{
+    if (size > d->size - d->pos) return WRONG_ARGUMENTS;
+    d->pos += size;
+    return OK;
+}
+
+bool
+SpillBuffer::isError()
+{
+    return d->error != OK;
+}
+
+bool
+SpillBuffer::isEof()
+{
+    return d->pos >= d->size;
+}
+
+uint64_t
+SpillBuffer::size() const
+{
+    return d->size;
+}
+
+bool
+SpillBuffer::isSpilled() const
+{
+    return d->spilled();
+}
+
+void
+SpillBuffer::clear()
+{
+    d->release();
+    d->size = d->pos = 0;
+    d->error = OK;
+}
+
+struct ReadAheadSource::Private {
+    struct Slot {
+        BufferPool::Buffer buf;
+        size_t len = 0;
+        bool filled = false;
+    };
+
+    DataSource *src;
+    bool owned;
+    std::vector<Slot> slots;
+    size_t buffer_size;
+    // Descriptor of file-backed inner source for prefetch hints
+    int fd = -1;
+    // Inner source tells its position and has not refused to seek
+    bool seekable = false;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::thread thread;
+    // Slot being consumed and position in it
+    size_t head = 0;
+    size_t head_pos = 0;
+    // Slot being filled
+    size_t tail = 0;
+    bool stop = false;
+    // Inner source is exhausted or failed
+    bool done = false;
+    result_t error = OK;
+    // Position of the caller and of the inner source
+    uint64_t pos = 0;
+    uint64_t src_pos = 0;
+
+    Private(DataSource *_src, bool _owned, unsigned int num_buffers, size_t _buffer_size)
+        : src(_src), owned(_owned), slots(std::max(num_buffers, 2U)), buffer_size(_buffer_size) {
+        for (Slot& slot : slots) slot.buf = BufferPool::get(buffer_size);
+#ifndef _WIN32
+        if (auto fsrc = dynamic_cast<FdSource *>(src)) fd = fsrc->getFd();
+        else if (auto dsrc = dynamic_cast<DirectFileSource *>(src)) fd = dsrc->getFd();
+#endif
+        result_t result = src->tell();
+        seekable = (result >= 0);
+        if (result > 0) src_pos = pos = uint64_t(result);
+    }
+    ~Private() {
+        halt();
+        if (owned) delete src;
+    }
+
+    void run();
+    void start() {
+        if (!thread.joinable() && !done) thread = std::thread(&Private::run, this);
+    }
+    void halt();
+    void drop();
+    void release(Slot& slot) {
+        slot.filled = false;
+        slot.len = 0;
+        head = (head + 1) % slots.size();
+        head_pos = 0;
+        cv.notify_all();
+    }
+};
+
+void
+ReadAheadSource::Private::run()
+{
+    while (true) {
+        Slot *slot;
+        uint64_t offset;
+        {
+            std::unique_lock lock(mutex);
+            cv.wait(lock, [this]{ return stop || !slots[tail].filled; });
+            if (stop) return;
+            slot = &slots[tail];
+            offset = src_pos;
+        }
+#ifdef POSIX_FADV_WILLNEED
+        if (fd >= 0) posix_fadvise(fd, off_t(offset), off_t(slots.size() * buffer_size), POSIX_FADV_WILLNEED);
+#endif
+        result_t result = src->read(slot->buf.data(), buffer_size);
+        bool eof = (result >= 0) && ((result_t(buffer_size) > result) || src->isEof());
+        std::lock_guard lock(mutex);
+        if (result < 0) {
+            error = result;
+            done = true;
+        } else {
+            if (result > 0) {
+                slot->len = size_t(result);
+                slot->filled = true;
+                tail = (tail + 1) % slots.size();
+                src_pos += result;
+            }
+            done = eof;
+        }
+        cv.notify_all();
+        if (done) return;
+    }
+}
+
+void
+ReadAheadSource::Private::halt()
+{
+    {
+        std::lock_guard lock(mutex);
+        stop = true;
+        cv.notify_all();
+    }
+    if (thread.joinable()) thread.join();
+    stop = false;
+}
+
+void
+ReadAheadSource::Private::drop()
+{
+    done = false;
+    for (Slot& slot : slots) {
+        slot.filled = false;
+        slot.len = 0;
+    }
+    head = head_pos = tail = 0;
+}
+
+ReadAheadSource::ReadAheadSource(DataSource *src, bool take_ownership, unsigned int num_buffers, size_t buffer_size)
+    : d(new Private(src, take_ownership, num_buffers, buffer_size ? buffer_size : BufferPool::getChunkSize(BufferPool::IO)))
+{
+}
+
+ReadAheadSource::~ReadAheadSource()
+{
+    delete d;
+}
+
+result_t
+ReadAheadSource::seek(size_t pos)
+{
+    if (isError()) return d->error;
+    if (pos == d->pos) return OK;
+    // Keep read ahead data if the inner source cannot seek anyway (e.g. skip falls back to reading)
+    if (!d->seekable) return NOT_IMPLEMENTED;
+    d->halt();
+    if (auto result = d->src->seek(pos); result != OK) {
+        // Inner source stays after the read ahead data, which is still valid
+        if (result == NOT_IMPLEMENTED) d->seekable = false;
+        return result;
+    }
+    d->drop();
+    d->pos = d->src_pos = pos;
+    return OK;
+}
+
+result_t
+ReadAheadSource::tell()
+{
+    std::lock_guard lock(d->mutex);
+    if (d->error != OK) return d->error;
+    return d->pos;
+}
+
+result_t
+ReadAheadSource::read(uint8_t *dst, size_t size)
+{
+    std::unique_lock lock(d->mutex);
+    // Errors of inner source are returned after the data read before them
+    if ((d->error != OK) && !d->slots[d->head].filled) return d->error;
+    d->start();
+    size_t n_copied = 0;
+    while (n_copied < size) {
+        d->cv.wait(lock, [this]{ return d->slots[d->head].filled || d->done; });
+        Private::Slot& slot = d->slots[d->head];
+        if (!slot.filled) {
+            if (d->error != OK) return d->error;
+            break;
+        }
+        // Filled slots are not touched by helper thread
+        size_t n = std::min(size - n_copied, slot.len - d->head_pos);
+        lock.unlock();
+        std::memcpy(dst + n_copied, slot.buf.data() + d->head_pos, n);
+        lock.lock();
+        d->head_pos += n;
+        d->pos += n;
+        n_copied += n;
+        if (d->head_pos >= slot.len) d->release(slot);
+    }
+    return n_copied;
+}
+
+result_t
+ReadAheadSource::peek(const uint8_t **ptr, size_t max)
+{
+    std::unique_lock lock(d->mutex);
+    if ((d->error != OK) && !d->slots[d->head].filled) return d->error;
+    d->start();
+    d->cv.wait(lock, [this]{ return d->slots[d->head].filled || d->done; });
+    Private::Slot& slot = d->slots[d->head];
+    if (!slot.filled) return d->error;
+    *ptr = slot.buf.data() + d->head_pos;
+    return std::min(max, slot.len - d->head_pos);
+}
+
+result_t
+ReadAheadSource::consume(size_t size)
+{
+    std::lock_guard lock(d->mutex);
+    Private::Slot& slot = d->slots[d->head];
+    if (!size) return OK;
+    if (!slot.filled || (size > slot.len - d->head_pos)) return WRONG_ARGUMENTS;
+    d->head_pos += size;
+    d->pos += size;
+    if (d->head_pos >= slot.len) d->release(slot);
+    return OK;
+}
+
+bool
+ReadAheadSource::isError()
+{
+    std::lock_guard lock(d->mutex);
+    return d->error != OK;
+}
+
+bool
+ReadAheadSource::isEof()
+{
+    std::lock_guard lock(d->mutex);
+    return d->done && !d->slots[d->head].filled;
+}
+
+struct WriteBehindConsumer::Private {
+    struct Slot {
+        BufferPool::Buffer buf;
+        size_t len = 0;
+        // Called after the data of slot is written
+        std::function<result_t()> action;
+        bool filled = false;
+    };
+
+    DataConsumer *dst;
+    bool owned;
+    std::vector<Slot> slots;
+    size_t buffer_size;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::thread thread;
+    // Slot being drained
+    size_t head = 0;
+    // Slot being filled
+    size_t tail = 0;
+    bool stop = false;
+    bool closed = false;
+    // First error of inner consumer
+    result_t error = OK;
+
+    Private(DataConsumer *_dst, bool _owned, unsigned int num_buffers, size_t _buffer_size)
+        : dst(_dst), owned(_owned), slots(std::max(num_buffers, 1U)), buffer_size(_buffer_size) {
+        for (Slot& slot : slots) slot.buf = BufferPool::get(buffer_size);
+    }
+
+    void run();
+    void start() {
+        if (!thread.joinable()) thread = std::thread(&Private::run, this);
+    }
+    void queue(Slot& slot) {
+        slot.filled = true;
+        tail = (tail + 1) % slots.size();
+        cv.notify_all();
+    }
+};
+
+void
+WriteBehindConsumer::Private::run()
+{
+    while (true) {
+        Slot *slot;
+        {
+            std::unique_lock lock(mutex);
+            cv.wait(lock, [this]{ return stop || slots[head].filled; });
+            // Stop only after all queued data is written
+            if (!slots[head].filled) return;
+            slot = &slots[head];
+        }
+        // Filled slots are not touched by caller
+        size_t n_written = 0;
+        result_t result = OK;
+        while (n_written < slot->len) {
+            result = dst->write(slot->buf.data() + n_written, slot->len - n_written);
+            if (result <= 0) break;
+            n_written += size_t(result);
+        }
+        if ((n_written == slot->len) && slot->action) result = slot->action();
+        std::lock_guard lock(mutex);
+        if ((n_written < slot->len) || (result < 0)) {
+            error = (result < 0) ? result : result_t(OUTPUT_ERROR);
+            // Drop the queued data, caller gets the error on next write or close
+            // The slot being filled belongs to caller and is left alone
+            for (Slot& s : slots) {
+                if (!s.filled) continue;
+                s.filled = false;
+                s.len = 0;
+                s.action = nullptr;
+            }
+            cv.notify_all();
+            return;
+        }
+        slot->filled = false;
+        slot->len = 0;
+        slot->action = nullptr;
+        head = (head + 1) % slots.size();
+        cv.notify_all();
+    }
+}
+
+WriteBehindConsumer::WriteBehindConsumer(DataConsumer *dst, bool take_ownership, unsigned int num_buffers, size_t buffer_size)
+    : d(new Private(dst, take_ownership, num_buffers, buffer_size ? buffer_size : BufferPool::getChunkSize(BufferPool::IO)))
+{
+}
+
+WriteBehindConsumer::~WriteBehindConsumer()
+{
+    close();
+    if (d->owned) delete d->dst;
+    delete d;
+}
+
+result_t
+WriteBehindConsumer::write(const uint8_t *src, size_t size)
+{
+    std::unique_lock lock(d->mutex);
+    if (d->error != OK) return d->error;
+    if (d->closed) return WORKFLOW_ERROR;
+    d->start();
+    size_t n_copied = 0;
+    while (n_copied < size) {
+        d->cv.wait(lock, [this]{ return !d->slots[d->tail].filled || (d->error != OK); });
+        if (d->error != OK) return d->error;
+        // The slot being filled is not touched by helper thread
+        Private::Slot& slot = d->slots[d->tail];
+        size_t n = std::min(size - n_copied, d->buffer_size - slot.len);
+        lock.unlock();
+        std::memcpy(slot.buf.data() + slot.len, src + n_copied, n);
+        lock.lock();
+        slot.len += n;
+        n_copied += n;
+        if (slot.len >= d->buffer_size) d->queue(slot);
+    }
+    return size;
+}
+
+result_t
+WriteBehindConsumer::sync()
+{
+    std::unique_lock lock(d->mutex);
+    if (d->error != OK) return d->error;
+    if (d->closed) return WORKFLOW_ERROR;
+    Private::Slot& slot = d->slots[d->tail];
+    if (!slot.filled && slot.len) {
+        d->start();
+        d->queue(slot);
+    }
+    // Helper thread releases a slot only after the inner write has returned
+    d->cv.wait(lock, [this]{
+        return (d->error != OK) || std::none_of(d->slots.cbegin(), d->slots.cend(), [](const Private::Slot& s) { return s.filled; });
+    });
+    return d->error;
+}
+
+result_t
+WriteBehindConsumer::post(std::function<result_t()> action)
+{
+    std::unique_lock lock(d->mutex);
+    if (d->error != OK) return d->error;
+    if (d->closed) return WORKFLOW_ERROR;
+    d->start();
+    d->cv.wait(lock, [this]{ return !d->slots[d->tail].filled || (d->error != OK); });
+    if (d->error != OK) return d->error;
+    // The action follows the data of the slot being filled, even if it is empty
+    Private::Slot& slot = d->slots[d->tail];
+    slot.action = std::move(action);
+    d->queue(slot);
+    return OK;
+}
+
+result_t
+WriteBehindConsumer::close()
+{
+    {
+        std::lock_guard lock(d->mutex);
+        if (d->closed) return d->error;
+        d->closed = true;
+        Private::Slot& slot = d->slots[d->tail];
+        if ((d->error == OK) && !slot.filled && slot.len) {
+            d->start();
+            d->queue(slot);
+        }
+        d->stop = true;
+        d->cv.notify_all();
+    }
+    if (d->thread.joinable()) d->thread.join();
+    // Inner consumer that is not owned is left open, as in ChainedConsumer
+    if (d->owned) {
+        result_t result = d->dst->close();
+        if (d->error == OK) d->error = result;
+    }
+    return d->error;
+}
+
+bool
+WriteBehindConsumer::isError()
+{
+    std::lock_guard lock(d->mutex);
+    return d->error != OK;
+}
+
+struct CachingSource::Private {
+    struct Page {
+        uint64_t index;
+        BufferPool::Buffer buf;
+        size_t len = 0;
+    };
+
+    DataSource *src;
+    bool owned;
+    size_t num_pages;
+    size_t page_size;
+    // Most recently used page first
+    std::list<Page> pages;
+    std::unordered_map<uint64_t,std::list<Page>::iterator> index;
+    // Position of the caller and of the inner source (-1 if unknown)
+    uint64_t pos = 0;
+    int64_t src_pos = -1;
+    // Size of data, known after reaching the end of inner source (-1 if unknown)
+    int64_t size = -1;
+    uint64_t n_hits = 0;
+    uint64_t n_misses = 0;
+    result_t error = OK;
+
+    Private(DataSource *_src, bool _owned, size_t _num_pages, size_t _page_size)
+        : src(_src), owned(_owned), num_pages(_num_pages), page_size(_page_size) {}
+
+    result_t getPage(uint64_t idx, const Page **page);
+};
+
+result_t
+CachingSource::Private::getPage(uint64_t idx, const Page **page)
+{
+    if (error != OK) return error;
+    auto it = index.find(idx);
+    if (it != index.end()) {
+        pages.splice(pages.begin(), pages, it->second);
+        n_hits += 1;
+        *page = &pages.front();
+        return OK;
+    }
+    uint64_t start = idx * page_size;
+    if ((size >= 0) && (start >= uint64_t(size))) {
+        *page = nullptr;
+        return OK;
+    }
+    n_misses += 1;
+    if (pages.size() >= num_pages) {
+        // Reuse the least recently used page
+        index.erase(pages.back().index);
+        pages.splice(pages.begin(), pages, std::prev(pages.end()));
+    } else {
+        pages.push_front({0, BufferPool::get(page_size), 0});
+    }
+    Page& p = pages.front();
+    p.index = idx;
+    p.len = 0;
+    if (src_pos != int64_t(start)) {
+        result_t result = src->seek(start);
+        if ((result == INPUT_STREAM_ERROR) && !src->isError()) {
+            // Inner source refuses positions past the end, there is no such page
+            pages.splice(pages.end(), pages, pages.begin());
+            *page = nullptr;
+            return OK;
+        }
+        if (result != OK) {
+            error = INPUT_STREAM_ERROR;
+            return error;
+        }
+        src_pos = int64_t(start);
+    }
+    while (p.len < page_size) {
+        result_t n_read = src->read(p.buf.data() + p.len, page_size - p.len);
+        if (n_read < 0) {
+            // Keep the incomplete page out of index, it is reused first
+            pages.splice(pages.end(), pages, pages.begin());
+            src_pos = -1;
+            error = n_read;
+            return error;
+        }
+        if (n_read == 0) break;
+        p.len += n_read;
+    }
+    src_pos += p.len;
+    // An empty page only tells that the end is not after its start, unless it is the first one
+    if ((p.len < page_size) && ((p.len > 0) || (start == 0))) size = int64_t(start + p.len);
+    index[idx] = pages.begin();
+    *page = &p;
+    return OK;
+}
+
+CachingSource::CachingSource(DataSource *src, bool take_ownership, size_t num_pages, size_t page_size)
+    : d(new Private(src, take_ownership, std::max<size_t>(num_pages, 1), std::max<size_t>(page_size, 1)))
+{
+    result_t result = src->tell();
+    if (result >= 0) d->src_pos = d->pos = uint64_t(result);
+}
+
+CachingSource::~CachingSource()
+{
+    if (d->owned) delete d->src;
+    delete d;
+}
+
+result_t
+CachingSource::seek(size_t pos)
+{
+    if (d->error != OK) return d->error;
+    if ((d->size < 0) && (pos > 0)) {
+        // Fetch the page of the last byte before position to find out whether it is past the end
+        const Private::Page *page;
+        if (auto result = d->getPage((pos - 1) / d->page_size, &page); result != OK) return result;
+        if (!page || (((pos - 1) % d->page_size) >= page->len)) return INPUT_STREAM_ERROR;
+    }
+    if ((d->size >= 0) && (pos > uint64_t(d->size))) return INPUT_STREAM_ERROR;
+    d->pos = pos;
+    return OK;
+}
+
+result_t
+CachingSource::tell()
+{
+    if (d->error != OK) return d->error;
+    return d->pos;
+}
+
+result_t
+CachingSource::read(uint8_t *dst, size_t size)
+{
+    size_t n_copied = 0;
+    while (n_copied < size) {
+        const Private::Page *page;
+        if (auto result = d->getPage(d->pos / d->page_size, &page); result != OK) return result;
+        size_t offset = d->pos % d->page_size;
+        if (!page || (offset >= page->len)) break;
+        size_t n = std::min(size - n_copied, page->len - offset);
+        std::memcpy(dst + n_copied, page->buf.data() + offset, n);
+        d->pos += n;
+        n_copied += n;
+    }
+    return n_copied;
+}
+
+result_t
+CachingSource::peek(const uint8_t **ptr, size_t max)
+{
+    const Private::Page *page;
+    if (auto result = d->getPage(d->pos / d->page_size, &page); result != OK) return result;
+    size_t offset = d->pos % d->page_size;
+    if (!page || (offset >= page->len)) return 0;
+    *ptr = page->buf.data() + offset;
+    return std::min(max, page->len - offset);
+}
+
+result_t
+CachingSource::consume(size_t size)
+{
+    if (d->error != OK) return d->error;
+    if (!size) return OK;
+    auto it = d->index.find(d->pos / d->page_size);
+    if ((it == d->index.end()) || (size > it->second->len - d->pos % d->page_size)) return WRONG_ARGUMENTS;
+    d->pos += size;
+    return OK;
+}
+
+bool
+CachingSource::isError()
+{
+    return d->error != OK;
+}
+
+bool
+CachingSource::isEof()
+{
+    const Private::Page *page;
+    if (d->getPage(d->pos / d->page_size, &page) != OK) return true;
+    return !page || ((d->pos % d->page_size) >= page->len);
+}
+
+void
+CachingSource::setOwnership(bool take_ownership)
+{
+    d->owned = take_ownership;
+}
+
+uint64_t
+CachingSource::getNumHits() const
+{
+    return d->n_hits;
+}
+
+uint64_t
+CachingSource::getNumMisses() const
+{
+    return d->n_misses;
+}
+
+struct RateLimiter::Private {
+    struct Bucket {
+        double rate = 0;
+        double tokens = 0;
+
+        // Refill for elapsed time and take amount, return the time to wait for debt
+        double take(double elapsed, double amount) {
+            if (rate <= 0) return 0;
+            tokens = std::min(tokens + elapsed * rate, rate * BURST) - amount;
+            return (tokens < 0) ? -tokens / rate : 0;
+        }
+    };
+
+    mutable std::mutex mutex;
+    Bucket bytes;
+    Bucket ops;
+    std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::duration throttled{};
+};
+
+RateLimiter::RateLimiter(double bytes_per_sec, double ops_per_sec)
+    : d(new Private)
+{
+    setLimits(bytes_per_sec, ops_per_sec);
+}
+
+RateLimiter::~RateLimiter()
+{
+    delete d;
+}
+
+void
+RateLimiter::setLimits(double bytes_per_sec, double ops_per_sec)
+{
+    std::lock_guard lock(d->mutex);
+    // Start with full bucket, but keep the debt of previous limit
+    d->bytes.rate = std::max(bytes_per_sec, 0.0);
+    d->bytes.tokens = std::min(d->bytes.tokens, 0.0) + d->bytes.rate * BURST;
+    d->ops.rate = std::max(ops_per_sec, 0.0);
+    d->ops.tokens = std::min(d->ops.tokens, 0.0) + d->ops.rate * BURST;
+}
+
+void
+RateLimiter::acquire(size_t size)
+{
+    std::chrono::duration<double> wait;
+    {
+        std::lock_guard lock(d->mutex);
+        auto now = std::chrono::steady_clock::now();
+        double elapsed = std::chrono::duration<double>(now - d->last).count();
+        d->last = now;
+        wait = std::chrono::duration<double>(std::max(d->bytes.take(elapsed, double(size)), d->ops.take(elapsed, 1)));
+        if (wait.count() <= 0) return;
+        d->throttled += std::chrono::duration_cast<std::chrono::steady_clock::duration>(wait);
+    }
+    std::this_thread::sleep_for(wait);
+}
+
+double
+RateLimiter::getThrottledTime() const
+{
+    std::lock_guard lock(d->mutex);
+    return std::chrono::duration<double>(d->throttled).count();
+}
+
+result_t
+ThrottledSource::read(uint8_t *dst, size_t size)
+{
+    result_t result = _src->read(dst, size);
+    if (result >= 0) _limiter->acquire(size_t(result));
+    return result;
+}
+
+result_t
+ThrottledSource::consume(size_t size)
+{
+    result_t result = _src->consume(size);
+    if (result == OK) _limiter->acquire(size);
+    return result;
+}
+
+result_t
+ThrottledConsumer::write(const uint8_t *src, size_t size)
+{
+    _limiter->acquire(size);
+    return _dst->write(src, size);
+}
+
+result_t
+FileListConsumer::write(const uint8_t *src, size_t size)
+{
+    if (!_file) return WORKFLOW_ERROR;
+    return _file->write(src, size);
+}
+
+result_t
+FileListConsumer::close()
+{
+    if (!_file) return OK;
+    result_t result = _file->close();
+    _file.reset();
+    return result;
+}
+
+bool
+FileListConsumer::isError()
+{
+    return _file && _file->isError();
+}
+
+result_t
+FileListConsumer::open(const std::string& name, int64_t size)
+{
+    if (_file) {
+        if (auto result = close(); result != OK) return result;
+    }
+    std::string fileName;
+    size_t lastSlashPos = name.find_last_of("\\/");
+    if (lastSlashPos != std::string::npos) {
+        fileName = name.substr(lastSlashPos + 1);
+    } else {
+        fileName = name;
+    }
+    std::filesystem::path path(base);
+    path /= fileName;
+#ifndef _WIN32
+    if (_direct_io) {
+        _file = std::make_unique<DirectFileConsumer>(path.string());
+    } else {
+        auto fdst = std::make_unique<FdConsumer>(path.string());
+        if (_bulk) fdst->setBulk(true);
+        _file = std::move(fdst);
+    }
+#else
+    _file = std::make_unique<OStreamConsumer>(path.string());
+#endif
+    return _file->isError() ? OUTPUT_STREAM_ERROR : OK;
+}
+
+#ifndef _WIN32
+struct AtomicFileListConsumer::Private {
+    struct File {
+        int fd = -1;
+        // Empty for anonymous (O_TMPFILE) file
+        std::string tmp_path;
+        std::filesystem::path path;
+    };
+
+    std::filesystem::path base;
+    unsigned int sync_group;
+    File current;
+    std::unique_ptr<FdConsumer> file;
+    uint64_t n_written = 0;
+    int64_t allocated = 0;
+    std::vector<File> pending;
+    // Final paths of completed files that were discarded
+    std::vector<std::string> failed;
+    unsigned int counter = 0;
+    result_t error = OK;
+
+    Private(const std::string& _base, unsigned int _sync_group) : base(_base), sync_group(_sync_group) {}
+
+    std::string tmpName(const std::string& name) {
+        return (base / ("." + name + "." + std::to_string(getpid()) + "." + std::to_string(counter++) + ".tmp")).string();
+    }
+
+    result_t create(const std::string& name);
+    void discard(File& f);
+    result_t publish(bool sync);
+};
+
+result_t
+AtomicFileListConsumer::Private::create(const std::string& name)
+{
+#ifdef O_TMPFILE
+    current.fd = ::open(base.c_str(), O_TMPFILE | O_WRONLY | O_CLOEXEC, 0666);
+    if (current.fd >= 0) return OK;
+#endif
+    // No O_TMPFILE support on this system or filesystem, use hidden temporary file
+    for (int i = 0; i < 100; i++) {
+        current.tmp_path = tmpName(name);
+        current.fd = ::open(current.tmp_path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+        if ((current.fd >= 0) || (errno != EEXIST)) break;
+    }
+    if (current.fd < 0) {
+        LOG_ERROR("Cannot create temporary file in {}: {}", base.string(), strerror(errno));
+        current = {};
+        return OUTPUT_STREAM_ERROR;
+    }
+    return OK;
+}
+
+void
+AtomicFileListConsumer::Private::discard(File& f)
+{
+    if (f.fd >= 0) ::close(f.fd);
+    if (!f.tmp_path.empty()) ::unlink(f.tmp_path.c_str());
+    f = {};
+}
+
+result_t
+AtomicFileListConsumer::Private::publish(bool sync)
+{
+    if (pending.empty()) return OK;
+    bool published = false;
+    for (File& f : pending) {
+        // After a failure the rest of group is discarded, every discarded file is recorded for caller
+        if (error != OK) {
+            failed.push_back(f.path.string());
+            discard(f);
+            continue;
+        }
+#ifdef __APPLE__
+        if (sync && (::fsync(f.fd) != 0)) {
+#else
+        if (sync && (::fdatasync(f.fd) != 0)) {
+#endif
+            LOG_ERROR("Cannot sync {}: {}", f.path.string(), strerror(errno));
+            error = OUTPUT_ERROR;
+            failed.push_back(f.path.string());
+            discard(f);
+            continue;
+        }
+        std::string tmp_path = f.tmp_path;
+        if (tmp_path.empty()) {
+            // Anonymous file has to be linked to a temporary name first, as linkat cannot replace
+            tmp_path = tmpName(f.path.filename().string());
+            std::string proc_path = "/proc/self/fd/" + std::to_string(f.fd);
+            if (::linkat(AT_FDCWD, proc_path.c_str(), AT_FDCWD, tmp_path.c_str(), AT_SYMLINK_FOLLOW) != 0) {
+                LOG_ERROR("Cannot link {}: {}", f.path.string(), strerror(errno));
+                error = OUTPUT_STREAM_ERROR;
+                failed.push_back(f.path.string());
+                discard(f);
+                continue;
+            }
+        }
+        if (::rename(tmp_path.c_str(), f.path.c_str()) != 0) {
+            LOG_ERROR("Cannot rename {} to {}: {}", tmp_path, f.path.string(), strerror(errno));
+            ::unlink(tmp_path.c_str());
+            error = OUTPUT_STREAM_ERROR;
+            failed.push_back(f.path.string());
+        } else {
+            published = true;
+        }
+        ::close(f.fd);
+        f = {};
+    }
+    pending.clear();
+    if (sync && published) {
+        // Make the new directory entries durable
+        int dir_fd = ::open(base.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if ((dir_fd < 0) || (::fsync(dir_fd) != 0)) {
+            LOG_ERROR("Cannot sync directory {}: {}", base.string(), strerror(errno));
+            error = OUTPUT_ERROR;
+        }
+        if (dir_fd >= 0) ::close(dir_fd);
+    }
+    return error;
+}
+
+AtomicFileListConsumer::AtomicFileListConsumer(const std::string& base_path, unsigned int sync_group)
+    : d(new Private(base_path, sync_group))
+{
+}
+
+AtomicFileListConsumer::~AtomicFileListConsumer()
+{
+    if (d->error == OK) {
+        finish();
+    } else {
+        abort();
+    }
+    delete d;
+}
+
+result_t
+AtomicFileListConsumer::write(const uint8_t *src, size_t size)
+{
+    if (d->error != OK) return d->error;
+    if (!d->file) return WORKFLOW_ERROR;
+    result_t result = d->file->write(src, size);
+    if (result < 0) return result;
+    d->n_written += result;
+    return result;
+}
+
+result_t
+AtomicFileListConsumer::close()
+{
+    if (!d->file) return d->error;
+    result_t result = d->file->close();
+    d->file.reset();
+    if ((result == OK) && (d->n_written < uint64_t(d->allocated)) && (::ftruncate(d->current.fd, d->n_written) != 0)) {
+        result = OUTPUT_STREAM_ERROR;
+    }
+    if (result != OK) {
+        d->discard(d->current);
+        d->error = result;
+        return result;
+    }
+    d->pending.push_back(std::move(d->current));
+    d->current = {};
+    if (d->sync_group == 0) return d->publish(false);
+    if (d->pending.size() >= d->sync_group) return d->publish(true);
+    return OK;
+}
+
+bool
+AtomicFileListConsumer::isError()
+{
+    return (d->error != OK) || (d->file && d->file->isError());
+}
+
+result_t
+AtomicFileListConsumer::open(const std::string& name, int64_t size)
+{
+    if (d->file) {
+        if (auto result = close(); result != OK) return result;
+    }
+    if (d->error != OK) return d->error;
+    std::string fileName;
+    size_t lastSlashPos = name.find_last_of("\\/");
+    if (lastSlashPos != std::string::npos) {
+        fileName = name.substr(lastSlashPos + 1);
+    } else {
+        fileName = name;
+    }
+    if (auto result = d->create(fileName); result != OK) return result;
+    d->current.path = d->base / fileName;
+    d->n_written = 0;
+    d->allocated = 0;
+    if (size > 0) {
+        // Reserve the space in one extent, failure is only fatal if the disk is full
+        int err = 0;
+#ifdef __linux__
+        if (::fallocate(d->current.fd, 0, 0, size) != 0) err = errno;
+#elif !defined(__APPLE__)
+        err = ::posix_fallocate(d->current.fd, 0, size);
+#endif
+        if (err == ENOSPC) {
+            LOG_ERROR("Cannot allocate {} bytes for {}", size, d->current.path.string());
+            d->discard(d->current);
+            return OUTPUT_ERROR;
+        }
+        if (!err) d->allocated = size;
+    }
+    d->file = std::make_unique<FdConsumer>(d->current.fd, false);
+    return OK;
+}
+
+result_t
+AtomicFileListConsumer::finish()
+{
+    if (auto result = close(); result != OK) return result;
+    return d->publish(d->sync_group > 0);
+}
+
+void
+AtomicFileListConsumer::abort()
+{
+    d->file.reset();
+    d->discard(d->current);
+    for (Private::File& f : d->pending) {
+        d->failed.push_back(f.path.string());
+        d->discard(f);
+    }
+    d->pending.clear();
+}
+
+size_t
+AtomicFileListConsumer::getNumPending() const
+{
+    return d->pending.size();
+}
+
+const std::vector<std::string>&
+AtomicFileListConsumer::getFailed() const
+{
+    return d->failed;
+}
+
+struct MemfdConsumer::Private {
+    File current = {{}, -1, 0};
+    std::unique_ptr<FdConsumer> file;
+    std::vector<File> files;
+    result_t error = OK;
+
+    void discard() {
+        file.reset();
+        if (current.fd >= 0) ::close(current.fd);
+        current = {{}, -1, 0};
+    }
+};
+
+MemfdConsumer::MemfdConsumer()
+    : d(new Private)
+{
+}
+
+MemfdConsumer::~MemfdConsumer()
+{
+    d->discard();
+    for (File& f : d->files) ::close(f.fd);
+    delete d;
+}
+
+result_t
+MemfdConsumer::write(const uint8_t *src, size_t size)
+{
+    if (d->error != OK) return d->error;
+    if (!d->file) return WORKFLOW_ERROR;
+    result_t result = d->file->write(src, size);
+    if (result < 0) return result;
+    d->current.size += result;
+    return result;
+}
+
+result_t
+MemfdConsumer::close()
+{
+    if (!d->file) return d->error;
+    result_t result = d->file->close();
+    d->file.reset();
+#ifdef F_SEAL_SEAL
+    if (result == OK) {
+        int fd = d->current.fd;
+        // Drop the unused part of preallocated size and rewind for the receiver
+        if ((::ftruncate(fd, off_t(d->current.size)) != 0) || (::lseek(fd, 0, SEEK_SET) != 0) ||
+            (::fcntl(fd, F_ADD_SEALS, F_SEAL_WRITE | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0)) {
+            LOG_ERROR("Cannot seal memfd for {}: {}", d->current.name, strerror(errno));
+            result = OUTPUT_STREAM_ERROR;
+        }
+    }
+#endif
+    if (result != OK) {
+        d->discard();
+        d->error = result;
+        return result;
+    }
+    d->files.push_back(std::move(d->current));
+    d->current = {{}, -1, 0};
+    return OK;
+}
+
+bool
+MemfdConsumer::isError()
+{
+    return (d->error != OK) || (d->file && d->file->isError());
+}
+
+result_t
+MemfdConsumer::open(const std::string& name, int64_t size)
+{
+    if (d->file) {
+        if (auto result = close(); result != OK) return result;
+    }
+    if (d->error != OK) return d->error;
+#if defined(MFD_ALLOW_SEALING) && defined(F_SEAL_SEAL)
+    std::string fileName;
+    size_t lastSlashPos = name.find_last_of("\\/");
+    if (lastSlashPos != std::string::npos) {
+        fileName = name.substr(lastSlashPos + 1);
+    } else {
+        fileName = name;
+    }
+    // The name is only informative (shown in /proc/self/fd) and limited to 249 bytes
+    int fd = ::memfd_create(("cdoc:" + fileName.substr(0, 240)).c_str(), MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        LOG_ERROR("Cannot create memfd for {}: {}", name, strerror(errno));
+        return OUTPUT_STREAM_ERROR;
+    }
+    d->current = {name, fd, 0};
+    if (size > 0) {
+        // Reserve the memory up front, so that running out of it is detected before decrypting
+        int err = 0;
+#ifdef __linux__
+        if (::fallocate(fd, 0, 0, size) != 0) err = errno;
+#else
+        err = ::posix_fallocate(fd, 0, size);
+#endif
+        if (err == ENOSPC) {
+            LOG_ERROR("Cannot allocate {} bytes for {}", size, name);
+            d->discard();
+            return OUTPUT_ERROR;
+        }
+    }
+    d->file = std::make_unique<FdConsumer>(fd, false);
+    return OK;
+#else
+    return NOT_IMPLEMENTED;
+#endif
+}
+
+const std::vector<MemfdConsumer::File>&
+MemfdConsumer::getFiles() const
+{
+    return d->files;
+}
+
+std::vector<MemfdConsumer::File>
+MemfdConsumer::release()
+{
+    return std::exchange(d->files, {});
+}
+#endif
+
+FileListSource::FileListSource(const std::string& base, const std::vector<std::string>& files, bool bulk)
+	: _base(base), _files(files), _current(-1), _bulk(bulk)
+{
+}
+
+int64_t
+FileListSource::read(uint8_t *dst, size_t size)
+{
+	if ((_current < 0) || (_current >= _files.size())) return WORKFLOW_ERROR;
+	return _src->read(dst, size);
+}
+
+bool
+FileListSource::isError()
+{
+    if ((_current < 0) || (_current >= _files.size())) return OK;
+	return _src->isError();
+}
+
+bool
+FileListSource::isEof()
+{
+	if (_current < 0) return false;
+	if (_current >= _files.size()) return true;
+	return _src->isEof();
+}
+
+libcdoc::result_t
+FileListSource::getNumComponents()
+{
+	return _files.size();
+}
+
+libcdoc::result_t
+FileListSource::next(std::string& name, int64_t& size)
+{
+	_src.reset();
+	_current += 1;
+	if (_current >= _files.size()) return END_OF_STREAM;
+	std::filesystem::path path(_base);
+	path.append(_files[_current]);
+	if (!std::filesystem::exists(path)) return IO_ERROR;
+#ifdef _WIN32
+	_src = std::make_unique<IStreamSource>(new std::ifstream(path, std::ios_base::in | std::ios_base::binary), true);
+#else
+	auto fsrc = std::make_unique<FdSource>(path.string());
+	if (_bulk) fsrc->setBulk(true);
+	_src = std::move(fsrc);
+#endif
+	if (_src->isError()) return IO_ERROR;
+	name = _files[_current];
+	size = std::filesystem::file_size(path);
+    return OK;
+}
+
+struct PrefetchFileListSource::Private {
+    struct Entry {
+        std::unique_ptr<DataSource> src;
+        int64_t size = 0;
+        // The first bytes of file read by helper thread
+        BufferPool::Buffer head;
+        size_t head_len = 0;
+        result_t error = OK;
+        bool ready = false;
+    };
+
+    std::filesystem::path base;
+    std::vector<std::string> files;
+    unsigned int prefetch;
+    size_t head_size;
+    std::vector<Entry> entries;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<std::thread> threads;
+    bool stop = false;
+    size_t next_prefetch = 0;
+    int64_t current = -1;
+    size_t head_pos = 0;
+    result_t error = OK;
+
+    Private(const std::string& _base, const std::vector<std::string>& _files, unsigned int _prefetch, size_t _head_size)
+        : base(_base), files(_files), prefetch(std::max(_prefetch, 1U)), head_size(std::max<size_t>(_head_size, 1)), entries(files.size()) {}
+
+    void run();
+    void open(Entry& entry, const std::string& name);
+    result_t check();
+};
+
+void
+PrefetchFileListSource::Private::open(Entry& entry, const std::string& name)
+{
+    std::filesystem::path path(base);
+    path.append(name);
+    std::error_code ec;
+    entry.size = int64_t(std::filesystem::file_size(path, ec));
+    if (ec) {
+        entry.error = IO_ERROR;
+        return;
+    }
+#ifdef _WIN32
+    entry.src = std::make_unique<IStreamSource>(new std::ifstream(path, std::ios_base::in | std::ios_base::binary), true);
+#else
+    entry.src = std::make_unique<FdSource>(path.string());
+#endif
+    if (entry.src->isError()) {
+        entry.error = IO_ERROR;
+        return;
+    }
+    entry.head = BufferPool::get(head_size);
+    result_t result = entry.src->read(entry.head.data(), head_size);
+    if (result < 0) {
+        entry.error = result;
+        return;
+    }
+    entry.head_len = size_t(result);
+}
+
+// Whether the current entry can be read, the error of failed entry or read otherwise
+result_t
+PrefetchFileListSource::Private::check()
+{
+    if ((current < 0) || (current >= int64_t(files.size()))) return WORKFLOW_ERROR;
+    Entry& entry = entries[current];
+    if (entry.error != OK) return entry.error;
+    if (!entry.src) return WORKFLOW_ERROR;
+    return error;
+}
+
+void
+PrefetchFileListSource::Private::run()
+{
+    while (true) {
+        size_t idx;
+        {
+            std::unique_lock lock(mutex);
+            cv.wait(lock, [this]{ return stop || (next_prefetch >= files.size()) || (int64_t(next_prefetch) <= current + prefetch); });
+            if (stop || (next_prefetch >= files.size())) return;
+            idx = next_prefetch++;
+        }
+        Entry entry;
+        open(entry, files[idx]);
+        std::lock_guard lock(mutex);
+        entries[idx] = std::move(entry);
+        entries[idx].ready = true;
+        cv.notify_all();
+    }
+}
+
+PrefetchFileListSource::PrefetchFileListSource(const std::string& base, const std::vector<std::string>& files, unsigned int prefetch, size_t head_size)
+    : d(new Private(base, files, prefetch, head_size))
+{
+}
+
+PrefetchFileListSource::~PrefetchFileListSource()
+{
+    {
+        std::lock_guard lock(d->mutex);
+        d->stop = true;
+        d->cv.notify_all();
+    }
+    for (std::thread& thread : d->threads) thread.join();
+    delete d;
+}
+
+result_t
+PrefetchFileListSource::read(uint8_t *dst, size_t size)
+{
+    if (result_t result = d->check(); result != OK) return result;
+    Private::Entry& entry = d->entries[d->current];
+    size_t n_copied = 0;
+    if (d->head_pos < entry.head_len) {
+        n_copied = std::min(size, entry.head_len - d->head_pos);
+        std::memcpy(dst, entry.head.data() + d->head_pos, n_copied);
+        d->head_pos += n_copied;
+    }
+    if (n_copied < size) {
+        result_t result = entry.src->read(dst + n_copied, size - n_copied);
+        if (result < 0) {
+            d->error = result;
+            return result;
+        }
+        n_copied += result;
+    }
+    return n_copied;
+}
+
+result_t
+PrefetchFileListSource::peek(const uint8_t **ptr, size_t max)
+{
+#ifdef _WIN32
+    // Stream sources cannot lend data after the prefetched head
+    return NOT_IMPLEMENTED;
+#else
+    if (result_t result = d->check(); result != OK) return result;
+    Private::Entry& entry = d->entries[d->current];
+    if (d->head_pos < entry.head_len) {
+        *ptr = entry.head.data() + d->head_pos;
+        return std::min(max, entry.head_len - d->head_pos);
+    }
+    result_t result = entry.src->peek(ptr, max);
+    if (result < 0) d->error = result;
+    return result;
+#endif
+}
+
+result_t
+PrefetchFileListSource::consume(size_t size)
+{
+    if (result_t result = d->check(); result != OK) return result;
+    Private::Entry& entry = d->entries[d->current];
+    if (d->head_pos < entry.head_len) {
+        if (size > entry.head_len - d->head_pos) return WRONG_ARGUMENTS;
+        d->head_pos += size;
+        return OK;
+    }
+    result_t result = entry.src->consume(size);
+    if (result < 0) d->error = result;
+    return result;
+}
+
+bool
+PrefetchFileListSource::isError()
+{
+    if ((d->current < 0) || (d->current >= int64_t(d->files.size()))) return false;
+    Private::Entry& entry = d->entries[d->current];
+    return (d->error != OK) || (entry.error != OK) || (entry.src && entry.src->isError());
+}
+
+bool
+PrefetchFileListSource::isEof()
+{
+    if (d->current < 0) return false;
+    if (d->current >= int64_t(d->files.size())) return true;
+    Private::Entry& entry = d->entries[d->current];
+    if ((entry.error != OK) || !entry.src) return false;
+    return (d->head_pos >= entry.head_len) && entry.src->isEof();
+}
+
+result_t
+PrefetchFileListSource::getNumComponents()
+{
+    return d->files.size();
+}
+
+result_t
+PrefetchFileListSource::next(std::string& name, int64_t& size)
+{
+    std::unique_lock lock(d->mutex);
+    if ((d->current >= 0) && (d->current < int64_t(d->files.size()))) d->entries[d->current] = {};
+    if (d->current < int64_t(d->files.size())) d->current += 1;
+    d->head_pos = 0;
+    d->error = OK;
+    if (d->current >= int64_t(d->files.size())) return END_OF_STREAM;
+    if (d->threads.empty()) {
+        size_t n_threads = std::min<size_t>(d->prefetch, d->files.size());
+        for (size_t i = 0; i < n_threads; i++) d->threads.emplace_back(&Private::run, d);
+    }
+    d->cv.notify_all();
+    d->cv.wait(lock, [this]{ return d->entries[d->current].ready; });
+    Private::Entry& entry = d->entries[d->current];
+    if (entry.error != OK) return entry.error;
+    name = d->files[d->current];
+    size = entry.size;
     return OK;
 }
 
@@ -23,6 +23,9 @@
 
 #include <filesystem>
 #include <fstream>
+#include <functional>
+#include <memory>
+#include <span>
 
 namespace libcdoc {
 
@@ -84,10 +87,20 @@ struct CDOC_EXPORT DataConsumer {
     result_t write(const std::string& src) {
 		return write((const uint8_t *) src.data(), src.size());
 	}
+    /**
+     * @brief announce the number of bytes that will be written next
+     *
+     * A hint that lets in-memory consumers allocate the space at once. For MultiDataConsumer it applies
+     * to the current sub-stream. The default implementation does nothing.
+     * @param size the number of bytes
+     * @return error code or OK
+     */
+    virtual result_t reserve(uint64_t size) { return OK; }
     /**
      * @brief write all data from input object
      *
-     * Copies all bytes from input source (until EOF or error) to the consumer. If error occurs
+     * Copies all bytes from input source (until EOF or error) to the consumer. If the source supports
+     * borrowing (peek), the data is written directly from the source buffers. If error occurs
      * while reading source, the source objects' error code is returned.
      * @param src the input DataSource
      * @return the number of bytes copied or error
@@ -111,11 +124,19 @@ struct CDOC_EXPORT DataSource {
      * @brief set stream input pointer
 	 *
 	 * Positions the read pointer at the specific distance from the stream start.
-	 * If the stream does not support seeking NOT_IMPLEMENTED is returned.
+	 * If the stream does not support seeking NOT_IMPLEMENTED is returned. Seeking beyond the end of data
+	 * fails and leaves the read pointer unchanged.
 	 * @param pos the position from the beggining of data
 	 * @return error code or OK
 	 */
     virtual result_t seek(size_t pos) { return NOT_IMPLEMENTED; }
+    /**
+     * @brief get stream input pointer
+     *
+     * If the stream does not track its position NOT_IMPLEMENTED is returned.
+     * @return the position from the beginning of data or error code
+     */
+    virtual result_t tell() { return NOT_IMPLEMENTED; }
 	/**
      * @brief read bytes from input object
 	 *
@@ -128,6 +149,26 @@ struct CDOC_EXPORT DataSource {
      * @return the number of bytes read or error code
 	 */
     virtual result_t read(uint8_t *dst, size_t size) { return NOT_IMPLEMENTED; }
+    /**
+     * @brief borrow bytes from input object without copying
+     *
+     * Makes up to max bytes of input data available at ptr. The data stays valid until the next call to any
+     * other method of this source and is not consumed until consume is called.
+     * Sources that do not keep the data in memory return NOT_IMPLEMENTED, in that case read has to be used.
+     * - if there is neither error nor eof then 0 < result <= max
+     * - if end of stream is reached then result == 0
+     * - if there is error then result < 0
+     * @param ptr the pointer to the available data
+     * @param max the maximum number of bytes to borrow
+     * @return the number of bytes available or error code
+     */
+    virtual result_t peek(const uint8_t **ptr, size_t max) { return NOT_IMPLEMENTED; }
+    /**
+     * @brief advance input pointer past borrowed bytes
+     * @param size the number of bytes to consume, not more than was made available by peek
+     * @return error code or OK
+     */
+    virtual result_t consume(size_t size) { return NOT_IMPLEMENTED; }
     /**
      * @brief check whether DataConsumer is in error state
      * @return true if error state
@@ -152,6 +193,8 @@ struct CDOC_EXPORT DataSource {
     /**
      * @brief skip specified number of bytes
      *
+     * Sources that support tell and seek jump over the data, borrowing sources advance the input pointer
+     * without copying, others read and discard the data.
      * The following invariant holds:
      * - if there is neither error nor eof then result == size
      * - if there is no errors but end of stream is reached then 0 <= result <= size
@@ -236,6 +279,10 @@ struct CDOC_EXPORT ChainedSource : public DataSource {
     result_t read(uint8_t *dst, size_t size) {
 		return _src->read(dst, size);
 	}
+	// Data of inner source is not lent, as subclasses usually transform it in read
+	// Pass-through adapters override these to forward to inner source
+    result_t peek(const uint8_t **ptr, size_t max) override { return NOT_IMPLEMENTED; }
+    result_t consume(size_t size) override { return NOT_IMPLEMENTED; }
 	bool isError() {
 		return _src->isError();
 	}
@@ -248,7 +295,14 @@ protected:
 };
 
 struct CDOC_EXPORT IStreamSource : public DataSource {
-	IStreamSource(std::istream *ifs, bool take_ownership = false) : _ifs(ifs), _owned(take_ownership) {}
+	IStreamSource(std::istream *ifs, bool take_ownership = false) : _ifs(ifs), _owned(take_ownership) {
+        // Streams that do not tell their position cannot seek
+        std::streampos cur = _ifs->tellg();
+        if (cur < 0) return;
+        _ifs->seekg(0, std::ios_base::end);
+        _size = _ifs->tellg();
+        _ifs->seekg(cur);
+	}
 	IStreamSource(const std::string& path);
 	~IStreamSource() {
         if (_owned) delete _ifs;
@@ -256,6 +310,8 @@ struct CDOC_EXPORT IStreamSource : public DataSource {
 
     result_t seek(size_t pos) {
         if(_ifs->bad()) return INPUT_STREAM_ERROR;
+        if (_size < 0) return NOT_IMPLEMENTED;
+        if (std::streamoff(pos) > _size) return INPUT_STREAM_ERROR;
         _ifs->clear();
 		_ifs->seekg(pos);
         //std::cerr << "Stream bad:" << _ifs->bad() << " eof:" << _ifs->eof() << " fail:" << _ifs->fail() << std::endl;
@@ -263,6 +319,12 @@ struct CDOC_EXPORT IStreamSource : public DataSource {
         return bool(_ifs->bad()) ? INPUT_STREAM_ERROR : OK;
 	}
 
+    result_t tell() {
+        if(_ifs->bad()) return INPUT_STREAM_ERROR;
+        std::streampos pos = _ifs->tellg();
+        return (pos < 0) ? result_t(NOT_IMPLEMENTED) : result_t(pos);
+    }
+
     result_t read(uint8_t *dst, size_t size) {
 		_ifs->read((char *) dst, size);
 		return (_ifs->bad()) ? INPUT_STREAM_ERROR : _ifs->gcount();
@@ -273,8 +335,466 @@ struct CDOC_EXPORT IStreamSource : public DataSource {
 protected:
 	std::istream *_ifs;
 	bool _owned;
+	// Size of stream on construction (-1 if not seekable)
+	std::streamoff _size = -1;
+};
+
+/**
+ * @brief A read-only memory-mapped file source
+ *
+ * Maps the whole file into memory and serves read and seek directly from the mapping, without
+ * intermediate stream buffers. If the file cannot be mapped the source is left in error state.
+ */
+struct CDOC_EXPORT MmapSource : public DataSource {
+    MmapSource(const std::string& path);
+    ~MmapSource();
+
+    result_t seek(size_t pos) override;
+    result_t tell() override;
+    result_t read(uint8_t *dst, size_t size) override;
+    result_t peek(const uint8_t **ptr, size_t max) override;
+    result_t consume(size_t size) override;
+
+    bool isError() override { return _error != OK; }
+    bool isEof() override { return _ptr >= _size; }
+
+    /**
+     * @brief get the mapped file data
+     * @return a pointer to the start of file or null if not mapped
+     */
+    const uint8_t *data() const { return _data; }
+    /**
+     * @brief get the size of mapped file
+     * @return the file size
+     */
+    size_t size() const { return _size; }
+protected:
+    const uint8_t *_data = nullptr;
+    size_t _size = 0;
+    size_t _ptr = 0;
+    result_t _error = OK;
+#ifdef _WIN32
+    void *_mapping = nullptr;
+#endif
+};
+
+#ifndef _WIN32
+/**
+ * @brief A memory-mapped file consumer
+ *
+ * Creates the file, extends it to the expected size and maps it into memory. Data can be either written
+ * or produced directly into the mapping with getBuffer and commit, so that a decrypting reader can
+ * decompress straight into the page cache without intermediate buffers or write system calls. The
+ * mapping is grown if more data than expected is written, and the file is truncated to the number of
+ * bytes written on close.
+ */
+struct CDOC_EXPORT MmapFileConsumer : public DataConsumer {
+    /**
+     * @brief create a new MmapFileConsumer
+     * @param path the file path
+     * @param size the expected file size
+     */
+    MmapFileConsumer(const std::string& path, uint64_t size);
+    ~MmapFileConsumer();
+
+    result_t write(const uint8_t *src, size_t size) override;
+    /**
+     * @brief unmap the file and truncate it to the number of bytes written
+     * @return error code or OK
+     */
+    result_t close() override;
+    bool isError() override { return _error != OK; }
+    /**
+     * @brief grow the file and mapping to hold at least size bytes from current position
+     * @param size the number of bytes to be written
+     * @return error code or OK
+     */
+    result_t reserve(uint64_t size) override;
+
+    /**
+     * @brief get the unwritten part of mapping
+     * @param ptr a pointer to the current write position
+     * @return the number of bytes available at ptr or error code
+     */
+    result_t getBuffer(uint8_t **ptr);
+    /**
+     * @brief mark bytes produced into buffer as written
+     * @param size the number of bytes, not more than returned by getBuffer
+     * @return error code or OK
+     */
+    result_t commit(size_t size);
+    /**
+     * @brief get the number of bytes written
+     */
+    uint64_t getPos() const { return _pos; }
+protected:
+    result_t map(uint64_t size);
+
+    int _fd = -1;
+    uint8_t *_data = nullptr;
+    uint64_t _size = 0;
+    uint64_t _pos = 0;
+    result_t _error = OK;
+};
+
+/**
+ * @brief A file source that keeps several reads in flight
+ *
+ * Reads the file sequentially in blocks, keeping up to queue_depth block reads queued with io_uring
+ * ahead of the consumer, so that disk I/O overlaps with the processing of data. The blocks are
+ * registered as fixed buffers if possible. If io_uring is not available, the blocks are read
+ * synchronously with pread.
+ */
+struct CDOC_EXPORT UringFileSource : public DataSource {
+    static constexpr unsigned int DEFAULT_QUEUE_DEPTH = 4;
+    static constexpr size_t DEFAULT_BLOCK_SIZE = 256 * 1024;
+
+    UringFileSource(const std::string& path, unsigned int queue_depth = DEFAULT_QUEUE_DEPTH, size_t block_size = DEFAULT_BLOCK_SIZE);
+    ~UringFileSource();
+
+    result_t seek(size_t pos) override;
+    result_t tell() override;
+    result_t read(uint8_t *dst, size_t size) override;
+    result_t peek(const uint8_t **ptr, size_t max) override;
+    result_t consume(size_t size) override;
+    bool isError() override;
+    bool isEof() override;
+
+    /**
+     * @brief check whether io_uring is used
+     * @return false if the synchronous fallback is used
+     */
+    bool isAsync() const;
+private:
+    struct Private;
+    Private *d;
+};
+
+/**
+ * @brief A file consumer that keeps several writes in flight
+ *
+ * Collects data into blocks and queues each full block as an io_uring write, so that the producer can
+ * continue while up to queue_depth blocks are being written. Buffers are reused only after their write has
+ * completed. Write errors are reported by the next write or close. If io_uring is not available, the
+ * blocks are written synchronously with pwrite.
+ */
+struct CDOC_EXPORT UringFileConsumer : public DataConsumer {
+    static constexpr unsigned int DEFAULT_QUEUE_DEPTH = 4;
+    static constexpr size_t DEFAULT_BLOCK_SIZE = 256 * 1024;
+
+    UringFileConsumer(const std::string& path, unsigned int queue_depth = DEFAULT_QUEUE_DEPTH, size_t block_size = DEFAULT_BLOCK_SIZE);
+    ~UringFileConsumer();
+
+    result_t write(const uint8_t *src, size_t size) override;
+    result_t close() override;
+    bool isError() override;
+
+    /**
+     * @brief check whether io_uring is used
+     * @return false if the synchronous fallback is used
+     */
+    bool isAsync() const;
+private:
+    struct Private;
+    Private *d;
+};
+
+/**
+ * @brief A file consumer that bypasses the page cache
+ *
+ * Opens the file with O_DIRECT (F_NOCACHE on macOS) and writes it through an aligned staging buffer in
+ * whole blocks, so that bulk output does not evict other data from the cache. The unaligned tail is written
+ * without direct I/O on close. If the filesystem does not support direct I/O, normal writes are used.
+ */
+struct CDOC_EXPORT DirectFileConsumer : public DataConsumer {
+    static constexpr size_t ALIGNMENT = 4096;
+    static constexpr size_t DEFAULT_BUFFER_SIZE = 1024 * 1024;
+
+    DirectFileConsumer(const std::string& path, size_t buffer_size = DEFAULT_BUFFER_SIZE);
+    ~DirectFileConsumer();
+
+    result_t write(const uint8_t *src, size_t size) override;
+    result_t close() override;
+    bool isError() override { return _error != OK; }
+
+    /**
+     * @brief check whether the file was opened for direct I/O
+     * @return false if the filesystem does not support direct I/O
+     */
+    bool isDirect() const { return _direct; }
+protected:
+    result_t writeBuffer(size_t len);
+
+    int _fd = -1;
+    uint8_t *_buf = nullptr;
+    size_t _buf_size;
+    size_t _buf_len = 0;
+    bool _direct = false;
+    result_t _error = OK;
+};
+
+/**
+ * @brief A file source that bypasses the page cache
+ *
+ * Opens the file with O_DIRECT (F_NOCACHE on macOS) and reads it in aligned blocks into a staging buffer.
+ * If the filesystem does not support direct I/O, normal reads are used.
+ */
+struct CDOC_EXPORT DirectFileSource : public DataSource {
+    static constexpr size_t ALIGNMENT = 4096;
+    static constexpr size_t DEFAULT_BUFFER_SIZE = 1024 * 1024;
+
+    DirectFileSource(const std::string& path, size_t buffer_size = DEFAULT_BUFFER_SIZE);
+    ~DirectFileSource();
+
+    result_t seek(size_t pos) override;
+    result_t tell() override;
+    result_t read(uint8_t *dst, size_t size) override;
+    result_t peek(const uint8_t **ptr, size_t max) override;
+    result_t consume(size_t size) override;
+    bool isError() override { return _error != OK; }
+    bool isEof() override { return (_buf_offset + _buf_pos) >= _size; }
+
+    /**
+     * @brief check whether the file was opened for direct I/O
+     * @return false if the filesystem does not support direct I/O
+     */
+    bool isDirect() const { return _direct; }
+    int getFd() const { return _fd; }
+protected:
+    result_t fill(uint64_t offset);
+
+    int _fd = -1;
+    uint8_t *_buf = nullptr;
+    size_t _buf_size;
+    uint64_t _buf_offset = 0;
+    size_t _buf_len = 0;
+    size_t _buf_pos = 0;
+    uint64_t _size = 0;
+    bool _direct = false;
+    result_t _error = OK;
+};
+
+/**
+ * @brief A buffered source that reads from a POSIX file descriptor
+ *
+ * Works with regular files as well as pipes and sockets. The latter cannot seek, except inside the
+ * current buffer, whether the descriptor can seek is decided once on construction. Reads larger than the buffer go directly to the destination and interrupted system
+ * calls are retried.
+ *
+ * In bulk mode the file is read with sequential access advice and the pages already read are dropped
+ * from page cache in BULK_WINDOW steps, so that streaming a large file once does not evict the working
+ * set of other processes.
+ */
+struct CDOC_EXPORT FdSource : public DataSource {
+    static constexpr size_t DEFAULT_BUFFER_SIZE = 256 * 1024;
+    static constexpr uint64_t BULK_WINDOW = 8 * 1024 * 1024;
+
+    /**
+     * @brief create a source from an open file descriptor
+     * @param fd the file descriptor
+     * @param take_ownership if true the descriptor is closed in destructor
+     * @param buffer_size the size of read buffer
+     */
+    FdSource(int fd, bool take_ownership = false, size_t buffer_size = DEFAULT_BUFFER_SIZE);
+    /**
+     * @brief open a file for reading
+     * @param path the file path
+     * @param buffer_size the size of read buffer
+     */
+    FdSource(const std::string& path, size_t buffer_size = DEFAULT_BUFFER_SIZE);
+    ~FdSource();
+
+    result_t seek(size_t pos) override;
+    result_t tell() override;
+    result_t read(uint8_t *dst, size_t size) override;
+    result_t peek(const uint8_t **ptr, size_t max) override;
+    result_t consume(size_t size) override;
+    bool isError() override { return _error != OK; }
+    bool isEof() override { return _eof && (_buf_pos >= _buf_len); }
+
+    int getFd() const { return _fd; }
+    /**
+     * @brief get the system error code of the last failed operation
+     * @return errno value or 0
+     */
+    int getErrno() const { return _errno; }
+    /**
+     * @brief enable or disable bulk (page cache friendly) mode
+     * @param bulk true to enable bulk mode
+     */
+    void setBulk(bool bulk);
+protected:
+    result_t fill();
+    void advance(size_t size);
+
+    int _fd;
+    bool _owned;
+    std::vector<uint8_t> _buf;
+    // File offset of the descriptor, the buffer holds bytes preceding it
+    uint64_t _offset = 0;
+    // Start of the range not yet dropped from page cache in bulk mode
+    uint64_t _dropped = 0;
+    bool _bulk = false;
+    size_t _buf_len = 0;
+    size_t _buf_pos = 0;
+    bool _eof = false;
+    bool _seekable = false;
+    // Size of regular file on construction (-1 if not a regular file)
+    int64_t _size = -1;
+    int _errno = 0;
+    result_t _error = OK;
+};
+
+/**
+ * @brief A buffered consumer that writes to a POSIX file descriptor
+ *
+ * Works with regular files as well as pipes and sockets. Writes larger than the buffer go directly to
+ * the descriptor, interrupted and partial writes are continued. The system error (e.g. ENOSPC) is
+ * available from getErrno.
+ *
+ * In bulk mode the writeback of each BULK_WINDOW of written data is started immediately, and the
+ * previous window is waited for and dropped from page cache, so that writing a large file does not fill
+ * the cache with dirty pages that will not be read again.
+ */
+struct CDOC_EXPORT FdConsumer : public DataConsumer {
+    static constexpr size_t DEFAULT_BUFFER_SIZE = 256 * 1024;
+    static constexpr uint64_t BULK_WINDOW = 8 * 1024 * 1024;
+
+    /**
+     * @brief create a consumer from an open file descriptor
+     *
+     * If the consumer does not own the descriptor, close only flushes buffered data.
+     * @param fd the file descriptor
+     * @param take_ownership if true the descriptor is closed in close or destructor
+     * @param buffer_size the size of write buffer
+     */
+    FdConsumer(int fd, bool take_ownership = false, size_t buffer_size = DEFAULT_BUFFER_SIZE);
+    /**
+     * @brief create or truncate a file for writing
+     * @param path the file path
+     * @param buffer_size the size of write buffer
+     */
+    FdConsumer(const std::string& path, size_t buffer_size = DEFAULT_BUFFER_SIZE);
+    ~FdConsumer();
+
+    result_t write(const uint8_t *src, size_t size) override;
+    result_t close() override;
+    bool isError() override { return _error != OK; }
+
+    int getFd() const { return _fd; }
+    /**
+     * @brief get the system error code of the last failed operation
+     * @return errno value or 0
+     */
+    int getErrno() const { return _errno; }
+    /**
+     * @brief enable or disable bulk (page cache friendly) mode
+     * @param bulk true to enable bulk mode
+     */
+    virtual void setBulk(bool bulk);
+protected:
+    virtual result_t flush();
+    result_t writeFully(const uint8_t *src, size_t size);
+    void written(size_t size);
+
+    int _fd;
+    bool _owned;
+    std::vector<uint8_t> _buf;
+    size_t _buf_len = 0;
+    // File offsets of written data, writeback started for [_dropped, _synced), data after it not yet
+    uint64_t _bulk_pos = 0;
+    uint64_t _synced = 0;
+    uint64_t _dropped = 0;
+    bool _bulk = false;
+    int _errno = 0;
+    result_t _error = OK;
 };
 
+/**
+ * @brief A file descriptor consumer that gathers writes into vectored system calls
+ *
+ * Small writes are collected into the buffer (callers may reuse their memory after write returns). A write
+ * that does not fit is sent together with the buffered data by a single writev without copying it. If
+ * the start offset is given, pwritev is used and the file position of descriptor is not changed.
+ */
+struct CDOC_EXPORT WritevConsumer : public FdConsumer {
+    /**
+     * @brief create a consumer from an open file descriptor
+     * @param fd the file descriptor
+     * @param take_ownership if true the descriptor is closed in close or destructor
+     * @param buffer_size the number of bytes collected before flushing
+     * @param offset the file offset to write at, or -1 to use the descriptor position
+     */
+    WritevConsumer(int fd, bool take_ownership = false, size_t buffer_size = DEFAULT_BUFFER_SIZE, int64_t offset = -1);
+    /**
+     * @brief create or truncate a file for writing
+     * @param path the file path
+     * @param buffer_size the number of bytes collected before flushing
+     */
+    WritevConsumer(const std::string& path, size_t buffer_size = DEFAULT_BUFFER_SIZE);
+    ~WritevConsumer();
+
+    result_t write(const uint8_t *src, size_t size) override;
+    void setBulk(bool bulk) override;
+
+    /**
+     * @brief get the number of write system calls made so far
+     */
+    uint64_t getNumCalls() const { return _n_calls; }
+protected:
+    result_t flush() override;
+    result_t writeGathered(const uint8_t *src, size_t size);
+
+    int64_t _offset;
+    uint64_t _n_calls = 0;
+};
+
+/**
+ * @brief A consumer that sends data to a connected socket with zero-copy transmission
+ *
+ * Data is collected into a ring of buffers and each full buffer is sent with MSG_ZEROCOPY, so that the
+ * kernel transmits directly from the buffer instead of copying it. A buffer is reused only after the
+ * kernel has reported (on socket error queue) that all sends from it are complete. If zero-copy is not
+ * supported by the system or socket type (e.g. UNIX sockets), or the kernel reports that it had to copy
+ * the data anyway, ordinary send is used instead. Non-blocking sockets are waited for with poll.
+ * SIGPIPE is never raised, a closed peer is reported as an error.
+ */
+struct CDOC_EXPORT SocketConsumer : public DataConsumer {
+    static constexpr unsigned int DEFAULT_NUM_BUFFERS = 8;
+
+    /**
+     * @brief create a new SocketConsumer
+     * @param fd the connected socket
+     * @param take_ownership if true the socket is closed in close or destructor
+     * @param num_buffers the number of buffers in ring
+     * @param buffer_size the size of each buffer, BufferPool IO chunk size if 0
+     */
+    SocketConsumer(int fd, bool take_ownership = false, unsigned int num_buffers = DEFAULT_NUM_BUFFERS, size_t buffer_size = 0);
+    ~SocketConsumer();
+
+    result_t write(const uint8_t *src, size_t size) override;
+    /**
+     * @brief send all buffered data and wait until the kernel has released all buffers
+     * @return error code or OK
+     */
+    result_t close() override;
+    bool isError() override;
+
+    /**
+     * @brief whether zero-copy sending is currently used
+     */
+    bool isZeroCopy() const;
+    /**
+     * @brief get the system error code of the last failed operation
+     * @return errno value or 0
+     */
+    int getErrno() const;
+private:
+    struct Private;
+    Private *d;
+};
+#endif
+
 struct CDOC_EXPORT OStreamConsumer : public DataConsumer {
 	static constexpr int STREAM_ERROR = -500;
 
@@ -309,6 +829,8 @@ struct CDOC_EXPORT VectorSource : public DataSource {
         return OK;
 	}
 
+    result_t tell() override { return _ptr; }
+
     result_t read(uint8_t *dst, size_t size) override {
 		size = std::min<size_t>(size, _data.size() - _ptr);
 		std::copy(_data.cbegin() + _ptr, _data.cbegin() + _ptr + size, dst);
@@ -316,6 +838,17 @@ struct CDOC_EXPORT VectorSource : public DataSource {
 		return size;
 	}
 
+    result_t peek(const uint8_t **ptr, size_t max) override {
+        *ptr = _data.data() + _ptr;
+        return std::min<size_t>(max, _data.size() - _ptr);
+    }
+
+    result_t consume(size_t size) override {
+        if (size > _data.size() - _ptr) return WRONG_ARGUMENTS;
+        _ptr += size;
+        return OK;
+    }
+
     bool isError() override { return false; }
     bool isEof() override { return _ptr >= _data.size(); }
 protected:
@@ -329,54 +862,499 @@ struct CDOC_EXPORT VectorConsumer : public DataConsumer {
 		_data.insert(_data.end(), src, src + size);
 		return size;
 	}
+    result_t reserve(uint64_t size) override final {
+        if (size > _data.max_size() - _data.size()) return OUTPUT_ERROR;
+        _data.reserve(_data.size() + size);
+        return OK;
+    }
     result_t close() override final { return OK; }
 	virtual bool isError() override final { return false; }
 protected:
     std::vector<uint8_t>& _data;
 };
 
+/**
+ * @brief A consumer that stores data in memory as a list of segments
+ *
+ * Unlike VectorConsumer, written bytes are never moved: when a segment is full a new one is allocated, so
+ * there is no reallocation and copying as the data grows. Reserve allocates a segment for the whole announced
+ * size, thus data of known size is stored contiguously.
+ */
+struct CDOC_EXPORT SegmentedConsumer : public DataConsumer {
+    static constexpr size_t DEFAULT_SEGMENT_SIZE = 64 * 1024;
+
+    /**
+     * @brief create a new SegmentedConsumer
+     * @param segment_size the minimum size of newly allocated segment
+     */
+    SegmentedConsumer(size_t segment_size = DEFAULT_SEGMENT_SIZE) : _segment_size(std::max<size_t>(segment_size, 1)) {}
+
+    result_t write(const uint8_t *src, size_t size) override final;
+    result_t reserve(uint64_t size) override final;
+    result_t close() override final { return OK; }
+    bool isError() override final { return false; }
+
+    /**
+     * @brief get the total number of bytes written
+     */
+    uint64_t size() const { return _size; }
+    /**
+     * @brief get the written data
+     *
+     * The spans stay valid until clear or destruction, later writes do not invalidate them.
+     * @return the non-empty segments in order
+     */
+    std::vector<std::span<const uint8_t>> getSpans() const;
+    /**
+     * @brief copy the written data to a single vector
+     */
+    std::vector<uint8_t> toVector() const;
+    /**
+     * @brief release all segments
+     */
+    void clear();
+protected:
+    struct Segment {
+        std::unique_ptr<uint8_t[]> data;
+        size_t capacity;
+        size_t len;
+    };
+    size_t _segment_size;
+    uint64_t _size = 0;
+    std::vector<Segment> _segments;
+};
+
+/**
+ * @brief A temporary buffer with bounded memory use
+ *
+ * Data written to the buffer is kept in memory until its size would exceed the memory limit, then the buffer
+ * transparently moves to an anonymous temporary file (unlinked on POSIX systems, so it disappears when the
+ * buffer is destroyed or the process exits). The written data can be read back through the DataSource
+ * interface, writing always appends. Configuration::SPILL_THRESHOLD sets the limit for the library's own
+ * buffers.
+ */
+struct CDOC_EXPORT SpillBuffer : public DataConsumer, public DataSource {
+    static constexpr size_t DEFAULT_MEMORY_LIMIT = 64 * 1024 * 1024;
+
+    /**
+     * @brief create a new SpillBuffer
+     * @param memory_limit the maximum number of bytes kept in memory
+     * @param dir the directory for temporary file (system temporary directory if empty)
+     */
+    SpillBuffer(size_t memory_limit = DEFAULT_MEMORY_LIMIT, const std::string& dir = {});
+    ~SpillBuffer();
+
+    using DataConsumer::write;
+    result_t write(const uint8_t *src, size_t size) override final;
+    /**
+     * @brief prepare for writing size bytes
+     *
+     * If the data would not fit into memory limit, the buffer spills to temporary file immediately.
+     */
+    result_t reserve(uint64_t size) override final;
+    result_t close() override final { return OK; }
+
+    result_t seek(size_t pos) override final;
+    result_t tell() override final;
+    result_t read(uint8_t *dst, size_t size) override final;
+    /**
+     * @brief borrow bytes from buffer
+     *
+     * Only supported while the data is in memory, NOT_IMPLEMENTED after spilling.
+     */
+    result_t peek(const uint8_t **ptr, size_t max) override final;
+    result_t consume(size_t size) override final;
+    bool isError() override final;
+    bool isEof() override final;
+    std::string getLastErrorStr(result_t code) const override final { return DataConsumer::getLastErrorStr(code); }
+
+    /**
+     * @brief get the total number of bytes written
+     */
+    uint64_t size() const;
+    /**
+     * @brief check whether the data has been moved to temporary file
+     */
+    bool isSpilled() const;
+    /**
+     * @brief discard all data and the temporary file
+     */
+    void clear();
+private:
+    struct Private;
+    Private *d;
+};
+
+/**
+ * @brief A source adapter that reads ahead in a background thread
+ *
+ * A helper thread fills a ring of buffers from the inner source while the caller processes earlier
+ * data, so that slow input overlaps with decryption and decompression. If the inner source is a
+ * FdSource or DirectFileSource, the kernel is also advised (posix_fadvise WILLNEED) to prefetch the
+ * following range. The inner source must not be used directly while the adapter exists.
+ */
+struct CDOC_EXPORT ReadAheadSource : public DataSource {
+    static constexpr unsigned int DEFAULT_NUM_BUFFERS = 4;
+
+    /**
+     * @brief create a new ReadAheadSource
+     * @param src the inner source
+     * @param take_ownership if true the inner source is deleted in destructor
+     * @param num_buffers the number of buffers in ring
+     * @param buffer_size the size of each buffer, BufferPool IO chunk size if 0
+     */
+    ReadAheadSource(DataSource *src, bool take_ownership = false, unsigned int num_buffers = DEFAULT_NUM_BUFFERS, size_t buffer_size = 0);
+    ~ReadAheadSource();
+
+    result_t seek(size_t pos) override;
+    result_t tell() override;
+    result_t read(uint8_t *dst, size_t size) override;
+    result_t peek(const uint8_t **ptr, size_t max) override;
+    result_t consume(size_t size) override;
+    bool isError() override;
+    bool isEof() override;
+private:
+    struct Private;
+    Private *d;
+};
+
+/**
+ * @brief A consumer adapter that writes behind in a background thread
+ *
+ * Incoming data is copied into a bounded ring of buffers and a helper thread drains the full buffers to
+ * the inner consumer, so that slow output overlaps with compression and encryption. Write blocks only
+ * if all buffers are waiting to be written. Errors of the inner consumer are deferred: they are returned
+ * by the next write or by close. The inner consumer must not be used directly while the adapter exists.
+ */
+struct CDOC_EXPORT WriteBehindConsumer : public DataConsumer {
+    static constexpr unsigned int DEFAULT_NUM_BUFFERS = 4;
+
+    /**
+     * @brief create a new WriteBehindConsumer
+     * @param dst the inner consumer
+     * @param take_ownership if true the inner consumer is deleted in destructor
+     * @param num_buffers the number of buffers in ring
+     * @param buffer_size the size of each buffer, BufferPool IO chunk size if 0
+     */
+    WriteBehindConsumer(DataConsumer *dst, bool take_ownership = false, unsigned int num_buffers = DEFAULT_NUM_BUFFERS, size_t buffer_size = 0);
+    ~WriteBehindConsumer();
+
+    result_t write(const uint8_t *src, size_t size) override;
+    /**
+     * @brief wait until all queued data is written to the inner consumer
+     *
+     * After successful return the inner consumer can be used directly until the next write.
+     * @return the first error of inner consumer or OK
+     */
+    result_t sync();
+    /**
+     * @brief queue an action to run in helper thread after the data written so far
+     *
+     * Allows changing the state of inner consumer in order with data without waiting for the queue to drain.
+     * An error returned by action is deferred like the errors of inner consumer.
+     * @param action the function to call
+     * @return the first error of inner consumer or OK
+     */
+    result_t post(std::function<result_t()> action);
+    /**
+     * @brief write all queued data and close the inner consumer if owned
+     * @return the first error of inner consumer or OK
+     */
+    result_t close() override;
+    bool isError() override;
+private:
+    struct Private;
+    Private *d;
+};
+
+/**
+ * @brief A source that caches the data of inner source in fixed-size pages
+ *
+ * Keeps up to num_pages most recently used pages of inner source in memory, so that repeated reads of
+ * the same region (e.g. format detection followed by a rewind, or the second parse of CDoc1 XML) do not
+ * reach the inner source again. The inner source is only seeked when a missing page does not follow the
+ * previously fetched one. Until the end of data is known, seek fetches the page before the new position
+ * to fail on positions past the end. Intended for sources where seek and read are expensive, such as remote storage.
+ */
+struct CDOC_EXPORT CachingSource : public DataSource {
+    static constexpr size_t DEFAULT_NUM_PAGES = 64;
+    static constexpr size_t DEFAULT_PAGE_SIZE = 64 * 1024;
+
+    /**
+     * @brief create a new CachingSource
+     * @param src the inner source
+     * @param take_ownership if true the inner source is deleted in destructor
+     * @param num_pages the maximum number of cached pages
+     * @param page_size the size of each page
+     */
+    CachingSource(DataSource *src, bool take_ownership = false, size_t num_pages = DEFAULT_NUM_PAGES, size_t page_size = DEFAULT_PAGE_SIZE);
+    ~CachingSource();
+
+    result_t seek(size_t pos) override;
+    result_t tell() override;
+    result_t read(uint8_t *dst, size_t size) override;
+    result_t peek(const uint8_t **ptr, size_t max) override;
+    result_t consume(size_t size) override;
+    bool isError() override;
+    bool isEof() override;
+
+    /**
+     * @brief set whether the inner source is deleted in destructor
+     * @param take_ownership if true the inner source is deleted in destructor
+     */
+    void setOwnership(bool take_ownership);
+    /**
+     * @brief get the number of page lookups served from cache
+     */
+    uint64_t getNumHits() const;
+    /**
+     * @brief get the number of pages fetched from inner source
+     */
+    uint64_t getNumMisses() const;
+private:
+    struct Private;
+    Private *d;
+};
+
+/**
+ * @brief A token bucket limiting the rate of I/O in bytes and operations per second
+ *
+ * The bucket holds up to BURST seconds worth of tokens, so short bursts after idle periods pass
+ * unthrottled. A request larger than the bucket is admitted and the debt is paid by sleeping, thus the
+ * average rate stays at the limit regardless of request size. The same limiter can be shared by several
+ * throttled sources and consumers (e.g. the input and output of one job), and by several threads. The
+ * limits can be changed at any time.
+ */
+class CDOC_EXPORT RateLimiter {
+public:
+    static constexpr double BURST = 0.1;
+
+    /**
+     * @brief create a new RateLimiter
+     * @param bytes_per_sec the limit of bytes per second, 0 for unlimited
+     * @param ops_per_sec the limit of read or write calls per second, 0 for unlimited
+     */
+    RateLimiter(double bytes_per_sec = 0, double ops_per_sec = 0);
+    ~RateLimiter();
+
+    /**
+     * @brief change the limits
+     * @param bytes_per_sec the limit of bytes per second, 0 for unlimited
+     * @param ops_per_sec the limit of read or write calls per second, 0 for unlimited
+     */
+    void setLimits(double bytes_per_sec, double ops_per_sec);
+    /**
+     * @brief take tokens for one operation, sleeping if the bucket is in debt
+     * @param size the number of bytes transferred
+     */
+    void acquire(size_t size);
+    /**
+     * @brief get the total time spent sleeping in acquire
+     * @return the time in seconds
+     */
+    double getThrottledTime() const;
+
+    RateLimiter(const RateLimiter&) = delete;
+    RateLimiter& operator=(const RateLimiter&) = delete;
+private:
+    struct Private;
+    Private *d;
+};
+
+/**
+ * @brief A source that limits the rate of reading from inner source
+ *
+ * Each read and consume is charged to the limiter with the number of bytes actually transferred.
+ */
+struct CDOC_EXPORT ThrottledSource : public ChainedSource {
+    /**
+     * @brief create a new ThrottledSource
+     * @param src the inner source
+     * @param take_ownership if true the inner source is deleted in destructor
+     * @param limiter the rate limiter, not owned
+     */
+    ThrottledSource(DataSource *src, bool take_ownership, RateLimiter *limiter) : ChainedSource(src, take_ownership), _limiter(limiter) {}
+
+    result_t seek(size_t pos) override { return _src->seek(pos); }
+    result_t tell() override { return _src->tell(); }
+    result_t read(uint8_t *dst, size_t size) override;
+    result_t peek(const uint8_t **ptr, size_t max) override { return _src->peek(ptr, max); }
+    result_t consume(size_t size) override;
+protected:
+    RateLimiter *_limiter;
+};
+
+/**
+ * @brief A consumer that limits the rate of writing to inner consumer
+ *
+ * Each write is charged to the limiter before it is passed on.
+ */
+struct CDOC_EXPORT ThrottledConsumer : public ChainedConsumer {
+    /**
+     * @brief create a new ThrottledConsumer
+     * @param dst the inner consumer
+     * @param take_ownership if true the inner consumer is deleted in destructor
+     * @param limiter the rate limiter, not owned
+     */
+    ThrottledConsumer(DataConsumer *dst, bool take_ownership, RateLimiter *limiter) : ChainedConsumer(dst, take_ownership), _limiter(limiter) {}
+
+    result_t write(const uint8_t *src, size_t size) override;
+    result_t reserve(uint64_t size) override { return _dst->reserve(size); }
+protected:
+    RateLimiter *_limiter;
+};
+
+/**
+ * @brief A multi-stream consumer that writes each sub-stream to a separate file
+ *
+ * Files are created in base directory, using only the last component of sub-stream name.
+ */
 struct CDOC_EXPORT FileListConsumer : public MultiDataConsumer {
-    FileListConsumer(const std::string& base_path) {
-		base = base_path;
-	}
-    result_t write(const uint8_t *src, size_t size) override final {
-		ofs.write((const char *) src, size);
-		return (ofs.bad()) ? OUTPUT_STREAM_ERROR : size;
-	}
-    result_t close() override final {
-		ofs.close();
-        return (ofs.bad()) ? OUTPUT_STREAM_ERROR : OK;
-	}
-	bool isError() override final {
-		return ofs.bad();
-	}
-    result_t open(const std::string& name, int64_t size) override final {
-        std::string fileName;
-        if (ofs.is_open()) {
-            ofs.close();
-        }
-        size_t lastSlashPos = name.find_last_of("\\/");
-        if (lastSlashPos != std::string::npos)
-        {
-            fileName = name.substr(lastSlashPos + 1);
-        }
-        else
-        {
-            fileName = name;
-        }
-        std::filesystem::path path(base);
-        path /= fileName;
-		ofs.open(path.string(), std::ios_base::binary);
-        return ofs.bad() ? OUTPUT_STREAM_ERROR : OK;
-	}
+    /**
+     * @brief create a new FileListConsumer
+     * @param base_path the directory for output files
+     * @param direct_io write files with direct I/O (bypassing page cache), if supported by the system
+     * @param bulk write files in bulk mode (see FdConsumer), ignored with direct I/O
+     */
+    FileListConsumer(const std::string& base_path, bool direct_io = false, bool bulk = false) : base(base_path), _direct_io(direct_io), _bulk(bulk) {}
+    result_t write(const uint8_t *src, size_t size) override final;
+    result_t close() override final;
+    bool isError() override final;
+    result_t open(const std::string& name, int64_t size) override final;
 
 protected:
 	std::filesystem::path base;
-	std::ofstream ofs;
+	bool _direct_io;
+	bool _bulk;
+	std::unique_ptr<DataConsumer> _file;
+};
+
+#ifndef _WIN32
+/**
+ * @brief A multi-stream consumer that creates each sub-stream file atomically
+ *
+ * Like FileListConsumer, but each file is written to an anonymous (O_TMPFILE) or hidden temporary file in
+ * base directory, preallocated to the size announced in open, and linked or renamed to its final name only
+ * after it is complete. Thus other processes never see partially written files and an existing file is
+ * replaced atomically. Completed files are published in groups: the data of each file is synced and the file
+ * renamed, followed by a single directory sync for the whole group. A file that fails to publish is discarded
+ * together with the rest of its group, the discarded files are listed by getFailed.
+ *
+ * The files that are still pending are published by finish or on destruction, and discarded by abort.
+ */
+struct CDOC_EXPORT AtomicFileListConsumer : public MultiDataConsumer {
+    static constexpr unsigned int DEFAULT_SYNC_GROUP = 64;
+
+    /**
+     * @brief create a new AtomicFileListConsumer
+     * @param base_path the directory for output files
+     * @param sync_group the number of files to sync and publish together, 0 publishes each file on close without syncing
+     */
+    AtomicFileListConsumer(const std::string& base_path, unsigned int sync_group = DEFAULT_SYNC_GROUP);
+    ~AtomicFileListConsumer();
+
+    result_t write(const uint8_t *src, size_t size) override final;
+    /**
+     * @brief complete the current file
+     *
+     * The file is truncated to the number of bytes written and added to the pending group. If the group
+     * is full, all pending files are synced and published.
+     * @return error code or OK
+     */
+    result_t close() override final;
+    bool isError() override final;
+    result_t open(const std::string& name, int64_t size) override final;
+
+    /**
+     * @brief complete the current file and sync and publish all pending files
+     * @return error code or OK
+     */
+    result_t finish();
+    /**
+     * @brief discard the current file and all files not yet published
+     */
+    void abort();
+    /**
+     * @brief get the number of completed files that are not yet published
+     */
+    size_t getNumPending() const;
+    /**
+     * @brief get the paths of completed files that were discarded instead of published
+     */
+    const std::vector<std::string>& getFailed() const;
+private:
+    struct Private;
+    Private *d;
 };
 
+/**
+ * @brief A multi-stream consumer that writes each sub-stream to an anonymous shared memory file
+ *
+ * Each sub-stream is written to a new memfd (memfd_create) that is sized to the length announced in
+ * open. When the sub-stream is complete, the descriptor is truncated to the number of bytes written,
+ * rewound and sealed against any further modification (F_SEAL_WRITE, F_SEAL_SHRINK, F_SEAL_GROW and
+ * F_SEAL_SEAL), so that it can be handed over to another process (e.g. via SCM_RIGHTS) without copying
+ * and the content never touches disk.
+ *
+ * The completed descriptors are owned by the consumer until released. Only supported on systems with
+ * sealable memfd (Linux, FreeBSD), elsewhere open returns NOT_IMPLEMENTED.
+ */
+struct CDOC_EXPORT MemfdConsumer : public MultiDataConsumer {
+    struct File {
+        /**
+         * @brief the sub-stream name
+         */
+        std::string name;
+        /**
+         * @brief the sealed memfd descriptor
+         */
+        int fd;
+        /**
+         * @brief the number of bytes written
+         */
+        uint64_t size;
+    };
+
+    MemfdConsumer();
+    ~MemfdConsumer();
+
+    result_t write(const uint8_t *src, size_t size) override final;
+    /**
+     * @brief complete and seal the current memfd
+     * @return error code or OK
+     */
+    result_t close() override final;
+    bool isError() override final;
+    result_t open(const std::string& name, int64_t size) override final;
+
+    /**
+     * @brief get the completed files
+     *
+     * The descriptors remain owned by the consumer and are closed on destruction.
+     * @return the list of completed files
+     */
+    const std::vector<File>& getFiles() const;
+    /**
+     * @brief release the completed files
+     *
+     * The caller takes ownership of descriptors and has to close them.
+     * @return the list of completed files
+     */
+    std::vector<File> release();
+private:
+    struct Private;
+    Private *d;
+};
+#endif
+
 struct CDOC_EXPORT FileListSource : public MultiDataSource {
-	FileListSource(const std::string& base, const std::vector<std::string>& files);
+    /**
+     * @brief create a new FileListSource
+     * @param base the directory of input files
+     * @param files the file names relative to base
+     * @param bulk read files in bulk mode (see FdSource)
+     */
+	FileListSource(const std::string& base, const std::vector<std::string>& files, bool bulk = false);
     result_t read(uint8_t *dst, size_t size) override final;
 	bool isError() override final;
 	bool isEof() override final;
@@ -386,7 +1364,40 @@ protected:
 	std::filesystem::path _base;
 	const std::vector<std::string>& _files;
 	int64_t _current;
-	std::ifstream _ifs;
+	bool _bulk;
+	std::unique_ptr<DataSource> _src;
+};
+
+/**
+ * @brief A multi-stream source that prefetches the following files in background
+ *
+ * Like FileListSource, but helper threads open and stat the next files and read their first bytes
+ * while the current file is being consumed, hiding per-file open latency on slow storage.
+ */
+struct CDOC_EXPORT PrefetchFileListSource : public MultiDataSource {
+    static constexpr unsigned int DEFAULT_PREFETCH = 4;
+    static constexpr size_t DEFAULT_HEAD_SIZE = 64 * 1024;
+
+    /**
+     * @brief create a new PrefetchFileListSource
+     * @param base the base directory of files
+     * @param files the file names relative to base directory
+     * @param prefetch the number of files to prefetch (also the number of helper threads, at least 1)
+     * @param head_size the number of bytes to read from each prefetched file
+     */
+    PrefetchFileListSource(const std::string& base, const std::vector<std::string>& files, unsigned int prefetch = DEFAULT_PREFETCH, size_t head_size = DEFAULT_HEAD_SIZE);
+    ~PrefetchFileListSource();
+
+    result_t read(uint8_t *dst, size_t size) override final;
+    result_t peek(const uint8_t **ptr, size_t max) override final;
+    result_t consume(size_t size) override final;
+    bool isError() override final;
+    bool isEof() override final;
+    result_t getNumComponents() override final;
+    result_t next(std::string& name, int64_t& size) override final;
+private:
+    struct Private;
+    Private *d;
 };
 
 } // namespace libcdoc
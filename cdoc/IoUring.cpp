@@ -0,0 +1,582 @@
+/*
+ * libcdoc
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _WIN32
+
+#include "IoUring.h"
+
+#include "ILogger.h"
+#include "Io.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+namespace libcdoc {
+
+IoUring::IoUring(unsigned int entries)
+{
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+    io_uring_params p {};
+    int fd = int(syscall(__NR_io_uring_setup, entries, &p));
+    if (fd < 0) {
+        LOG_DBG("io_uring is not available ({}), using synchronous I/O", errno);
+        return;
+    }
+    if (!(p.features & IORING_FEAT_RW_CUR_POS)) {
+        // Kernel older than 5.6, no IORING_OP_READ/WRITE
+        ::close(fd);
+        return;
+    }
+    _sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    _cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        _sq_size = _cq_size = std::max(_sq_size, _cq_size);
+    }
+    _sq_ptr = mmap(nullptr, _sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (_sq_ptr == MAP_FAILED) {
+        _sq_ptr = nullptr;
+        ::close(fd);
+        return;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        _cq_ptr = _sq_ptr;
+    } else {
+        _cq_ptr = mmap(nullptr, _cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (_cq_ptr == MAP_FAILED) {
+            _cq_ptr = nullptr;
+            munmap(_sq_ptr, _sq_size);
+            _sq_ptr = nullptr;
+            ::close(fd);
+            return;
+        }
+    }
+    _sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+    _sqes = mmap(nullptr, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (_sqes == MAP_FAILED) {
+        _sqes = nullptr;
+        if (_cq_ptr != _sq_ptr) munmap(_cq_ptr, _cq_size);
+        munmap(_sq_ptr, _sq_size);
+        _sq_ptr = _cq_ptr = nullptr;
+        ::close(fd);
+        return;
+    }
+    uint8_t *sq = (uint8_t *) _sq_ptr;
+    _sq_head = (unsigned *) (sq + p.sq_off.head);
+    _sq_tail = (unsigned *) (sq + p.sq_off.tail);
+    _sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+    _sq_array = (unsigned *) (sq + p.sq_off.array);
+    uint8_t *cq = (uint8_t *) _cq_ptr;
+    _cq_head = (unsigned *) (cq + p.cq_off.head);
+    _cq_tail = (unsigned *) (cq + p.cq_off.tail);
+    _cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+    _cqes = cq + p.cq_off.cqes;
+    _ring_fd = fd;
+#endif
+}
+
+IoUring::~IoUring()
+{
+#ifdef __linux__
+    if (_ring_fd < 0) return;
+    munmap(_sqes, _sqes_size);
+    if (_cq_ptr != _sq_ptr) munmap(_cq_ptr, _cq_size);
+    munmap(_sq_ptr, _sq_size);
+    ::close(_ring_fd);
+#endif
+}
+
+void
+IoUring::registerBuffers(std::vector<std::vector<uint8_t>>& buffers)
+{
+#if defined(__linux__) && defined(__NR_io_uring_register)
+    if (_ring_fd < 0) return;
+    std::vector<iovec> iov(buffers.size());
+    for (size_t i = 0; i < buffers.size(); i++) {
+        iov[i].iov_base = buffers[i].data();
+        iov[i].iov_len = buffers[i].size();
+    }
+    // Fails if buffers exceed RLIMIT_MEMLOCK, plain requests work the same way
+    _fixed = syscall(__NR_io_uring_register, _ring_fd, IORING_REGISTER_BUFFERS, iov.data(), unsigned(iov.size())) == 0;
+    if (!_fixed) LOG_DBG("Cannot register io_uring buffers ({})", errno);
+#endif
+}
+
+bool
+IoUring::read(int fd, uint8_t *buf, uint32_t len, uint64_t offset, int buf_index, uint64_t user_data)
+{
+#ifdef __linux__
+    if (_ring_fd >= 0) {
+        return submit((_fixed) ? IORING_OP_READ_FIXED : IORING_OP_READ, fd, buf, len, offset, buf_index, user_data);
+    }
+#endif
+    ssize_t result;
+    do {
+        result = pread(fd, buf, len, off_t(offset));
+    } while ((result < 0) && (errno == EINTR));
+    _done.emplace_back(user_data, (result < 0) ? -errno : int32_t(result));
+    return true;
+}
+
+bool
+IoUring::write(int fd, const uint8_t *buf, uint32_t len, uint64_t offset, int buf_index, uint64_t user_data)
+{
+#ifdef __linux__
+    if (_ring_fd >= 0) {
+        return submit((_fixed) ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE, fd, buf, len, offset, buf_index, user_data);
+    }
+#endif
+    ssize_t result;
+    do {
+        result = pwrite(fd, buf, len, off_t(offset));
+    } while ((result < 0) && (errno == EINTR));
+    _done.emplace_back(user_data, (result < 0) ? -errno : int32_t(result));
+    return true;
+}
+
+bool
+IoUring::submit(uint8_t opcode, int fd, const void *buf, uint32_t len, uint64_t offset, int buf_index, uint64_t user_data)
+{
+#if defined(__linux__) && defined(__NR_io_uring_enter)
+    // Single producer, the kernel only reads the tail
+    unsigned tail = *_sq_tail;
+    unsigned idx = tail & *_sq_mask;
+    io_uring_sqe *sqe = (io_uring_sqe *) _sqes + idx;
+    std::memset(sqe, 0, sizeof(io_uring_sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) buf;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->user_data = user_data;
+    if ((opcode == IORING_OP_READ_FIXED) || (opcode == IORING_OP_WRITE_FIXED)) sqe->buf_index = uint16_t(buf_index);
+    _sq_array[idx] = idx;
+    __atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+    while (syscall(__NR_io_uring_enter, _ring_fd, 1, 0, 0, nullptr, 0) < 0) {
+        if (errno == EINTR) continue;
+        LOG_ERROR("io_uring_enter failed: {}", errno);
+        // Take the entry back if the kernel has not consumed it, otherwise it completes as usual
+        if (__atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) != tail) return true;
+        __atomic_store_n(_sq_tail, tail, __ATOMIC_RELEASE);
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool
+IoUring::wait(uint64_t& user_data, int32_t& res)
+{
+    if (!_done.empty()) {
+        user_data = _done.front().first;
+        res = _done.front().second;
+        _done.pop_front();
+        return true;
+    }
+#if defined(__linux__) && defined(__NR_io_uring_enter)
+    if (_ring_fd < 0) return false;
+    while (true) {
+        unsigned head = *_cq_head;
+        if (head != __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE)) {
+            io_uring_cqe *cqe = (io_uring_cqe *) _cqes + (head & *_cq_mask);
+            user_data = cqe->user_data;
+            res = cqe->res;
+            __atomic_store_n(_cq_head, head + 1, __ATOMIC_RELEASE);
+            return true;
+        }
+        if ((syscall(__NR_io_uring_enter, _ring_fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0) && (errno != EINTR)) {
+            LOG_ERROR("io_uring_enter failed: {}", errno);
+            return false;
+        }
+    }
+#else
+    return false;
+#endif
+}
+
+struct UringFileSource::Private {
+    struct Slot {
+        uint64_t offset = 0;
+        size_t len = 0;
+        bool pending = false;
+    };
+
+    Private(unsigned int depth, size_t block_size)
+        : ring(depth), buffers(depth, std::vector<uint8_t>(block_size)), slots(depth) {
+        ring.registerBuffers(buffers);
+    }
+    ~Private() {
+        // The kernel may still be writing into buffers
+        drain();
+        if (fd >= 0) ::close(fd);
+        // Requests that were never completed may still land in buffers, keep them allocated
+        if (broken) new std::vector<std::vector<uint8_t>>(std::move(buffers));
+    }
+
+    void queue(unsigned int idx) {
+        if (broken) return;
+        Slot& slot = slots[idx];
+        slot.offset = next_offset;
+        slot.len = size_t(std::min<uint64_t>(buffers[idx].size(), file_size - std::min(next_offset, file_size)));
+        if (!slot.len) return;
+        next_offset += slot.len;
+        slot.pending = true;
+        if (!ring.read(fd, buffers[idx].data(), uint32_t(slot.len), slot.offset, int(idx), idx)) {
+            slot.pending = false;
+            error = INPUT_STREAM_ERROR;
+        }
+    }
+
+    void complete(uint64_t idx, int32_t res) {
+        Slot& slot = slots[idx];
+        slot.pending = false;
+        if (res < 0) {
+            LOG_ERROR("Read error: {}", strerror(-res));
+            error = INPUT_STREAM_ERROR;
+            return;
+        }
+        // Short read, finish synchronously
+        size_t n_read = size_t(res);
+        while (n_read < slot.len) {
+            ssize_t result = pread(fd, buffers[idx].data() + n_read, slot.len - n_read, off_t(slot.offset + n_read));
+            if ((result < 0) && (errno == EINTR)) continue;
+            if (result < 0) {
+                error = INPUT_STREAM_ERROR;
+                return;
+            }
+            if (result == 0) {
+                // File was truncated while reading
+                slot.len = n_read;
+                file_size = slot.offset + n_read;
+                break;
+            }
+            n_read += result;
+        }
+    }
+
+    bool waitFor(unsigned int idx) {
+        while (slots[idx].pending) {
+            uint64_t user_data;
+            int32_t res;
+            if (!ring.wait(user_data, res)) {
+                broken = true;
+                error = INPUT_STREAM_ERROR;
+                return false;
+            }
+            complete(user_data, res);
+        }
+        return error == OK;
+    }
+
+    bool drain() {
+        for (unsigned int i = 0; i < slots.size(); i++) {
+            while (slots[i].pending) {
+                uint64_t user_data;
+                int32_t res;
+                if (!ring.wait(user_data, res)) {
+                    broken = true;
+                    error = INPUT_STREAM_ERROR;
+                    return false;
+                }
+                slots[user_data].pending = false;
+            }
+        }
+        return true;
+    }
+
+    void start(uint64_t pos) {
+        if (!drain()) return;
+        next_offset = pos;
+        head = 0;
+        head_pos = 0;
+        for (unsigned int i = 0; i < slots.size(); i++) queue(i);
+    }
+
+    // Release the fully consumed head block and queue it for the next offset
+    void advance() {
+        queue(head);
+        head = (head + 1) % slots.size();
+        head_pos = 0;
+    }
+
+    IoUring ring;
+    std::vector<std::vector<uint8_t>> buffers;
+    std::vector<Slot> slots;
+    int fd = -1;
+    uint64_t file_size = 0;
+    uint64_t next_offset = 0;
+    uint64_t pos = 0;
+    unsigned int head = 0;
+    size_t head_pos = 0;
+    result_t error = OK;
+    // Waiting for completions failed, the state of pending requests is unknown
+    bool broken = false;
+};
+
+UringFileSource::UringFileSource(const std::string& path, unsigned int queue_depth, size_t block_size)
+    : d(new Private(std::max(queue_depth, 1U), std::max<size_t>(block_size, 4096)))
+{
+    d->fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if ((d->fd < 0) || (fstat(d->fd, &st) != 0) || !S_ISREG(st.st_mode)) {
+        d->error = INPUT_STREAM_ERROR;
+        return;
+    }
+    d->file_size = uint64_t(st.st_size);
+    d->start(0);
+}
+
+UringFileSource::~UringFileSource()
+{
+    delete d;
+}
+
+bool
+UringFileSource::isAsync() const
+{
+    return d->ring.isAsync();
+}
+
+result_t
+UringFileSource::seek(size_t pos)
+{
+    if (d->error != OK) return d->error;
+    if (pos > d->file_size) return INPUT_STREAM_ERROR;
+    d->start(pos);
+    d->pos = pos;
+    return d->error;
+}
+
+result_t
+UringFileSource::tell()
+{
+    if (d->error != OK) return d->error;
+    return d->pos;
+}
+
+result_t
+UringFileSource::read(uint8_t *dst, size_t size)
+{
+    if (d->error != OK) return d->error;
+    size_t n_copied = 0;
+    while ((n_copied < size) && (d->pos < d->file_size)) {
+        if (!d->waitFor(d->head)) return d->error;
+        const Private::Slot& slot = d->slots[d->head];
+        size_t n = std::min(size - n_copied, slot.len - d->head_pos);
+        std::copy_n(d->buffers[d->head].data() + d->head_pos, n, dst + n_copied);
+        n_copied += n;
+        d->head_pos += n;
+        d->pos += n;
+        if (d->head_pos >= slot.len) d->advance();
+    }
+    return (d->error != OK) ? d->error : n_copied;
+}
+
+result_t
+UringFileSource::peek(const uint8_t **ptr, size_t max)
+{
+    if (d->error != OK) return d->error;
+    if (d->pos >= d->file_size) return 0;
+    if (!d->waitFor(d->head)) return d->error;
+    *ptr = d->buffers[d->head].data() + d->head_pos;
+    return std::min(max, d->slots[d->head].len - d->head_pos);
+}
+
+result_t
+UringFileSource::consume(size_t size)
+{
+    if (d->error != OK) return d->error;
+    if (d->pos >= d->file_size) return (size) ? WRONG_ARGUMENTS : OK;
+    const Private::Slot& slot = d->slots[d->head];
+    if (d->slots[d->head].pending || (size > slot.len - d->head_pos)) return WRONG_ARGUMENTS;
+    d->head_pos += size;
+    d->pos += size;
+    if (d->head_pos >= slot.len) d->advance();
+    return d->error;
+}
+
+bool
+UringFileSource::isError()
+{
+    return d->error != OK;
+}
+
+bool
+UringFileSource::isEof()
+{
+    return d->pos >= d->file_size;
+}
+
+struct UringFileConsumer::Private {
+    struct Slot {
+        uint64_t offset = 0;
+        size_t len = 0;
+        bool pending = false;
+    };
+
+    Private(unsigned int depth, size_t block_size)
+        : ring(depth), buffers(depth, std::vector<uint8_t>(block_size)), slots(depth) {
+        ring.registerBuffers(buffers);
+    }
+    ~Private() {
+        // The kernel may still be reading from buffers
+        waitAll();
+        if (fd >= 0) ::close(fd);
+        // Requests that were never completed may still read buffers, keep them allocated
+        if (broken) new std::vector<std::vector<uint8_t>>(std::move(buffers));
+    }
+
+    void complete(uint64_t idx, int32_t res) {
+        Slot& slot = slots[idx];
+        slot.pending = false;
+        if (res < 0) {
+            LOG_ERROR("Write error: {}", strerror(-res));
+            error = OUTPUT_STREAM_ERROR;
+            return;
+        }
+        // Short write, finish synchronously
+        size_t n_written = size_t(res);
+        while (n_written < slot.len) {
+            ssize_t result = pwrite(fd, buffers[idx].data() + n_written, slot.len - n_written, off_t(slot.offset + n_written));
+            if ((result < 0) && (errno == EINTR)) continue;
+            if (result <= 0) {
+                error = OUTPUT_STREAM_ERROR;
+                return;
+            }
+            n_written += result;
+        }
+        slot.len = 0;
+    }
+
+    bool waitFor(unsigned int idx) {
+        while (slots[idx].pending) {
+            uint64_t user_data;
+            int32_t res;
+            if (!ring.wait(user_data, res)) {
+                broken = true;
+                error = OUTPUT_STREAM_ERROR;
+                return false;
+            }
+            complete(user_data, res);
+        }
+        return error == OK;
+    }
+
+    bool waitAll() {
+        for (unsigned int i = 0; i < slots.size(); i++) {
+            if (!waitFor(i)) return false;
+        }
+        return true;
+    }
+
+    void flush() {
+        Slot& slot = slots[cur];
+        if (broken || slot.pending || !slot.len) return;
+        slot.offset = offset;
+        offset += slot.len;
+        slot.pending = true;
+        if (!ring.write(fd, buffers[cur].data(), uint32_t(slot.len), slot.offset, int(cur), cur)) {
+            slot.pending = false;
+            error = OUTPUT_STREAM_ERROR;
+        }
+        cur = (cur + 1) % slots.size();
+    }
+
+    IoUring ring;
+    std::vector<std::vector<uint8_t>> buffers;
+    std::vector<Slot> slots;
+    int fd = -1;
+    uint64_t offset = 0;
+    unsigned int cur = 0;
+    result_t error = OK;
+    // Waiting for completions failed, the state of pending requests is unknown
+    bool broken = false;
+};
+
+UringFileConsumer::UringFileConsumer(const std::string& path, unsigned int queue_depth, size_t block_size)
+    : d(new Private(std::max(queue_depth, 1U), std::max<size_t>(block_size, 4096)))
+{
+    d->fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (d->fd < 0) d->error = OUTPUT_STREAM_ERROR;
+}
+
+UringFileConsumer::~UringFileConsumer()
+{
+    if (d->fd >= 0) close();
+    delete d;
+}
+
+bool
+UringFileConsumer::isAsync() const
+{
+    return d->ring.isAsync();
+}
+
+result_t
+UringFileConsumer::write(const uint8_t *src, size_t size)
+{
+    if (d->error != OK) return d->error;
+    size_t n_copied = 0;
+    while (n_copied < size) {
+        // Reuse the buffer only after its previous write has completed
+        if (!d->waitFor(d->cur)) return d->error;
+        Private::Slot& slot = d->slots[d->cur];
+        std::vector<uint8_t>& buf = d->buffers[d->cur];
+        size_t n = std::min(size - n_copied, buf.size() - slot.len);
+        std::copy_n(src + n_copied, n, buf.data() + slot.len);
+        slot.len += n;
+        n_copied += n;
+        if (slot.len == buf.size()) d->flush();
+        if (d->error != OK) return d->error;
+    }
+    return size;
+}
+
+result_t
+UringFileConsumer::close()
+{
+    if (d->fd < 0) return d->error;
+    if (d->error == OK) d->flush();
+    d->waitAll();
+    if ((::close(d->fd) != 0) && (d->error == OK)) d->error = OUTPUT_STREAM_ERROR;
+    d->fd = -1;
+    return d->error;
+}
+
+bool
+UringFileConsumer::isError()
+{
+    return d->error != OK;
+}
+
+} // namespace libcdoc
+
+#endif
@@ -0,0 +1,88 @@
+/*
+ * libcdoc
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <utility>
+#include <vector>
+
+namespace libcdoc {
+
+/**
+ * @brief A minimal io_uring submission/completion queue for positioned file I/O
+ *
+ * Requests are identified by user data that is returned with the completion. If io_uring is not
+ * available (non-Linux system, old kernel or blocked by seccomp) every request is executed
+ * synchronously with pread/pwrite at submission time and its completion is queued locally, so
+ * the caller can use the same submit/wait logic in both cases.
+ */
+class IoUring {
+public:
+    explicit IoUring(unsigned int entries);
+    ~IoUring();
+
+    bool isAsync() const { return _ring_fd >= 0; }
+
+    /**
+     * @brief register buffers for fixed-buffer requests
+     *
+     * Registration failure is not an error, requests simply use unregistered buffers.
+     */
+    void registerBuffers(std::vector<std::vector<uint8_t>>& buffers);
+
+    bool read(int fd, uint8_t *buf, uint32_t len, uint64_t offset, int buf_index, uint64_t user_data);
+    bool write(int fd, const uint8_t *buf, uint32_t len, uint64_t offset, int buf_index, uint64_t user_data);
+    /**
+     * @brief wait for the next completed request
+     * @param user_data the user data of completed request
+     * @param res the number of bytes transferred or negated errno
+     * @return false if there was a system error while waiting
+     */
+    bool wait(uint64_t& user_data, int32_t& res);
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+private:
+    bool submit(uint8_t opcode, int fd, const void *buf, uint32_t len, uint64_t offset, int buf_index, uint64_t user_data);
+
+    int _ring_fd = -1;
+    bool _fixed = false;
+
+    void *_sq_ptr = nullptr;
+    size_t _sq_size = 0;
+    void *_cq_ptr = nullptr;
+    size_t _cq_size = 0;
+    void *_sqes = nullptr;
+    size_t _sqes_size = 0;
+
+    unsigned *_sq_head = nullptr;
+    unsigned *_sq_tail = nullptr;
+    unsigned *_sq_mask = nullptr;
+    unsigned *_sq_array = nullptr;
+    unsigned *_cq_head = nullptr;
+    unsigned *_cq_tail = nullptr;
+    unsigned *_cq_mask = nullptr;
+    void *_cqes = nullptr;
+
+    std::deque<std::pair<uint64_t,int32_t>> _done;
+};
+
+} // namespace libcdoc
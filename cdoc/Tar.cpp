@@ -17,6 +17,7 @@
  */
 
 #include "Tar.h"
+#include "BufferPool.h"
 
 #include <array>
 #include <sstream>
@@ -121,6 +122,7 @@ libcdoc::TAR::files(libcdoc::DataSource *src, bool &warning, libcdoc::MultiDataC
 	int64_t size;
     while (tar.next(name, size) == OK) {
 		dst->open(name, size);
+		if (size > 0) dst->reserve(size);
 		dst->writeAll(tar);
 	}
 	warning = !src->isEof();
@@ -152,6 +154,7 @@ libcdoc::TAR::save(libcdoc::DataConsumer& dst, libcdoc::MultiDataSource& src)
 {
 	std::string name;
 	int64_t size;
+	libcdoc::BufferPool::Buffer buf = libcdoc::BufferPool::get(libcdoc::BufferPool::IO);
 	while (src.next(name, size)) {
 		Header h {};
 		std::string filename(name);
@@ -178,10 +181,9 @@ libcdoc::TAR::save(libcdoc::DataConsumer& dst, libcdoc::MultiDataSource& src)
 			return false;
 		size_t total_written = 0;
 		while (!src.isEof()) {
-			uint8_t buf[256];
-			auto n_read = src.read(buf, 256);
+			auto n_read = src.read(buf.data(), buf.size());
 			if (n_read < 0) return false;
-			dst.write(buf, n_read);
+			dst.write(buf.data(), n_read);
 			total_written += n_read;
 		}
 		writePadding(&dst, total_written);
@@ -214,16 +216,21 @@ libcdoc::TarConsumer::write(const uint8_t *src, size_t size)
 libcdoc::result_t
 libcdoc::TarConsumer::close()
 {
-	if (_current_size) {
-		writePadding(_dst, _current_size);
+	result_t result = OK;
+	if (_current_size && !writePadding(_dst, _current_size)) {
+		result = OUTPUT_ERROR;
 	}
 	Header empty = {};
-	_dst->write((const uint8_t *)&empty, sizeof(Header));
-	_dst->write((const uint8_t *)&empty, sizeof(Header));
+	if ((_dst->write((const uint8_t *)&empty, sizeof(Header)) != sizeof(Header)) ||
+		(_dst->write((const uint8_t *)&empty, sizeof(Header)) != sizeof(Header))) {
+		result = OUTPUT_ERROR;
+	}
 	if (_owned) {
-		_dst->close();
+		// Deferred errors of threaded consumers are only known after close
+		result_t close_result = _dst->close();
+		if (close_result < 0) result = close_result;
 	}
-    return OK;
+	return result;
 }
 
 bool
@@ -295,6 +302,29 @@ libcdoc::TarSource::read(uint8_t *dst, size_t size)
 	return n_read;
 }
 
+libcdoc::result_t
+libcdoc::TarSource::peek(const uint8_t **ptr, size_t max)
+{
+    if (_error != OK) return _error;
+	if (_pos >= _data_size) {
+		_eof = true;
+		return 0;
+	}
+	int64_t n_avail = _src->peek(ptr, std::min(_data_size - _pos, max));
+	if (n_avail == 0) _eof = true;
+	return n_avail;
+}
+
+libcdoc::result_t
+libcdoc::TarSource::consume(size_t size)
+{
+    if (_error != OK) return _error;
+	if (size > _data_size - _pos) return WRONG_ARGUMENTS;
+	int64_t result = _src->consume(size);
+	if (result == OK) _pos += size;
+	return result;
+}
+
 bool
 libcdoc::TarSource::isError()
 {
@@ -347,7 +377,7 @@ libcdoc::TarSource::next(std::string& name, int64_t& size)
 		if(h.typeflag == 'x') {
 			std::vector<char> pax_in(h_size);
 			result = _src->read((uint8_t *) pax_in.data(), pax_in.size());
-			if (result != h_size) {
+			if (result != result_t(h_size)) {
 				_error = INPUT_STREAM_ERROR;
 				return _error;
 			}
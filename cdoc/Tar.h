@@ -54,6 +54,8 @@ public:
 	TarSource(DataSource *src, bool take_ownership);
 	~TarSource();
     libcdoc::result_t read(uint8_t *dst, size_t size) override final;
+    libcdoc::result_t peek(const uint8_t **ptr, size_t max) override final;
+    libcdoc::result_t consume(size_t size) override final;
 	bool isError() override final;
 	bool isEof() override final;
     libcdoc::result_t getNumComponents() override final { return NOT_IMPLEMENTED; };
@@ -77,7 +77,16 @@ struct ToolConf : public JSONConfiguration {
      */
     std::vector<std::vector<uint8_t>> accept_certs;
 
+    /**
+     * @brief Use bulk I/O for container files unless set otherwise in configuration file
+     */
+    bool bulk_io = false;
+
     std::string getValue(std::string_view domain, std::string_view param) const final {
+        if (bulk_io && domain.empty() && (param == Configuration::BULK_IO)) {
+            std::string value = JSONConfiguration::getValue(domain, param);
+            return value.empty() ? "true" : value;
+        }
         for (auto& sdata : servers) {
             if (sdata.ID == domain) {
                 if (param == Configuration::KEYSERVER_SEND_URL) {
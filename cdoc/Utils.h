@@ -201,50 +201,99 @@ static void writeFile(const std::string &path, const std::vector<unsigned char>
 
 } // vectorwrapbuf
 
-// A source implementation that always keeps last 16 bytes in tag
+// A source implementation that always keeps last tag_size bytes in tag
+// The bytes read from source but not returned yet are held in tag, at the end of stream these are the
+// trailing tag. Peek lends the buffer of source directly if it has more than tag_size bytes available.
 
 struct TaggedSource : public libcdoc::DataSource {
 	std::vector<uint8_t> tag;
 	libcdoc::DataSource *_src;
 	bool _owned;
+	size_t _tag_size;
+	// Whether the last peek lent the buffer of source or tag
+	bool _lent_src = false;
 
-	TaggedSource(libcdoc::DataSource *src, bool take_ownership, size_t tag_size) : tag(tag_size), _src(src), _owned(take_ownership) {
-		tag.resize(tag.size());
-		_src->read(tag.data(), tag.size());
+	TaggedSource(libcdoc::DataSource *src, bool take_ownership, size_t tag_size) : _src(src), _owned(take_ownership), _tag_size(tag_size) {
+		tag.reserve(2 * tag_size);
 	}
 	~TaggedSource() {
 		if (_owned) delete(_src);
 	}
 
     libcdoc::result_t seek(size_t pos) override final {
-        if (!_src->seek(pos)) return libcdoc::INPUT_STREAM_ERROR;
-        if (_src->read(tag.data(), tag.size()) != tag.size()) return libcdoc::INPUT_STREAM_ERROR;
+        if (_src->seek(pos) != libcdoc::OK) return libcdoc::INPUT_STREAM_ERROR;
+        tag.clear();
         return libcdoc::OK;
 	}
 
     libcdoc::result_t read(uint8_t *dst, size_t size) override final {
-		std::vector<uint8_t> t(tag.size());
-		uint8_t *tmp = t.data();
-		size_t nread = _src->read(dst, size);
-		if (nread >= tag.size()) {
-			std::copy(dst + nread - tag.size(), dst + nread, tmp);
-			std::copy_backward(dst, dst + nread - tag.size(), dst + nread);
-			std::copy(tag.cbegin(), tag.cend(), dst);
-			std::copy(tmp, tmp + tag.size(), tag.begin());
-		} else {
-			std::copy(dst, dst + nread, tmp);
-			std::copy(tag.cbegin(), tag.cbegin() + nread, dst);
-			std::copy(tag.cbegin() + nread, tag.cend(), tag.begin());
-			std::copy(tmp, tmp + nread, tag.end() - nread);
+		size_t n_done = 0;
+		// Bytes staged by peek come first
+		if (tag.size() > _tag_size) {
+			n_done = std::min(tag.size() - _tag_size, size);
+			std::copy(tag.cbegin(), tag.cbegin() + n_done, dst);
+			tag.erase(tag.begin(), tag.begin() + n_done);
 		}
-		return nread;
+		std::vector<uint8_t> last(_tag_size);
+		while (n_done < size) {
+			size_t to_read = size - n_done;
+			libcdoc::result_t n_read = _src->read(dst + n_done, to_read);
+			if (n_read < 0) return n_read;
+			if ((tag.size() + size_t(n_read)) <= _tag_size) {
+				tag.insert(tag.end(), dst + n_done, dst + n_done + n_read);
+			} else {
+				// Return held bytes followed by the read ones, except the last tag_size
+				size_t n_out = tag.size() + size_t(n_read) - _tag_size;
+				if (size_t(n_read) >= _tag_size) {
+					std::copy(dst + n_done + n_read - _tag_size, dst + n_done + n_read, last.begin());
+					std::copy_backward(dst + n_done, dst + n_done + n_out - tag.size(), dst + n_done + n_out);
+					std::copy(tag.cbegin(), tag.cend(), dst + n_done);
+				} else {
+					auto it = std::copy(tag.cend() - (_tag_size - n_read), tag.cend(), last.begin());
+					std::copy(dst + n_done, dst + n_done + n_read, it);
+					std::copy(tag.cbegin(), tag.cbegin() + n_out, dst + n_done);
+				}
+				tag.assign(last.cbegin(), last.cend());
+				n_done += n_out;
+			}
+			if (size_t(n_read) < to_read) break;
+		}
+		return n_done;
+	}
+
+    libcdoc::result_t peek(const uint8_t **ptr, size_t max) override final {
+		while (true) {
+			if (tag.size() > _tag_size) {
+				_lent_src = false;
+				*ptr = tag.data();
+				return std::min(tag.size() - _tag_size, max);
+			}
+			const uint8_t *p;
+			libcdoc::result_t n_avail = _src->peek(&p, std::min(max, SIZE_MAX - _tag_size) + _tag_size);
+			if (n_avail <= 0) return n_avail;
+			if (size_t(n_avail) > _tag_size) {
+				// At least tag_size bytes follow the held ones and the lent part of source buffer
+				_lent_src = tag.empty();
+				*ptr = _lent_src ? p : tag.data();
+				return std::min(_lent_src ? (size_t(n_avail) - _tag_size) : tag.size(), max);
+			}
+			// Too few bytes to tell apart from tag, hold them
+			tag.insert(tag.end(), p, p + n_avail);
+			if (auto result = _src->consume(size_t(n_avail)); result != libcdoc::OK) return result;
+		}
+	}
+    libcdoc::result_t consume(size_t size) override final {
+		if (_lent_src) return _src->consume(size);
+		if (size > tag.size()) return libcdoc::WORKFLOW_ERROR;
+		tag.erase(tag.begin(), tag.begin() + size);
+		return libcdoc::OK;
 	}
 
 	virtual bool isError() override final {
 		return _src->isError();
 	}
 	virtual bool isEof() override final {
-		return _src->isEof();
+		return (tag.size() <= _tag_size) && _src->isEof();
 	}
 };
 
@@ -115,6 +115,12 @@ std::vector<uint8_t> XMLReader::readBase64()
 	return libcdoc::Crypto::decodeBase64(xmlTextReaderConstValue(d->reader));
 }
 
+int64_t XMLReader::readBase64(DataConsumer &dst)
+{
+	xmlTextReaderRead(d->reader);
+	return libcdoc::Crypto::decodeBase64(xmlTextReaderConstValue(d->reader), dst);
+}
+
 std::string XMLReader::readText()
 {
 	xmlTextReaderRead(d->reader);
@@ -25,6 +25,7 @@
 
 namespace libcdoc {
 
+struct DataConsumer;
 struct DataSource;
 
 class XMLReader
@@ -41,6 +42,7 @@ public:
 	bool isEndElement() const;
 	bool read();
 	std::vector<uint8_t> readBase64();
+	int64_t readBase64(DataConsumer &dst);
 	std::string readText();
 
 private:
@@ -139,6 +139,33 @@ int64_t XMLWriter::writeBase64Element(const NS &ns, const std::string &name, con
     return writeEndElement(ns);
 }
 
+int64_t XMLWriter::writeBase64Element(const NS &ns, const std::string &name, DataSource &src, const std::map<std::string, std::string> &attr)
+{
+    // Chunks are a multiple of both 3 bytes and base64 line (54 bytes), joined with the line break libxml2 uses,
+    // so the output is identical to encoding all data at once
+    static constexpr size_t CHUNK = 54 * 1024;
+    if(auto rv = writeStartElement(ns, name, attr); rv != OK)
+        return rv;
+    std::vector<char> buf(CHUNK);
+    bool first = true;
+    while(!src.isEof())
+    {
+        int64_t n_read = src.read((uint8_t *) buf.data(), buf.size());
+        if(n_read < 0)
+            return n_read;
+        if(n_read == 0)
+            break;
+        if(!first && xmlTextWriterWriteRaw(d->w, pcxmlChar("\r\n")) == -1)
+            return IO_ERROR;
+        if(xmlTextWriterWriteBase64(d->w, buf.data(), 0, int(n_read)) == -1)
+            return IO_ERROR;
+        first = false;
+        if(size_t(n_read) < buf.size() && !src.isEof())
+            return INPUT_STREAM_ERROR;
+    }
+    return writeEndElement(ns);
+}
+
 int64_t XMLWriter::writeTextElement(const NS &ns, const std::string &name, const std::map<std::string, std::string> &attr, const std::string &data)
 {
     if(auto rv = writeStartElement(ns, name, attr); rv != OK)
@@ -28,6 +28,7 @@
 namespace libcdoc {
 
 struct DataConsumer;
+struct DataSource;
 
 class XMLWriter
 {
@@ -44,6 +45,7 @@ public:
     int64_t writeElement(const NS &ns, const std::string &name, const std::function<void()> &f = nullptr);
     int64_t writeElement(const NS &ns, const std::string &name, const std::map<std::string, std::string> &attr, const std::function<void()> &f = nullptr);
     int64_t writeBase64Element(const NS &ns, const std::string &name, const std::vector<unsigned char> &data, const std::map<std::string, std::string> &attr = {});
+    int64_t writeBase64Element(const NS &ns, const std::string &name, DataSource &src, const std::map<std::string, std::string> &attr = {});
     int64_t writeTextElement(const NS &ns, const std::string &name, const std::map<std::string, std::string> &attr, const std::string &data);
 
 private:
@@ -0,0 +1,350 @@
+/*
+ * libcdoc
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ZStream.h"
+
+#include "Configuration.h"
+#include "ILogger.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace libcdoc {
+
+ConfigCompressionPolicy::ConfigCompressionPolicy(const Configuration *conf)
+{
+    std::string extensions;
+    if (conf) {
+        _params.level = std::clamp(conf->getInt(Configuration::ZLIB_LEVEL, Z_DEFAULT_COMPRESSION), Z_DEFAULT_COMPRESSION, Z_BEST_COMPRESSION);
+        std::string strategy = conf->getValue(Configuration::ZLIB_STRATEGY);
+        if (strategy == "FILTERED") _params.strategy = Z_FILTERED;
+        else if (strategy == "HUFFMAN_ONLY") _params.strategy = Z_HUFFMAN_ONLY;
+        else if (strategy == "RLE") _params.strategy = Z_RLE;
+        else if (strategy == "FIXED") _params.strategy = Z_FIXED;
+        else if (!strategy.empty() && (strategy != "DEFAULT")) LOG_WARN("Unknown compression strategy {}", strategy);
+        _adaptive = conf->getBoolean(Configuration::ZLIB_ADAPTIVE, true);
+        extensions = conf->getValue(Configuration::ZLIB_STORED_EXTENSIONS);
+    }
+    if (extensions.empty()) extensions = DEFAULT_STORED_EXTENSIONS;
+    for (size_t pos = 0; pos < extensions.size();) {
+        size_t end = std::min(extensions.find(',', pos), extensions.size());
+        std::string ext = extensions.substr(pos, end - pos);
+        ext.erase(std::remove_if(ext.begin(), ext.end(), [](unsigned char c) { return std::isspace(c) || (c == '.'); }), ext.end());
+        std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+        if (!ext.empty()) _stored.insert(ext);
+        pos = end + 1;
+    }
+}
+
+CompressionPolicy::Params
+ConfigCompressionPolicy::choose(const std::string& name, int64_t size, const uint8_t *data, size_t len)
+{
+    if (!_adaptive || (_params.level == 0)) return _params;
+    size_t dot = name.find_last_of("./\\");
+    if ((dot != std::string::npos) && (name[dot] == '.')) {
+        std::string ext = name.substr(dot + 1);
+        std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+        if (_stored.contains(ext)) {
+            LOG_DBG("Storing {} by extension", name);
+            return {0, Z_DEFAULT_STRATEGY};
+        }
+    }
+    if ((len >= MIN_PROBE_SIZE) && (entropy(data, len) > ENTROPY_THRESHOLD)) {
+        LOG_DBG("Storing {} by entropy", name);
+        return {0, Z_DEFAULT_STRATEGY};
+    }
+    return _params;
+}
+
+double
+ConfigCompressionPolicy::entropy(const uint8_t *data, size_t len)
+{
+    if (!len) return 0;
+    size_t count[256] = {};
+    for (size_t i = 0; i < len; i++) count[data[i]]++;
+    double h = 0;
+    for (size_t c : count) {
+        if (!c) continue;
+        double p = double(c) / len;
+        h -= p * std::log2(p);
+    }
+    return h;
+}
+
+struct ParallelZConsumer::Private {
+    struct Block {
+        BufferPool::Buffer in;
+        size_t len = 0;
+        // The end of previous block, empty for the first one
+        std::vector<uint8_t> dict;
+        bool last = false;
+        int level;
+        int strategy;
+        std::vector<uint8_t> out;
+        uLong adler = 0;
+        bool done = false;
+        bool fail = false;
+    };
+
+    int level;
+    int strategy = Z_DEFAULT_STRATEGY;
+    // Compression level flags of zlib header, from initial level
+    uint8_t flevel;
+    size_t block_size;
+    unsigned int num_threads;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<std::thread> threads;
+    // Submitted blocks in stream order
+    std::deque<std::unique_ptr<Block>> blocks;
+    // Blocks waiting for a thread
+    std::deque<Block *> todo;
+    bool stop = false;
+
+    // Block being filled by caller
+    std::unique_ptr<Block> current;
+    std::vector<uint8_t> dict;
+    uLong adler = adler32(0, nullptr, 0);
+    bool header_written = false;
+    bool closed = false;
+    result_t error = OK;
+
+    Private(int _level, size_t _block_size, unsigned int _num_threads)
+        : level(_level), flevel((level == Z_DEFAULT_COMPRESSION) ? 2 : (level < 2) ? 0 : (level < 6) ? 1 : (level == 6) ? 2 : 3),
+        block_size(_block_size), num_threads(_num_threads) {}
+    ~Private() {
+        halt();
+    }
+
+    void run();
+    void halt();
+    void compress(Block& block);
+    void submit(bool last);
+    result_t flush(DataConsumer *dst, size_t max_queued);
+};
+
+void
+ParallelZConsumer::Private::run()
+{
+    while (true) {
+        Block *block;
+        {
+            std::unique_lock lock(mutex);
+            cv.wait(lock, [this]{ return stop || !todo.empty(); });
+            if (stop) return;
+            block = todo.front();
+            todo.pop_front();
+        }
+        // Queued blocks are not touched by caller until done
+        compress(*block);
+        std::lock_guard lock(mutex);
+        block->done = true;
+        cv.notify_all();
+    }
+}
+
+void
+ParallelZConsumer::Private::halt()
+{
+    {
+        std::lock_guard lock(mutex);
+        stop = true;
+        cv.notify_all();
+    }
+    for (std::thread& thread : threads) thread.join();
+    threads.clear();
+}
+
+void
+ParallelZConsumer::Private::compress(Block& block)
+{
+    block.adler = adler32(adler32(0, nullptr, 0), block.in.data(), uInt(block.len));
+    // Raw deflate, zlib header and trailer are written by caller
+    z_stream s {};
+    if (deflateInit2(&s, block.level, Z_DEFLATED, -MAX_WBITS, 8, block.strategy) != Z_OK) {
+        block.fail = true;
+        return;
+    }
+    if (!block.dict.empty() && (deflateSetDictionary(&s, block.dict.data(), uInt(block.dict.size())) != Z_OK)) {
+        deflateEnd(&s);
+        block.fail = true;
+        return;
+    }
+    // The bound does not include sync flush marker
+    block.out.resize(deflateBound(&s, uLong(block.len)) + 16);
+    s.next_in = (z_const Bytef *) block.in.data();
+    s.avail_in = uInt(block.len);
+    int flush = block.last ? Z_FINISH : Z_SYNC_FLUSH;
+    while (true) {
+        s.next_out = (Bytef *) block.out.data() + s.total_out;
+        s.avail_out = uInt(block.out.size() - s.total_out);
+        int res = deflate(&s, flush);
+        if ((res != Z_OK) && (res != Z_STREAM_END) && (res != Z_BUF_ERROR)) {
+            block.fail = true;
+            break;
+        }
+        // Sync flush is complete if output space is left, finish when the end of stream is written
+        if (block.last ? (res == Z_STREAM_END) : (s.avail_out > 0)) break;
+        block.out.resize(block.out.size() * 2);
+    }
+    block.out.resize(s.total_out);
+    deflateEnd(&s);
+    // Input is not needed any more, return the buffer to pool early
+    block.in = {};
+}
+
+void
+ParallelZConsumer::Private::submit(bool last)
+{
+    if (!current) current = std::make_unique<Block>();
+    current->last = last;
+    current->level = level;
+    current->strategy = strategy;
+    current->dict = std::move(dict);
+    // The dictionary of next block is the tail of up to DICT_SIZE bytes of this one, it is shorter
+    // after a block that setParams submitted early
+    size_t n = std::min(DICT_SIZE, current->len);
+    dict.assign(current->in.data() + current->len - n, current->in.data() + current->len);
+    if (threads.empty()) {
+        for (unsigned int i = 0; i < num_threads; i++) threads.emplace_back(&Private::run, this);
+    }
+    std::lock_guard lock(mutex);
+    todo.push_back(current.get());
+    blocks.push_back(std::move(current));
+    cv.notify_all();
+}
+
+result_t
+ParallelZConsumer::Private::flush(DataConsumer *dst, size_t max_queued)
+{
+    std::unique_lock lock(mutex);
+    while (!blocks.empty()) {
+        Block& block = *blocks.front();
+        if (!block.done) {
+            if (blocks.size() <= max_queued) break;
+            cv.wait(lock, [&block]{ return block.done; });
+        }
+        lock.unlock();
+        if (block.fail) {
+            LOG_ERROR("Deflate of block failed");
+            return OUTPUT_ERROR;
+        }
+        if (!header_written) {
+            // CMF: deflate with 32 KiB window, FLG: compression level and check bits
+            uint8_t header[2] = {0x78, uint8_t(flevel << 6)};
+            header[1] += 31 - ((header[0] * 256 + header[1]) % 31);
+            if (dst->write(header, 2) != 2) return OUTPUT_ERROR;
+            header_written = true;
+        }
+        if (!block.out.empty()) {
+            result_t result = dst->write(block.out.data(), block.out.size());
+            if (result != result_t(block.out.size())) return (result < 0) ? result : result_t(OUTPUT_ERROR);
+        }
+        adler = adler32_combine(adler, block.adler, z_off_t(block.len));
+        lock.lock();
+        blocks.pop_front();
+    }
+    return OK;
+}
+
+ParallelZConsumer::ParallelZConsumer(DataConsumer *dst, bool take_ownership, unsigned int num_threads, size_t block_size, int level)
+    : ChainedConsumer(dst, take_ownership),
+    d(new Private(level, std::clamp(block_size, MIN_BLOCK_SIZE, MAX_BLOCK_SIZE), num_threads ? num_threads : std::max(std::thread::hardware_concurrency(), 1U)))
+{
+}
+
+ParallelZConsumer::~ParallelZConsumer()
+{
+    delete d;
+}
+
+result_t
+ParallelZConsumer::write(const uint8_t *src, size_t size)
+{
+    if (d->error != OK) return d->error;
+    if (d->closed) return WORKFLOW_ERROR;
+    size_t n_copied = 0;
+    while (n_copied < size) {
+        if (!d->current) {
+            d->current = std::make_unique<Private::Block>();
+            d->current->in = BufferPool::get(d->block_size);
+        }
+        size_t n = std::min(size - n_copied, d->block_size - d->current->len);
+        std::memcpy(d->current->in.data() + d->current->len, src + n_copied, n);
+        d->current->len += n;
+        n_copied += n;
+        if (d->current->len >= d->block_size) {
+            d->submit(false);
+            // Keep two blocks per thread in flight, write out the finished ones
+            d->error = d->flush(_dst, 2 * d->num_threads);
+            if (d->error != OK) return d->error;
+        }
+    }
+    return size;
+}
+
+result_t
+ParallelZConsumer::setParams(int level, int strategy)
+{
+    if (d->error != OK) return d->error;
+    if (d->closed) return WORKFLOW_ERROR;
+    if ((level == d->level) && (strategy == d->strategy)) return OK;
+    if (d->current && d->current->len) {
+        d->submit(false);
+        d->error = d->flush(_dst, 2 * d->num_threads);
+        if (d->error != OK) return d->error;
+    }
+    d->level = level;
+    d->strategy = strategy;
+    return OK;
+}
+
+result_t
+ParallelZConsumer::close()
+{
+    if (d->closed) return d->error;
+    d->closed = true;
+    if (d->error == OK) {
+        d->submit(true);
+        d->error = d->flush(_dst, 0);
+    }
+    if (d->error == OK) {
+        uint8_t trailer[4] = {uint8_t(d->adler >> 24), uint8_t(d->adler >> 16), uint8_t(d->adler >> 8), uint8_t(d->adler)};
+        if (_dst->write(trailer, 4) != 4) d->error = OUTPUT_ERROR;
+    }
+    d->halt();
+    result_t result = ChainedConsumer::close();
+    if (d->error == OK) d->error = result;
+    return d->error;
+}
+
+bool
+ParallelZConsumer::isError()
+{
+    return (d->error != OK) || ChainedConsumer::isError();
+}
+
+} // namespace libcdoc
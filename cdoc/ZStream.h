@@ -19,42 +19,113 @@
 #ifndef __ZSTREAM_H__
 #define __ZSTREAM_H__
 
+#include "BufferPool.h"
 #include "Crypto.h"
 #include "Io.h"
 
-#include <zlib.h>
+#include <set>
+#include <string>
 
-#include <array>
+#include <zlib.h>
 
 namespace libcdoc {
 
+struct Configuration;
+
+/**
+ * @brief Chooses compression level and strategy for each file of container
+ */
+struct CompressionPolicy {
+	/**
+	 * @brief The amount of file data given to choose if available
+	 */
+	static constexpr size_t PROBE_SIZE = 64 * 1024;
+
+	struct Params {
+		int level = Z_DEFAULT_COMPRESSION;
+		int strategy = Z_DEFAULT_STRATEGY;
+	};
+
+	virtual ~CompressionPolicy() = default;
+	/**
+	 * @brief choose compression parameters for a file
+	 * @param name the file name
+	 * @param size the file size, -1 if unknown
+	 * @param data the beginning of file data
+	 * @param len the length of data, up to PROBE_SIZE (may be 0)
+	 * @return the compression parameters
+	 */
+	virtual Params choose(const std::string& name, int64_t size, const uint8_t *data, size_t len) = 0;
+};
+
+/**
+ * @brief Compression policy from Configuration
+ *
+ * Files are compressed with ZLIB_LEVEL and ZLIB_STRATEGY, except if ZLIB_ADAPTIVE is not disabled and the
+ * file extension is in ZLIB_STORED_EXTENSIONS (or built-in list of compressed formats) or the byte entropy
+ * of the first block is above ENTROPY_THRESHOLD. Such files are stored (level 0).
+ */
+struct ConfigCompressionPolicy : public CompressionPolicy {
+	static constexpr char const *DEFAULT_STORED_EXTENSIONS = "7z,aac,asice,avi,bdoc,bz2,cdoc,docx,edoc,flac,gif,gz,heic,jpeg,jpg,"
+		"lz,lzma,m4a,mkv,mov,mp3,mp4,odp,ods,odt,ogg,pdf,png,pptx,rar,sce,tgz,webm,webp,xlsx,xz,zip,zst";
+	/**
+	 * @brief The minimum amount of data for entropy probe
+	 */
+	static constexpr size_t MIN_PROBE_SIZE = 4096;
+	/**
+	 * @brief Byte entropy (bits per byte) above which data is considered incompressible
+	 */
+	static constexpr double ENTROPY_THRESHOLD = 7.5;
+
+	explicit ConfigCompressionPolicy(const Configuration *conf = nullptr);
+
+	Params choose(const std::string& name, int64_t size, const uint8_t *data, size_t len) override;
+
+	/**
+	 * @brief calculate the Shannon entropy of bytes
+	 * @return the entropy in bits per byte (0-8)
+	 */
+	static double entropy(const uint8_t *data, size_t len);
+private:
+	Params _params;
+	bool _adaptive = true;
+	std::set<std::string> _stored;
+};
+
 struct CipherConsumer : public ChainedConsumer {
+	// The output buffer grows to this size for large writes
+	static constexpr size_t MAX_UPDATE_SIZE = 4 * 1024 * 1024;
+
 	bool _fail = false;
 	libcdoc::Crypto::Cipher *_cipher;
 	uint32_t _block_size;
+	BufferPool::Buffer _buf = BufferPool::get(BufferPool::CIPHER);
 	CipherConsumer(DataConsumer *dst, bool take_ownership, libcdoc::Crypto::Cipher *cipher)
 		: ChainedConsumer(dst, take_ownership), _cipher(cipher), _block_size(cipher->blockSize()) {}
 	~CipherConsumer() {
 	}
 
     libcdoc::result_t write(const uint8_t *src, size_t size) override final {
-		static constexpr uint64_t CHUNK_SIZE = 16LL * 1024LL;
 		if (_fail) return OUTPUT_ERROR;
 		if (size % _block_size) {
 			_fail = true;
 			return OUTPUT_ERROR;
 		}
-		uint8_t b[CHUNK_SIZE];
+		if ((size > _buf.size()) && (_buf.size() < MAX_UPDATE_SIZE)) {
+			// A single size keeps the pool from collecting buffers of arbitrary sizes
+			_buf = BufferPool::get(MAX_UPDATE_SIZE);
+		}
+		uint8_t *b = _buf.data();
 		size_t processed = 0;
 		while (processed < size) {
-			size_t to_process = std::min<size_t>(size, CHUNK_SIZE);
-			std::copy(src + processed, src + processed + to_process, b);
-			if(!_cipher->update(b, int(to_process))) {
+			// Encrypt out of place, straight from caller's buffer
+			size_t to_process = std::min<size_t>(size - processed, _block_size * (_buf.size() / _block_size));
+			if(!_cipher->update(b, src + processed, to_process)) {
 				_fail = true;
 				return OUTPUT_ERROR;
 			}
 			int64_t n_written = _dst->write(b, to_process);
-			if (n_written != to_process) {
+			if (n_written != int64_t(to_process)) {
 				_fail = true;
 				return OUTPUT_ERROR;
 			}
@@ -77,27 +148,58 @@ struct CipherSource : public ChainedSource {
 
     libcdoc::result_t read(uint8_t *dst, size_t size) override final {
 		if (_fail) return INPUT_ERROR;
-		size_t n_read = _src->read(dst, _block_size * (size / _block_size));
-		if (n_read) {
-			if((n_read % _block_size) || !_cipher->update(dst, n_read)) {
+		size = _block_size * (size / _block_size);
+		size_t n_done = 0;
+		while (n_done < size) {
+			// Decrypt out of place from the buffer of underlying source if possible
+			const uint8_t *ptr;
+			libcdoc::result_t n_avail = _src->peek(&ptr, size - n_done);
+			if (n_avail == 0) break;
+			if ((n_avail < 0) && (n_avail != NOT_IMPLEMENTED)) {
+				_fail = true;
+				return n_avail;
+			}
+			// Sources that cannot lend and lent parts smaller than a block are read into destination
+			if (n_avail > 0) n_avail = _block_size * (n_avail / _block_size);
+			if (n_avail > 0) {
+				if (!_cipher->update(dst + n_done, ptr, size_t(n_avail)) || (_src->consume(size_t(n_avail)) != OK)) {
+					_fail = true;
+					return INPUT_ERROR;
+				}
+				n_done += size_t(n_avail);
+				continue;
+			}
+			libcdoc::result_t n_read = _src->read(dst + n_done, size - n_done);
+			if (n_read < 0) {
+				_fail = true;
+				return n_read;
+			}
+			if ((n_read % _block_size) || !_cipher->update(dst + n_done, int(n_read))) {
 				_fail = true;
 				return INPUT_ERROR;
 			}
+			n_done += size_t(n_read);
+			break;
 		}
-		return n_read;
+		return n_done;
 	}
 
+	// Decrypted data cannot be borrowed from the underlying source
+    libcdoc::result_t peek(const uint8_t **ptr, size_t max) override final { return NOT_IMPLEMENTED; }
+    libcdoc::result_t consume(size_t size) override final { return NOT_IMPLEMENTED; }
+
 	virtual bool isError() override final {
 		return _fail || ChainedSource::isError();
 	};
 };
 
 struct ZConsumer : public ChainedConsumer {
-	static constexpr uint64_t CHUNK = 16LL * 1024LL;
 	z_stream _s {};
 	bool _fail = false;
-	std::vector<uint8_t> buf;
+	BufferPool::Buffer out = BufferPool::get(BufferPool::ZLIB);
 	int flush = Z_NO_FLUSH;
+	int _level = Z_DEFAULT_COMPRESSION;
+	int _strategy = Z_DEFAULT_STRATEGY;
 	ZConsumer(DataConsumer *dst, bool take_ownership = false) : ChainedConsumer(dst, take_ownership) {
 		if (deflateInit(&_s, Z_DEFAULT_COMPRESSION) != Z_OK) _fail = true;
 	}
@@ -109,17 +211,16 @@ struct ZConsumer : public ChainedConsumer {
 		if (_fail) return OUTPUT_ERROR;
 		_s.next_in = (z_const Bytef *) src;
 		_s.avail_in = uInt(size);
-		std::array<uint8_t,CHUNK> out{};
 		while(true) {
 			_s.next_out = (Bytef *)out.data();
-			_s.avail_out = out.size();
+			_s.avail_out = uInt(out.size());
 			int res = deflate(&_s, flush);
 			if(res == Z_STREAM_ERROR)
 				return OUTPUT_ERROR;
 			auto o_size = out.size() - _s.avail_out;
 			if(o_size > 0) {
 				int64_t result = _dst->write(out.data(), o_size);
-				if (result != o_size) return result;
+				if (result != int64_t(o_size)) return result;
 			}
 			if(res == Z_STREAM_END) break;
 			if(flush == Z_FINISH) continue;
@@ -128,23 +229,96 @@ struct ZConsumer : public ChainedConsumer {
 		return size;
 	}
 
+	/**
+	 * @brief change compression level and strategy for the following data
+	 *
+	 * Data written so far is compressed with the old parameters.
+	 */
+	libcdoc::result_t setParams(int level, int strategy) {
+		if (_fail) return OUTPUT_ERROR;
+		if ((level == _level) && (strategy == _strategy)) return OK;
+		_s.next_in = nullptr;
+		_s.avail_in = 0;
+		while (true) {
+			_s.next_out = (Bytef *)out.data();
+			_s.avail_out = uInt(out.size());
+			int res = deflateParams(&_s, level, strategy);
+			auto o_size = out.size() - _s.avail_out;
+			if (o_size > 0) {
+				int64_t result = _dst->write(out.data(), o_size);
+				if (result != int64_t(o_size)) return (result < 0) ? result : result_t(OUTPUT_ERROR);
+			}
+			if (res == Z_OK) break;
+			// Buffer error is retried with empty output buffer
+			if ((res != Z_BUF_ERROR) || (o_size == 0)) return OUTPUT_ERROR;
+		}
+		_level = level;
+		_strategy = strategy;
+		return OK;
+	}
+
 	virtual bool isError() override final {
 		return _fail || ChainedConsumer::isError();
 	};
 
     libcdoc::result_t close() override final {
 		flush = Z_FINISH;
-		write (nullptr, 0);
+		libcdoc::result_t result = write(nullptr, 0);
 		deflateEnd(&_s);
-		return ChainedConsumer::close();
+		libcdoc::result_t close_result = ChainedConsumer::close();
+		return (result < 0) ? result : close_result;
 	}
 };
 
+/**
+ * @brief A compressing consumer that deflates blocks of input in parallel threads
+ *
+ * Input is cut into blocks that are compressed independently, each primed with the last 32 KiB of
+ * previous block as dictionary and ended with sync flush. The compressed blocks are written in order
+ * between zlib header and combined Adler-32 checksum, so the output is an ordinary zlib stream that
+ * ZSource (or any inflater) decodes unchanged. The compression ratio is slightly worse than that of
+ * ZConsumer because matches cannot cross the dictionary window of block start.
+ */
+struct ParallelZConsumer : public ChainedConsumer {
+	static constexpr size_t DEFAULT_BLOCK_SIZE = 256 * 1024;
+	static constexpr size_t MIN_BLOCK_SIZE = 128 * 1024;
+	static constexpr size_t MAX_BLOCK_SIZE = 1024 * 1024;
+	static constexpr size_t DICT_SIZE = 32 * 1024;
+
+	/**
+	 * @brief create a new ParallelZConsumer
+	 * @param dst the consumer of compressed stream
+	 * @param take_ownership if true the destination is deleted in destructor
+	 * @param num_threads the number of compressing threads, the number of cores if 0
+	 * @param block_size the size of input block, clamped to [MIN_BLOCK_SIZE, MAX_BLOCK_SIZE]
+	 * @param level the compression level
+	 */
+	ParallelZConsumer(DataConsumer *dst, bool take_ownership = false, unsigned int num_threads = 0, size_t block_size = DEFAULT_BLOCK_SIZE, int level = Z_DEFAULT_COMPRESSION);
+	~ParallelZConsumer();
+
+	libcdoc::result_t write(const uint8_t *src, size_t size) override final;
+	/**
+	 * @brief change compression level and strategy for the following data
+	 *
+	 * The current block is submitted with the old parameters, so it may be shorter than block size.
+	 */
+	libcdoc::result_t setParams(int level, int strategy);
+	/**
+	 * @brief compress the remaining input, write checksum and close destination if owned
+	 * @return the first error of compression or destination, OK on success
+	 */
+	libcdoc::result_t close() override final;
+	bool isError() override final;
+private:
+	struct Private;
+	Private *d;
+};
+
 struct ZSource : public ChainedSource {
-	static constexpr uint64_t CHUNK = 16LL * 1024LL;
 	z_stream _s {};
     int64_t _error = OK;
-	std::vector<uint8_t> buf;
+	// Input buffer, the unprocessed part of it is kept in z_stream and refilled only when drained
+	BufferPool::Buffer in = BufferPool::get(BufferPool::ZLIB);
 	int flush = Z_NO_FLUSH;
 	ZSource(DataSource *src, bool take_ownership = false) : ChainedSource(src, take_ownership) {
 		if (inflateInit2(&_s, MAX_WBITS) != Z_OK) {
@@ -159,28 +333,39 @@ struct ZSource : public ChainedSource {
 		if (_error) return _error;
 		_s.next_out = (Bytef *) dst;
 		_s.avail_out = uInt (size);
-		uint8_t in[CHUNK];
 		int res = Z_OK;
 		while((_s.avail_out > 0) && (res == Z_OK)) {
-			size_t readlen = CHUNK;
-			int64_t n_read = _src->read(in, readlen);
-			if (n_read > 0) {
-				buf.insert(buf.end(), in, in + n_read);
-			} else if (n_read != 0) {
-				_error = n_read;
-				return _error;
+			if (_s.avail_in == 0) {
+				const uint8_t *ptr;
+				int64_t n_avail = _src->peek(&ptr, in.size());
+				if (n_avail != NOT_IMPLEMENTED) {
+					if (n_avail < 0) {
+						_error = n_avail;
+						return _error;
+					}
+					// Inflate directly from the source buffer
+					_s.next_in = (z_const Bytef *) ptr;
+					_s.avail_in = uInt(n_avail);
+					res = inflate(&_s, flush);
+					if ((res != Z_OK) && (res != Z_STREAM_END)) {
+						_error = ZLIB_ERROR;
+						return _error;
+					}
+					// Unprocessed data stays in source
+					_src->consume(n_avail - _s.avail_in);
+					_s.avail_in = 0;
+					continue;
+				}
+				int64_t n_read = _src->read(in.data(), in.size());
+				if (n_read < 0) {
+					_error = n_read;
+					return _error;
+				}
+				_s.next_in = (z_const Bytef *) in.data();
+				_s.avail_in = uInt(n_read);
 			}
-			_s.next_in = (z_const Bytef *) buf.data();
-			_s.avail_in = uInt(buf.size());
 			res = inflate(&_s, flush);
-			switch(res) {
-			case Z_OK:
-				buf.erase(buf.begin(), buf.end() - _s.avail_in);
-				break;
-			case Z_STREAM_END:
-				buf.clear();
-				break;
-			default:
+			if ((res != Z_OK) && (res != Z_STREAM_END)) {
 				_error = ZLIB_ERROR;
 				return _error;
 			}
@@ -188,6 +373,10 @@ struct ZSource : public ChainedSource {
 		return size - _s.avail_out;
 	}
 
+	// Inflated data cannot be borrowed from the underlying source
+    libcdoc::result_t peek(const uint8_t **ptr, size_t max) override final { return NOT_IMPLEMENTED; }
+    libcdoc::result_t consume(size_t size) override final { return NOT_IMPLEMENTED; }
+
 	virtual bool isError() override final {
         return (_error != OK) || ChainedSource::isError();
 	};
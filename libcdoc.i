@@ -47,11 +47,32 @@
 %ignore libcdoc::ChainedConsumer;
 %ignore libcdoc::ChainedSource;
 %ignore libcdoc::IStreamSource;
+%ignore libcdoc::MmapSource;
+%ignore libcdoc::MmapFileConsumer;
+%ignore libcdoc::UringFileSource;
+%ignore libcdoc::UringFileConsumer;
+%ignore libcdoc::DirectFileSource;
+%ignore libcdoc::DirectFileConsumer;
+%ignore libcdoc::FdSource;
+%ignore libcdoc::FdConsumer;
+%ignore libcdoc::WritevConsumer;
+%ignore libcdoc::SocketConsumer;
+%ignore libcdoc::ReadAheadSource;
+%ignore libcdoc::WriteBehindConsumer;
+%ignore libcdoc::CachingSource;
+%ignore libcdoc::RateLimiter;
+%ignore libcdoc::ThrottledSource;
+%ignore libcdoc::ThrottledConsumer;
+%ignore libcdoc::SegmentedConsumer;
+%ignore libcdoc::SpillBuffer;
 %ignore libcdoc::OStreamConsumer;
 %ignore libcdoc::VectorConsumer;
 %ignore libcdoc::VectorSource;
 %ignore libcdoc::FileListConsumer;
+%ignore libcdoc::AtomicFileListConsumer;
+%ignore libcdoc::MemfdConsumer;
 %ignore libcdoc::FileListSource;
+%ignore libcdoc::PrefetchFileListSource;
 
 %ignore libcdoc::CDocWriter::createWriter(int version, DataConsumer *dst, bool take_ownership, Configuration *conf, CryptoBackend *crypto, NetworkBackend *network);
 %ignore libcdoc::CDocWriter::createWriter(int version, std::ostream& ofs, Configuration *conf, CryptoBackend *crypto, NetworkBackend *network);
@@ -73,6 +94,22 @@
 %ignore libcdoc::Configuration::RP_UUID;
 %ignore libcdoc::Configuration::RP_NAME;
 %ignore libcdoc::Configuration::PHONE_NUMBER;
+%ignore libcdoc::Configuration::ASYNC_IO;
+%ignore libcdoc::Configuration::DIRECT_IO;
+%ignore libcdoc::Configuration::READ_AHEAD;
+%ignore libcdoc::Configuration::READ_CACHE;
+%ignore libcdoc::Configuration::WRITE_BEHIND;
+%ignore libcdoc::Configuration::PIPELINE;
+%ignore libcdoc::Configuration::BULK_IO;
+%ignore libcdoc::Configuration::IO_CHUNK_SIZE;
+%ignore libcdoc::Configuration::ZLIB_CHUNK_SIZE;
+%ignore libcdoc::Configuration::ZLIB_THREADS;
+%ignore libcdoc::Configuration::ZLIB_LEVEL;
+%ignore libcdoc::Configuration::ZLIB_STRATEGY;
+%ignore libcdoc::Configuration::ZLIB_ADAPTIVE;
+%ignore libcdoc::Configuration::ZLIB_STORED_EXTENSIONS;
+%ignore libcdoc::Configuration::CIPHER_CHUNK_SIZE;
+%ignore libcdoc::Configuration::SPILL_THRESHOLD;
 
 %ignore libcdoc::PKCS11Backend::Handle;
 %ignore libcdoc::PKCS11Backend::findCertificates(const std::string& label);
@@ -424,6 +461,13 @@ static std::vector<unsigned char> SWIG_JavaArrayToVectorUnsignedChar(JNIEnv *jen
 %ignore libcdoc::DataBuffer::DataBuffer(std::vector<uint8_t> *_data);
 %ignore libcdoc::DataBuffer::reset();
 
+//
+// DataSource
+//
+
+%ignore libcdoc::DataSource::peek(const uint8_t **ptr, size_t max);
+%ignore libcdoc::DataSource::consume(size_t size);
+
 //
 // DataConsumer
 //
@@ -19,12 +19,27 @@
 #define BOOST_TEST_MODULE "C++ Unit Tests for libcdoc"
 
 #include <boost/test/unit_test.hpp>
+#include <chrono>
 #include <filesystem>
 #include <fstream>
 #include <map>
+#include <random>
+#include <sstream>
+#include <thread>
 #include <CDocCipher.h>
 #include <Recipient.h>
+#include <Tar.h>
 #include <Utils.h>
+#include <ZStream.h>
+#include <openssl/evp.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #ifndef DATA_DIR
 #define DATA_DIR "."
@@ -213,6 +228,66 @@ public:
     }
 };
 
+/**
+ * @brief The Test Fixture class for streaming IO tests.
+ *
+ * Provides generated test data and file paths in a temporary directory that is unique to the test case
+ * and removed after it.
+ */
+class StreamingFixture
+{
+public:
+    ~StreamingFixture()
+    {
+        if (!tempDir.empty())
+        {
+            error_code e;
+            fs::remove_all(tempDir, e);
+        }
+    }
+
+    /**
+     * @brief Creates binary data of given size with a repeating pattern.
+     */
+    static vector<uint8_t> PatternData(size_t size)
+    {
+        vector<uint8_t> data(size);
+        for (size_t i = 0; i < data.size(); i++) data[i] = uint8_t(i % 251);
+        return data;
+    }
+
+    /**
+     * @brief Creates compressible text data of given number of lines.
+     */
+    static vector<uint8_t> TextData(int numLines)
+    {
+        vector<uint8_t> data;
+        for (int i = 0; i < numLines; i++) {
+            string line = "Line " + to_string(i) + " of compressible test data\n";
+            data.insert(data.end(), line.cbegin(), line.cend());
+        }
+        return data;
+    }
+
+    /**
+     * @brief Returns the path of given file in the temporary directory of test case, creating the directory.
+     * @param fileName File's name, the file itself is not created.
+     */
+    fs::path TempPath(string_view fileName)
+    {
+        if (tempDir.empty())
+        {
+            random_device rd;
+            do {
+                tempDir = fs::temp_directory_path() / ("libcdoc_test_" + to_string(rd()));
+            } while (!fs::create_directory(tempDir));
+        }
+        return tempDir / fileName;
+    }
+
+    fs::path tempDir;
+};
+
 
 BOOST_AUTO_TEST_SUITE(PasswordUsageWithLabel)
 
@@ -515,3 +590,1218 @@ BOOST_AUTO_TEST_CASE(Base64LabelParsingWithMediaType)
 }
 
 BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_FIXTURE_TEST_SUITE(StreamingIO, StreamingFixture)
+
+BOOST_FIXTURE_TEST_CASE_WITH_DECOR(MmapSourceRead, FixtureBase, * utf::description("Reading a file through memory mapping"))
+{
+    FormFilePath(SourceFile, sourceFilePath);
+    BOOST_TEST_REQUIRE(fs::exists(sourceFilePath), "File " << sourceFilePath << " must exists");
+    vector<uint8_t> expected = libcdoc::readAllBytes(sourceFilePath.string());
+
+    libcdoc::MmapSource src(sourceFilePath.string());
+    BOOST_TEST_REQUIRE(!src.isError());
+    BOOST_CHECK_EQUAL(src.size(), expected.size());
+    vector<uint8_t> data;
+    libcdoc::VectorConsumer vcons(data);
+    BOOST_CHECK_EQUAL(vcons.writeAll(src), expected.size());
+    BOOST_TEST(data == expected, btools::per_element());
+    BOOST_TEST(src.isEof());
+
+    uint8_t b[4];
+    BOOST_CHECK_EQUAL(src.seek(4), libcdoc::OK);
+    BOOST_CHECK_EQUAL(src.read(b, 4), 4);
+    BOOST_TEST(equal(b, b + 4, expected.cbegin() + 4));
+    BOOST_CHECK_NE(src.seek(expected.size() + 1), libcdoc::OK);
+}
+
+BOOST_AUTO_TEST_CASE(BorrowingSource)
+{
+    vector<uint8_t> data(100000);
+    for (size_t i = 0; i < data.size(); i++) data[i] = uint8_t(i * 7);
+    libcdoc::VectorSource vsrc(data);
+    const uint8_t *ptr = nullptr;
+    BOOST_CHECK_EQUAL(vsrc.peek(&ptr, 16), 16);
+    BOOST_TEST(ptr == data.data());
+    BOOST_CHECK_EQUAL(vsrc.consume(16), libcdoc::OK);
+
+    vector<uint8_t> copy;
+    libcdoc::VectorConsumer vcons(copy);
+    BOOST_CHECK_EQUAL(vcons.writeAll(vsrc), data.size() - 16);
+    BOOST_TEST(equal(copy.cbegin(), copy.cend(), data.cbegin() + 16, data.cend()));
+    BOOST_CHECK_EQUAL(vsrc.peek(&ptr, 16), 0);
+    BOOST_TEST(vsrc.isEof());
+
+    // Chained sources that transform data in read are not bypassed by borrowing
+    struct InvertingSource : public libcdoc::ChainedSource {
+        using ChainedSource::ChainedSource;
+        libcdoc::result_t read(uint8_t *dst, size_t size) override {
+            libcdoc::result_t n_read = _src->read(dst, size);
+            for (libcdoc::result_t i = 0; i < n_read; i++) dst[i] = ~dst[i];
+            return n_read;
+        }
+    };
+    libcdoc::VectorSource isrc(data);
+    InvertingSource inv(&isrc, false);
+    BOOST_CHECK_EQUAL(inv.peek(&ptr, 16), libcdoc::NOT_IMPLEMENTED);
+    copy.clear();
+    BOOST_CHECK_EQUAL(vcons.writeAll(inv), data.size());
+    BOOST_CHECK_EQUAL(copy[1], uint8_t(~data[1]));
+}
+
+BOOST_AUTO_TEST_CASE(ZStreamRoundTrip)
+{
+    vector<uint8_t> data = TextData(20000);
+    vector<uint8_t> compressed;
+    libcdoc::ZConsumer zcons(new libcdoc::VectorConsumer(compressed), true);
+    BOOST_CHECK_EQUAL(zcons.write(data.data(), data.size()), data.size());
+    BOOST_CHECK_EQUAL(zcons.close(), libcdoc::OK);
+    BOOST_TEST(compressed.size() < data.size());
+
+    vector<uint8_t> inflated;
+    libcdoc::VectorSource vsrc(compressed);
+    libcdoc::ZSource zsrc(&vsrc);
+    libcdoc::VectorConsumer vcons(inflated);
+    BOOST_CHECK_EQUAL(vcons.writeAll(zsrc), data.size());
+    BOOST_TEST(inflated == data, btools::per_element());
+
+    // Copying source and small reads keep unprocessed input between calls
+    istringstream ifs(string(compressed.cbegin(), compressed.cend()));
+    libcdoc::IStreamSource isrc(&ifs);
+    libcdoc::ZSource szsrc(&isrc);
+    inflated.assign(data.size() + 1, 0);
+    size_t pos = 0;
+    for (libcdoc::result_t n_read = 1; n_read > 0; pos += n_read) {
+        n_read = szsrc.read(inflated.data() + pos, min<size_t>(1000, inflated.size() - pos));
+        BOOST_REQUIRE(n_read >= 0);
+    }
+    BOOST_CHECK_EQUAL(pos, data.size());
+    BOOST_TEST(equal(data.cbegin(), data.cend(), inflated.cbegin()));
+    BOOST_TEST(szsrc.isEof());
+}
+
+BOOST_AUTO_TEST_CASE(ParallelZRoundTrip)
+{
+    vector<uint8_t> data = TextData(100000);
+    vector<uint8_t> compressed;
+    libcdoc::ParallelZConsumer zcons(new libcdoc::VectorConsumer(compressed), true, 4, libcdoc::ParallelZConsumer::MIN_BLOCK_SIZE);
+    size_t pos = 0;
+    for (size_t len = 1; pos < data.size(); len = len * 3 + 1) {
+        size_t n = min(len % 300000, data.size() - pos);
+        BOOST_REQUIRE_EQUAL(zcons.write(data.data() + pos, n), n);
+        pos += n;
+    }
+    BOOST_CHECK_EQUAL(zcons.close(), libcdoc::OK);
+    BOOST_TEST(compressed.size() < data.size() / 4);
+
+    // Ordinary zlib stream with valid checksum
+    vector<uint8_t> inflated(data.size() + 1);
+    uLongf len = uLongf(inflated.size());
+    BOOST_CHECK_EQUAL(uncompress(inflated.data(), &len, compressed.data(), uLong(compressed.size())), Z_OK);
+    BOOST_CHECK_EQUAL(len, data.size());
+
+    libcdoc::VectorSource vsrc(compressed);
+    libcdoc::ZSource zsrc(&vsrc);
+    inflated.clear();
+    libcdoc::VectorConsumer vcons(inflated);
+    BOOST_CHECK_EQUAL(vcons.writeAll(zsrc), data.size());
+    BOOST_TEST(inflated == data);
+
+    // Empty input is a valid stream too
+    compressed.clear();
+    libcdoc::ParallelZConsumer econs(new libcdoc::VectorConsumer(compressed), true);
+    BOOST_CHECK_EQUAL(econs.close(), libcdoc::OK);
+    len = uLongf(inflated.size());
+    BOOST_CHECK_EQUAL(uncompress(inflated.data(), &len, compressed.data(), uLong(compressed.size())), Z_OK);
+    BOOST_CHECK_EQUAL(len, 0);
+}
+
+BOOST_AUTO_TEST_CASE(CompressionPolicySwitch)
+{
+    vector<uint8_t> text = TextData(20000);
+    vector<uint8_t> noise = libcdoc::Crypto::random(300000);
+
+    libcdoc::ConfigCompressionPolicy policy;
+    BOOST_CHECK_EQUAL(policy.choose("photo.JPG", 1000, nullptr, 0).level, 0);
+    BOOST_CHECK_EQUAL(policy.choose("dir.zip/notes", text.size(), text.data(), libcdoc::CompressionPolicy::PROBE_SIZE).level, Z_DEFAULT_COMPRESSION);
+    BOOST_CHECK_EQUAL(policy.choose("blob.bin", noise.size(), noise.data(), libcdoc::CompressionPolicy::PROBE_SIZE).level, 0);
+    // Too little data for probe
+    BOOST_CHECK_EQUAL(policy.choose("blob.bin", 100, noise.data(), 100).level, Z_DEFAULT_COMPRESSION);
+
+    struct Conf : public libcdoc::Configuration {
+        std::string getValue(std::string_view domain, std::string_view param) const override {
+            if (param == libcdoc::Configuration::ZLIB_LEVEL) return "9";
+            if (param == libcdoc::Configuration::ZLIB_STRATEGY) return "FILTERED";
+            if (param == libcdoc::Configuration::ZLIB_STORED_EXTENSIONS) return "raw, .DAT";
+            return {};
+        }
+    } conf;
+    libcdoc::ConfigCompressionPolicy cpolicy(&conf);
+    libcdoc::CompressionPolicy::Params params = cpolicy.choose("notes.txt", text.size(), text.data(), text.size());
+    BOOST_CHECK_EQUAL(params.level, 9);
+    BOOST_CHECK_EQUAL(params.strategy, Z_FILTERED);
+    BOOST_CHECK_EQUAL(cpolicy.choose("image.dat", 1000, nullptr, 0).level, 0);
+    BOOST_CHECK_EQUAL(cpolicy.choose("image.jpg", 1000, nullptr, 0).level, 9);
+
+    // Parameters switched between files, stored data stays a valid stream
+    vector<uint8_t> expected = text;
+    expected.insert(expected.end(), noise.cbegin(), noise.cend());
+    expected.insert(expected.end(), text.cbegin(), text.cend());
+    for (bool parallel : {false, true}) {
+        vector<uint8_t> compressed;
+        libcdoc::ZConsumer *zcons = nullptr;
+        libcdoc::ParallelZConsumer *pzcons = nullptr;
+        libcdoc::DataConsumer *cons;
+        if (parallel) {
+            cons = pzcons = new libcdoc::ParallelZConsumer(new libcdoc::VectorConsumer(compressed), true, 2);
+        } else {
+            cons = zcons = new libcdoc::ZConsumer(new libcdoc::VectorConsumer(compressed), true);
+        }
+        libcdoc::WriteBehindConsumer wcons(cons, true, 2, 16384);
+        auto setParams = [&](int level) {
+            BOOST_REQUIRE_EQUAL(wcons.sync(), libcdoc::OK);
+            return parallel ? pzcons->setParams(level, Z_DEFAULT_STRATEGY) : zcons->setParams(level, Z_DEFAULT_STRATEGY);
+        };
+        BOOST_CHECK_EQUAL(wcons.write(text.data(), text.size()), text.size());
+        BOOST_CHECK_EQUAL(setParams(0), libcdoc::OK);
+        BOOST_CHECK_EQUAL(wcons.write(noise.data(), noise.size()), noise.size());
+        BOOST_CHECK_EQUAL(setParams(Z_BEST_COMPRESSION), libcdoc::OK);
+        BOOST_CHECK_EQUAL(wcons.write(text.data(), text.size()), text.size());
+        BOOST_CHECK_EQUAL(wcons.close(), libcdoc::OK);
+        BOOST_TEST(compressed.size() < noise.size() + text.size() / 2);
+
+        libcdoc::VectorSource vsrc(compressed);
+        libcdoc::ZSource zsrc(&vsrc);
+        vector<uint8_t> inflated;
+        libcdoc::VectorConsumer vcons(inflated);
+        BOOST_CHECK_EQUAL(vcons.writeAll(zsrc), expected.size());
+        BOOST_TEST(inflated == expected);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(CipherOutOfPlace)
+{
+    vector<uint8_t> data = PatternData(10 * 1024 * 1024 + 1000);
+    vector<uint8_t> key = libcdoc::Crypto::random(32);
+    vector<uint8_t> iv = libcdoc::Crypto::random(12);
+
+    // Reference: the whole data encrypted in place
+    vector<uint8_t> expected = data;
+    libcdoc::Crypto::Cipher ref(EVP_aes_256_gcm(), key, iv, true);
+    BOOST_REQUIRE(ref.update(expected.data(), int(expected.size())));
+
+    // Small write followed by one larger than the maximum update size
+    vector<uint8_t> encrypted;
+    libcdoc::Crypto::Cipher enc(EVP_aes_256_gcm(), key, iv, true);
+    libcdoc::CipherConsumer ccons(new libcdoc::VectorConsumer(encrypted), true, &enc);
+    BOOST_CHECK_EQUAL(ccons.write(data.data(), 1000), 1000);
+    BOOST_CHECK_EQUAL(ccons.write(data.data() + 1000, data.size() - 1000), data.size() - 1000);
+    BOOST_CHECK_EQUAL(ccons.close(), libcdoc::OK);
+    BOOST_TEST(encrypted == expected);
+
+    // Decrypted out of place from the buffer of source
+    libcdoc::Crypto::Cipher dec(EVP_aes_256_gcm(), key, iv, false);
+    libcdoc::VectorSource vsrc(encrypted);
+    libcdoc::CipherSource csrc(&vsrc, false, &dec);
+    vector<uint8_t> decrypted(data.size());
+    BOOST_CHECK_EQUAL(csrc.read(decrypted.data(), 5), 5);
+    BOOST_CHECK_EQUAL(csrc.read(decrypted.data() + 5, decrypted.size()), decrypted.size() - 5);
+    BOOST_TEST(decrypted == data);
+    BOOST_CHECK_EQUAL(vsrc.tell(), encrypted.size());
+
+#ifndef _WIN32
+    // A source that lends less than requested still fills the whole read
+    int fds[2];
+    BOOST_REQUIRE_EQUAL(pipe(fds), 0);
+    thread writer([&encrypted, fd = fds[1]] {
+        libcdoc::FdConsumer(fd, true).write(encrypted.data(), encrypted.size());
+    });
+    libcdoc::Crypto::Cipher pdec(EVP_aes_256_gcm(), key, iv, false);
+    libcdoc::CipherSource psrc(new libcdoc::FdSource(fds[0], true, 4096), true, &pdec);
+    decrypted.assign(data.size(), 0);
+    BOOST_CHECK_EQUAL(psrc.read(decrypted.data(), decrypted.size()), decrypted.size());
+    writer.join();
+    BOOST_TEST(decrypted == data);
+#endif
+
+    // Peek errors other than NOT_IMPLEMENTED are passed through instead of falling back to read
+    struct FailingSource : public libcdoc::VectorSource {
+        using VectorSource::VectorSource;
+        libcdoc::result_t peek(const uint8_t **ptr, size_t max) override { return libcdoc::INPUT_STREAM_ERROR; }
+    } fsrc(encrypted);
+    libcdoc::Crypto::Cipher fdec(EVP_aes_256_gcm(), key, iv, false);
+    libcdoc::CipherSource fcsrc(&fsrc, false, &fdec);
+    BOOST_CHECK_EQUAL(fcsrc.read(decrypted.data(), 100), libcdoc::INPUT_STREAM_ERROR);
+    BOOST_TEST(fcsrc.isError());
+}
+
+BOOST_AUTO_TEST_CASE(TaggedSourceBorrowing)
+{
+    vector<uint8_t> data = TextData(20000);
+    vector<uint8_t> key = libcdoc::Crypto::random(32);
+    vector<uint8_t> iv = libcdoc::Crypto::random(12);
+    vector<uint8_t> encrypted;
+    libcdoc::Crypto::Cipher enc(EVP_chacha20_poly1305(), key, iv, true);
+    {
+        libcdoc::TarConsumer tar(new libcdoc::ZConsumer(new libcdoc::CipherConsumer(new libcdoc::VectorConsumer(encrypted), true, &enc), true), true);
+        BOOST_CHECK_EQUAL(tar.open("file", data.size()), libcdoc::OK);
+        BOOST_CHECK_EQUAL(tar.write(data.data(), data.size()), data.size());
+        BOOST_CHECK_EQUAL(tar.close(), libcdoc::OK);
+    }
+    BOOST_REQUIRE(enc.result());
+    vector<uint8_t> tag = enc.tag();
+    encrypted.insert(encrypted.end(), tag.cbegin(), tag.cend());
+
+    // Counts copying reads, lends at most max_lend bytes at once or nothing if 0
+    struct CountingSource : public libcdoc::VectorSource {
+        size_t max_lend;
+        int n_reads = 0;
+        CountingSource(const vector<uint8_t>& data, size_t max_lend) : VectorSource(data), max_lend(max_lend) {}
+        libcdoc::result_t read(uint8_t *dst, size_t size) override {
+            n_reads++;
+            return VectorSource::read(dst, size);
+        }
+        libcdoc::result_t peek(const uint8_t **ptr, size_t max) override {
+            if (!max_lend) return libcdoc::NOT_IMPLEMENTED;
+            return VectorSource::peek(ptr, min(max, max_lend));
+        }
+    };
+
+    // The decryption chain of CDoc2Reader borrows from the source
+    for (size_t max_lend : {size_t(1000000), size_t(7), size_t(0)}) {
+        CountingSource csrc(encrypted, max_lend);
+        TaggedSource tgs(&csrc, false, 16);
+        libcdoc::Crypto::Cipher dec(EVP_chacha20_poly1305(), key, iv, false);
+        libcdoc::CipherSource *payload = new libcdoc::CipherSource(&tgs, false, &dec);
+        libcdoc::TarSource tar(new libcdoc::ZSource(payload, true), true);
+        string name;
+        int64_t size;
+        vector<uint8_t> copy;
+        libcdoc::VectorConsumer vcons(copy);
+        BOOST_CHECK_EQUAL(tar.next(name, size), libcdoc::OK);
+        BOOST_CHECK_EQUAL(vcons.writeAll(tar), data.size());
+        BOOST_TEST(copy == data);
+        BOOST_CHECK_EQUAL(tar.next(name, size), libcdoc::END_OF_STREAM);
+        while (payload->skip(4096) > 0) {}
+        if (max_lend) BOOST_CHECK_EQUAL(csrc.n_reads, 0);
+        BOOST_TEST(tgs.tag == tag);
+        BOOST_TEST(dec.setTag(tgs.tag));
+        BOOST_TEST(dec.result());
+    }
+
+    // Reads and borrows mixed
+    CountingSource msrc(encrypted, 7);
+    TaggedSource mtgs(&msrc, false, 16);
+    vector<uint8_t> payload(encrypted.size() - 16);
+    BOOST_CHECK_EQUAL(mtgs.read(payload.data(), 3), 3);
+    const uint8_t *ptr;
+    libcdoc::result_t n_avail = mtgs.peek(&ptr, 100);
+    BOOST_REQUIRE(n_avail > 0);
+    std::copy(ptr, ptr + n_avail, payload.begin() + 3);
+    BOOST_CHECK_EQUAL(mtgs.consume(n_avail), libcdoc::OK);
+    BOOST_CHECK_EQUAL(mtgs.read(payload.data() + 3 + n_avail, payload.size()), payload.size() - 3 - n_avail);
+    BOOST_TEST(equal(payload.cbegin(), payload.cend(), encrypted.cbegin()));
+    BOOST_TEST(mtgs.tag == tag);
+    BOOST_TEST(mtgs.isEof());
+}
+
+BOOST_AUTO_TEST_CASE(BufferPoolChunkSizes)
+{
+    struct ChunkConf : public libcdoc::Configuration {
+        std::string getValue(std::string_view domain, std::string_view param) const override {
+            if (param == libcdoc::Configuration::ZLIB_CHUNK_SIZE) return "1000000";
+            if (param == libcdoc::Configuration::CIPHER_CHUNK_SIZE) return "100";
+            return {};
+        }
+    } conf;
+    size_t io_size = libcdoc::BufferPool::getChunkSize(libcdoc::BufferPool::IO);
+    size_t zlib_size = libcdoc::BufferPool::getChunkSize(libcdoc::BufferPool::ZLIB);
+    size_t cipher_size = libcdoc::BufferPool::getChunkSize(libcdoc::BufferPool::CIPHER);
+    libcdoc::BufferPool::configure(conf);
+    BOOST_CHECK_EQUAL(libcdoc::BufferPool::getChunkSize(libcdoc::BufferPool::IO), io_size);
+    BOOST_CHECK_EQUAL(libcdoc::BufferPool::getChunkSize(libcdoc::BufferPool::ZLIB), 1003520);
+    BOOST_CHECK_EQUAL(libcdoc::BufferPool::getChunkSize(libcdoc::BufferPool::CIPHER), libcdoc::BufferPool::MIN_CHUNK_SIZE);
+
+    // Buffers are aligned and reused
+    uint8_t *ptr;
+    {
+        libcdoc::BufferPool::Buffer buf = libcdoc::BufferPool::get(libcdoc::BufferPool::ZLIB);
+        BOOST_CHECK_EQUAL(buf.size(), 1003520);
+        BOOST_CHECK_EQUAL(uintptr_t(buf.data()) % libcdoc::BufferPool::ALIGNMENT, 0);
+        ptr = buf.data();
+    }
+    BOOST_CHECK_EQUAL(libcdoc::BufferPool::get(1003520).data(), ptr);
+
+    // Free buffers are kept only up to the total limit
+    libcdoc::BufferPool::clear();
+    {
+        libcdoc::BufferPool::Buffer a = libcdoc::BufferPool::get(40 * 1024 * 1024);
+        libcdoc::BufferPool::Buffer b = libcdoc::BufferPool::get(40 * 1024 * 1024);
+    }
+    BOOST_CHECK_EQUAL(libcdoc::BufferPool::getFreeSize(), 40 * 1024 * 1024);
+    libcdoc::BufferPool::clear();
+    BOOST_CHECK_EQUAL(libcdoc::BufferPool::getFreeSize(), 0);
+
+    // Compressor output larger than cipher chunk
+    vector<uint8_t> data(3000000);
+    for (size_t i = 0; i < data.size(); i++) data[i] = uint8_t((i * 7919) >> 5);
+    vector<uint8_t> key = libcdoc::Crypto::random(32), iv = libcdoc::Crypto::random(12);
+    vector<uint8_t> encrypted;
+    {
+        libcdoc::Crypto::Cipher cipher(EVP_aes_256_gcm(), key, iv, true);
+        libcdoc::CipherConsumer ccons(new libcdoc::VectorConsumer(encrypted), true, &cipher);
+        libcdoc::ZConsumer zcons(&ccons);
+        BOOST_CHECK_EQUAL(zcons.write(data.data(), data.size()), data.size());
+        BOOST_CHECK_EQUAL(zcons.close(), libcdoc::OK);
+    }
+    vector<uint8_t> decrypted;
+    {
+        libcdoc::Crypto::Cipher cipher(EVP_aes_256_gcm(), key, iv, false);
+        libcdoc::VectorSource vsrc(encrypted);
+        libcdoc::CipherSource csrc(&vsrc, false, &cipher);
+        libcdoc::ZSource zsrc(&csrc);
+        libcdoc::VectorConsumer vcons(decrypted);
+        BOOST_CHECK_EQUAL(vcons.writeAll(zsrc), data.size());
+    }
+    BOOST_TEST(decrypted == data, btools::per_element());
+
+    libcdoc::BufferPool::setChunkSize(libcdoc::BufferPool::ZLIB, zlib_size);
+    libcdoc::BufferPool::setChunkSize(libcdoc::BufferPool::CIPHER, cipher_size);
+    vector<double> speed = libcdoc::BufferPool::benchmark(libcdoc::BufferPool::CIPHER, {4096, 65536}, 1024 * 1024);
+    BOOST_CHECK_EQUAL(speed.size(), 2);
+    BOOST_TEST(speed[0] > 0);
+    BOOST_CHECK_EQUAL(libcdoc::BufferPool::getChunkSize(libcdoc::BufferPool::CIPHER), cipher_size);
+}
+
+BOOST_AUTO_TEST_CASE(SeekAwareSkip)
+{
+    vector<uint8_t> data = PatternData(100000);
+    uint8_t b[16];
+
+    libcdoc::VectorSource vsrc(data);
+    BOOST_CHECK_EQUAL(vsrc.skip(70000), 70000);
+    BOOST_CHECK_EQUAL(vsrc.tell(), 70000);
+    BOOST_CHECK_EQUAL(vsrc.read(b, 16), 16);
+    BOOST_TEST(equal(b, b + 16, data.cbegin() + 70000));
+    // Seeking beyond the end fails, skip stops at the end
+    BOOST_CHECK_EQUAL(vsrc.seek(data.size() + 1), libcdoc::INPUT_STREAM_ERROR);
+    BOOST_CHECK_EQUAL(vsrc.tell(), 70016);
+    BOOST_CHECK_EQUAL(vsrc.skip(50000), data.size() - 70016);
+
+    std::stringstream ss(string((const char *) data.data(), data.size()));
+    libcdoc::IStreamSource isrc(&ss);
+    BOOST_CHECK_EQUAL(isrc.skip(60000), 60000);
+    BOOST_CHECK_EQUAL(isrc.tell(), 60000);
+    BOOST_CHECK_EQUAL(isrc.read(b, 16), 16);
+    BOOST_TEST(equal(b, b + 16, data.cbegin() + 60000));
+    BOOST_CHECK_EQUAL(isrc.skip(50000), data.size() - 60016);
+    BOOST_TEST(isrc.isEof());
+
+    // Not seekable and not borrowing
+    struct ReadOnlySource : public libcdoc::DataSource {
+        libcdoc::VectorSource& _src;
+        ReadOnlySource(libcdoc::VectorSource& src) : _src(src) {}
+        libcdoc::result_t read(uint8_t *dst, size_t size) override { return _src.read(dst, size); }
+        bool isError() override { return false; }
+        bool isEof() override { return _src.isEof(); }
+    } rsrc(vsrc);
+    vsrc.seek(0);
+    BOOST_CHECK_EQUAL(rsrc.skip(99990), 99990);
+    BOOST_CHECK_EQUAL(rsrc.skip(100), 10);
+
+#ifndef _WIN32
+    // Pipe cannot seek, skip reads without leaving a system error behind
+    int fds[2];
+    BOOST_REQUIRE_EQUAL(pipe(fds), 0);
+    thread writer([&data, fd = fds[1]] {
+        libcdoc::FdConsumer(fd, true).write(data.data(), data.size());
+    });
+    libcdoc::FdSource psrc(fds[0], true, 4096);
+    BOOST_CHECK_EQUAL(psrc.seek(50000), libcdoc::NOT_IMPLEMENTED);
+    BOOST_CHECK_EQUAL(psrc.skip(50000), 50000);
+    BOOST_CHECK_EQUAL(psrc.read(b, 16), 16);
+    BOOST_TEST(equal(b, b + 16, data.cbegin() + 50000));
+    BOOST_CHECK_EQUAL(psrc.getErrno(), 0);
+    BOOST_CHECK_EQUAL(psrc.skip(data.size()), data.size() - 50016);
+    writer.join();
+#endif
+}
+
+BOOST_AUTO_TEST_CASE(ReadAheadRoundTrip)
+{
+    vector<uint8_t> data = PatternData(1000003);
+
+    libcdoc::VectorSource vsrc(data);
+    libcdoc::ReadAheadSource src(&vsrc, false, 3, 10000);
+    vector<uint8_t> copy(data.size());
+    BOOST_CHECK_EQUAL(src.read(copy.data(), 12345), 12345);
+    BOOST_CHECK_EQUAL(src.read(copy.data() + 12345, copy.size()), copy.size() - 12345);
+    BOOST_TEST(copy == data, btools::per_element());
+    BOOST_TEST(src.isEof());
+
+    BOOST_CHECK_EQUAL(src.seek(500000), libcdoc::OK);
+    BOOST_CHECK_EQUAL(src.tell(), 500000);
+    vector<uint8_t> rest;
+    libcdoc::VectorConsumer vcons(rest);
+    BOOST_CHECK_EQUAL(vcons.writeAll(src), data.size() - 500000);
+    BOOST_TEST(equal(rest.cbegin(), rest.cend(), data.cbegin() + 500000));
+    BOOST_CHECK_EQUAL(src.seek(data.size() + 1), libcdoc::INPUT_STREAM_ERROR);
+    BOOST_CHECK_EQUAL(src.tell(), data.size());
+
+    // Skip over a source that cannot seek keeps the data read ahead
+    struct StreamSource : public libcdoc::VectorSource {
+        using VectorSource::VectorSource;
+        libcdoc::result_t tell() override { return libcdoc::NOT_IMPLEMENTED; }
+        libcdoc::result_t seek(size_t pos) override { return libcdoc::NOT_IMPLEMENTED; }
+    } ssrc(data);
+    libcdoc::ReadAheadSource sasrc(&ssrc, false, 3, 10000);
+    BOOST_CHECK_EQUAL(sasrc.read(copy.data(), 100), 100);
+    BOOST_CHECK_EQUAL(sasrc.skip(50000), 50000);
+    BOOST_CHECK_EQUAL(sasrc.read(copy.data(), 100), 100);
+    BOOST_TEST(equal(copy.cbegin(), copy.cbegin() + 100, data.cbegin() + 50100));
+
+#ifndef _WIN32
+    // Pipe tells its position but cannot seek, failed seek keeps the data read ahead
+    int fds[2];
+    BOOST_REQUIRE_EQUAL(pipe(fds), 0);
+    thread writer([&data, fd = fds[1]] {
+        libcdoc::FdConsumer(fd, true).write(data.data(), data.size());
+    });
+    libcdoc::ReadAheadSource psrc(new libcdoc::FdSource(fds[0], true, 4096), true, 3, 10000);
+    BOOST_CHECK_EQUAL(psrc.read(copy.data(), 100), 100);
+    BOOST_CHECK_EQUAL(psrc.skip(300000), 300000);
+    BOOST_CHECK_EQUAL(psrc.read(copy.data(), 16), 16);
+    BOOST_TEST(equal(copy.cbegin(), copy.cbegin() + 16, data.cbegin() + 300100));
+    BOOST_TEST(!psrc.isError());
+    BOOST_CHECK_EQUAL(psrc.skip(data.size()), data.size() - 300116);
+    writer.join();
+#endif
+
+    // Errors of inner source are reported after the data read before
+    struct FailingSource : public libcdoc::VectorSource {
+        using VectorSource::VectorSource;
+        libcdoc::result_t read(uint8_t *dst, size_t size) override {
+            if (_ptr >= 25000) return libcdoc::INPUT_STREAM_ERROR;
+            return VectorSource::read(dst, size);
+        }
+    } fsrc(data);
+    libcdoc::ReadAheadSource esrc(&fsrc, false, 2, 10000);
+    BOOST_CHECK_EQUAL(esrc.read(copy.data(), 20000), 20000);
+    BOOST_CHECK_EQUAL(esrc.read(copy.data(), 20000), libcdoc::INPUT_STREAM_ERROR);
+    BOOST_TEST(esrc.isError());
+}
+
+BOOST_AUTO_TEST_CASE(CachingSourcePages)
+{
+    vector<uint8_t> data = PatternData(100003);
+
+    // Counts the calls that would be round trips to remote storage
+    struct CountingSource : public libcdoc::VectorSource {
+        using VectorSource::VectorSource;
+        int n_seeks = 0;
+        int n_reads = 0;
+        libcdoc::result_t seek(size_t pos) override { n_seeks += 1; return VectorSource::seek(pos); }
+        libcdoc::result_t read(uint8_t *dst, size_t size) override { n_reads += 1; return VectorSource::read(dst, size); }
+    } csrc(data);
+    libcdoc::CachingSource src(&csrc, false, 4, 10000);
+    vector<uint8_t> copy(data.size());
+    BOOST_CHECK_EQUAL(src.read(copy.data(), 100), 100);
+    BOOST_CHECK_EQUAL(src.seek(0), libcdoc::OK);
+    BOOST_CHECK_EQUAL(src.read(copy.data(), 25000), 25000);
+    // Rewind and sequential reads do not seek the inner source
+    BOOST_CHECK_EQUAL(csrc.n_seeks, 0);
+    BOOST_CHECK_EQUAL(csrc.n_reads, 3);
+    BOOST_CHECK_EQUAL(src.getNumMisses(), 3);
+    BOOST_CHECK_EQUAL(src.seek(5), libcdoc::OK);
+    BOOST_CHECK_EQUAL(src.read(copy.data() + 5, 20000), 20000);
+    BOOST_CHECK_EQUAL(csrc.n_reads, 3);
+    BOOST_TEST(equal(copy.begin(), copy.begin() + 25000, data.begin()));
+
+    // Jump to the end evicts least recently used pages
+    BOOST_CHECK_EQUAL(src.seek(95000), libcdoc::OK);
+    BOOST_CHECK_EQUAL(src.read(copy.data() + 95000, 10000), 5003);
+    BOOST_TEST(src.isEof());
+    BOOST_CHECK_EQUAL(csrc.n_seeks, 1);
+    BOOST_CHECK_EQUAL(src.seek(data.size() + 1), libcdoc::INPUT_STREAM_ERROR);
+    BOOST_CHECK_EQUAL(src.seek(30000), libcdoc::OK);
+    BOOST_CHECK_EQUAL(src.read(copy.data() + 30000, 65000), 65000);
+    BOOST_CHECK_EQUAL(src.seek(0), libcdoc::OK);
+    BOOST_CHECK_EQUAL(src.read(copy.data(), 30000), 30000);
+    BOOST_TEST(copy == data, btools::per_element());
+    BOOST_CHECK_EQUAL(src.getNumMisses(), 15);
+
+    const uint8_t *ptr;
+    BOOST_CHECK_EQUAL(src.seek(19990), libcdoc::OK);
+    BOOST_CHECK_EQUAL(src.peek(&ptr, 100), 10);
+    BOOST_CHECK_EQUAL(*ptr, data[19990]);
+    BOOST_CHECK_EQUAL(src.consume(10), libcdoc::OK);
+    BOOST_CHECK_EQUAL(src.tell(), 20000);
+
+    // Skip past the end before the size is known only skips the remaining data
+    libcdoc::VectorSource vsrc(data);
+    libcdoc::CachingSource ksrc(&vsrc, false, 4, 10000);
+    BOOST_CHECK_EQUAL(ksrc.read(copy.data(), 100), 100);
+    BOOST_CHECK_EQUAL(ksrc.seek(data.size() + 20000), libcdoc::INPUT_STREAM_ERROR);
+    BOOST_TEST(!ksrc.isError());
+    BOOST_CHECK_EQUAL(ksrc.skip(data.size()), data.size() - 100);
+    BOOST_TEST(ksrc.isEof());
+    BOOST_CHECK_EQUAL(ksrc.seek(data.size()), libcdoc::OK);
+    BOOST_CHECK_EQUAL(ksrc.seek(data.size() + 1), libcdoc::INPUT_STREAM_ERROR);
+}
+
+BOOST_AUTO_TEST_CASE(ThrottledRoundTrip)
+{
+    vector<uint8_t> data = PatternData(300000);
+
+    // 1 MB/s, the first 0.1 s worth of data passes as burst
+    libcdoc::RateLimiter limiter(1000000, 0);
+    libcdoc::VectorSource vsrc(data);
+    libcdoc::ThrottledSource src(&vsrc, false, &limiter);
+    vector<uint8_t> copy;
+    libcdoc::VectorConsumer vcons(copy);
+    libcdoc::ThrottledConsumer cons(&vcons, false, &limiter);
+    auto start = chrono::steady_clock::now();
+    uint8_t buf[10000];
+    for (auto n = src.read(buf, sizeof(buf)); n > 0; n = src.read(buf, sizeof(buf))) {
+        BOOST_REQUIRE_EQUAL(cons.write(buf, n), n);
+    }
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    BOOST_TEST(copy == data);
+    // 600 KB through shared limiter
+    BOOST_TEST(limiter.getThrottledTime() > 0.4);
+    BOOST_TEST(elapsed >= 0.45);
+
+    // Operation limit, raised at runtime
+    limiter.setLimits(0, 100);
+    double before = limiter.getThrottledTime();
+    for (int i = 0; i < 20; i++) limiter.acquire(1);
+    BOOST_TEST(limiter.getThrottledTime() - before > 0.05);
+    limiter.setLimits(0, 0);
+    before = limiter.getThrottledTime();
+    for (int i = 0; i < 1000; i++) limiter.acquire(1000000);
+    BOOST_TEST(limiter.getThrottledTime() - before < 0.2);
+}
+
+BOOST_AUTO_TEST_CASE(SegmentedConsumerSpans)
+{
+    vector<uint8_t> data = PatternData(100000);
+
+    libcdoc::SegmentedConsumer cons(4096);
+    BOOST_CHECK_EQUAL(cons.write(data.data(), 1000), 1000);
+    auto first = cons.getSpans();
+    BOOST_REQUIRE_EQUAL(first.size(), 1);
+    const uint8_t *ptr = first[0].data();
+    BOOST_CHECK_EQUAL(cons.write(data.data() + 1000, 9000), 9000);
+    // Written bytes are never moved
+    BOOST_CHECK_EQUAL(cons.getSpans()[0].data(), ptr);
+    // Reserved data is contiguous
+    BOOST_CHECK_EQUAL(cons.reserve(90000), libcdoc::OK);
+    BOOST_CHECK_EQUAL(cons.write(data.data() + 10000, 90000), 90000);
+    auto spans = cons.getSpans();
+    BOOST_CHECK_EQUAL(spans.back().size(), 90000);
+    BOOST_CHECK_EQUAL(cons.size(), data.size());
+    size_t pos = 0;
+    for (auto span : spans) {
+        BOOST_TEST(equal(span.begin(), span.end(), data.cbegin() + pos));
+        pos += span.size();
+    }
+    BOOST_TEST(cons.toVector() == data);
+    cons.clear();
+    BOOST_CHECK_EQUAL(cons.size(), 0);
+    BOOST_CHECK(cons.getSpans().empty());
+
+    vector<uint8_t> vdata;
+    libcdoc::VectorConsumer vcons(vdata);
+    BOOST_CHECK_EQUAL(vcons.reserve(data.size()), libcdoc::OK);
+    BOOST_CHECK_GE(vdata.capacity(), data.size());
+    BOOST_CHECK_EQUAL(vcons.write(data.data(), data.size()), data.size());
+    BOOST_TEST(vdata == data);
+}
+
+BOOST_AUTO_TEST_CASE(SpillBufferRoundTrip)
+{
+    vector<uint8_t> data = PatternData(100000);
+
+    libcdoc::SpillBuffer buf(30000);
+    BOOST_CHECK_EQUAL(buf.write(data.data(), 20000), 20000);
+    BOOST_CHECK(!buf.isSpilled());
+    vector<uint8_t> copy(data.size());
+    BOOST_CHECK_EQUAL(buf.read(copy.data(), 5000), 5000);
+    // Exceeding the limit moves the data to temporary file, reading continues from the same position
+    BOOST_CHECK_EQUAL(buf.write(data.data() + 20000, 80000), 80000);
+    BOOST_CHECK(buf.isSpilled());
+    BOOST_CHECK_EQUAL(buf.size(), data.size());
+    const uint8_t *ptr;
+    BOOST_CHECK_EQUAL(buf.peek(&ptr, 100), libcdoc::NOT_IMPLEMENTED);
+    BOOST_CHECK_EQUAL(buf.read(copy.data() + 5000, copy.size()), copy.size() - 5000);
+    BOOST_TEST(buf.isEof());
+    BOOST_TEST(copy == data, btools::per_element());
+
+    BOOST_CHECK_EQUAL(buf.seek(50000), libcdoc::OK);
+    BOOST_CHECK_EQUAL(buf.tell(), 50000);
+    vector<uint8_t> rest;
+    libcdoc::VectorConsumer vcons(rest);
+    BOOST_CHECK_EQUAL(vcons.writeAll(buf), data.size() - 50000);
+    BOOST_TEST(equal(rest.cbegin(), rest.cend(), data.cbegin() + 50000));
+    BOOST_CHECK_EQUAL(buf.seek(data.size() + 1), libcdoc::INPUT_STREAM_ERROR);
+
+    buf.clear();
+    BOOST_CHECK_EQUAL(buf.size(), 0);
+    BOOST_CHECK(!buf.isSpilled());
+    // Reserving more than the limit spills at once
+    BOOST_CHECK_EQUAL(buf.reserve(40000), libcdoc::OK);
+    BOOST_CHECK(buf.isSpilled());
+}
+
+BOOST_AUTO_TEST_CASE(WriteBehindRoundTrip)
+{
+    vector<uint8_t> data = PatternData(1000003);
+
+    vector<uint8_t> copy;
+    libcdoc::VectorConsumer vcons(copy);
+    libcdoc::WriteBehindConsumer cons(&vcons, false, 3, 10000);
+    size_t pos = 0;
+    for (size_t len = 1; pos < data.size(); len = len * 3 + 1) {
+        size_t n = min(len % 50000, data.size() - pos);
+        BOOST_REQUIRE_EQUAL(cons.write(data.data() + pos, n), n);
+        pos += n;
+    }
+    BOOST_CHECK_EQUAL(cons.close(), libcdoc::OK);
+    BOOST_TEST(copy == data, btools::per_element());
+    BOOST_CHECK_EQUAL(cons.write(data.data(), 1), libcdoc::WORKFLOW_ERROR);
+
+    // Posted actions run in order with data, their errors are deferred
+    copy.clear();
+    libcdoc::WriteBehindConsumer pcons(&vcons, false, 3, 10000);
+    size_t seen = 0;
+    BOOST_CHECK_EQUAL(pcons.write(data.data(), 15000), 15000);
+    BOOST_CHECK_EQUAL(pcons.post([&copy, &seen] { seen = copy.size(); return libcdoc::OK; }), libcdoc::OK);
+    BOOST_CHECK_EQUAL(pcons.write(data.data() + 15000, 25000), 25000);
+    BOOST_CHECK_EQUAL(pcons.post([] { return libcdoc::WORKFLOW_ERROR; }), libcdoc::OK);
+    BOOST_CHECK_EQUAL(pcons.close(), libcdoc::WORKFLOW_ERROR);
+    BOOST_CHECK_EQUAL(seen, 15000);
+    BOOST_CHECK_EQUAL(copy.size(), 40000);
+
+    // Errors of inner consumer are reported on a later write or on close
+    struct FailingConsumer : public libcdoc::DataConsumer {
+        size_t n_written = 0;
+        libcdoc::result_t write(const uint8_t *src, size_t size) override {
+            if (n_written >= 25000) return libcdoc::OUTPUT_STREAM_ERROR;
+            n_written += size;
+            return size;
+        }
+        libcdoc::result_t close() override { return libcdoc::OK; }
+        bool isError() override { return n_written >= 25000; }
+    } fcons;
+    libcdoc::WriteBehindConsumer econs(&fcons, false, 2, 10000);
+    libcdoc::result_t result = libcdoc::OK;
+    for (pos = 0; (pos < data.size()) && (result >= 0); pos += 10000) {
+        result = econs.write(data.data() + pos, 10000);
+    }
+    BOOST_CHECK_EQUAL(result, libcdoc::OUTPUT_STREAM_ERROR);
+    BOOST_TEST(econs.isError());
+    BOOST_CHECK_EQUAL(econs.close(), libcdoc::OUTPUT_STREAM_ERROR);
+
+    // Inner consumer that is not owned stays open after close and destruction
+    struct CountingConsumer : public libcdoc::DataConsumer {
+        vector<uint8_t>& copy;
+        int n_closes = 0;
+        CountingConsumer(vector<uint8_t>& _copy) : copy(_copy) {}
+        libcdoc::result_t write(const uint8_t *src, size_t size) override {
+            copy.insert(copy.end(), src, src + size);
+            return size;
+        }
+        libcdoc::result_t close() override { n_closes += 1; return libcdoc::OK; }
+        bool isError() override { return false; }
+    } ccons(copy);
+    copy.clear();
+    {
+        libcdoc::WriteBehindConsumer ncons(&ccons, false, 2, 10000);
+        BOOST_CHECK_EQUAL(ncons.write(data.data(), 15000), 15000);
+        BOOST_CHECK_EQUAL(ncons.close(), libcdoc::OK);
+        BOOST_CHECK_EQUAL(copy.size(), 15000);
+        libcdoc::WriteBehindConsumer dcons(&ccons, false, 2, 10000);
+        BOOST_CHECK_EQUAL(dcons.write(data.data(), 15000), 15000);
+    }
+    BOOST_CHECK_EQUAL(ccons.n_closes, 0);
+    BOOST_CHECK_EQUAL(copy.size(), 30000);
+}
+
+BOOST_AUTO_TEST_CASE(PipelinedTarRoundTrip)
+{
+    vector<uint8_t> data = TextData(50000);
+    vector<uint8_t> key = libcdoc::Crypto::random(32);
+    vector<uint8_t> iv = libcdoc::Crypto::random(12);
+
+    // Tar, deflate and cipher stages in separate threads, as in pipelined CDoc2Writer
+    vector<uint8_t> encrypted;
+    libcdoc::Crypto::Cipher enc(EVP_chacha20_poly1305(), key, iv, true);
+    {
+        libcdoc::DataConsumer *cons = new libcdoc::CipherConsumer(new libcdoc::VectorConsumer(encrypted), true, &enc);
+        cons = new libcdoc::WriteBehindConsumer(cons, true, 2);
+        cons = new libcdoc::ZConsumer(cons, true);
+        cons = new libcdoc::WriteBehindConsumer(cons, true, 2);
+        libcdoc::TarConsumer tar(cons, true);
+        BOOST_CHECK_EQUAL(tar.open("first", data.size()), libcdoc::OK);
+        BOOST_CHECK_EQUAL(tar.write(data.data(), data.size()), data.size());
+        BOOST_CHECK_EQUAL(tar.open("second", 1000), libcdoc::OK);
+        BOOST_CHECK_EQUAL(tar.write(data.data(), 1000), 1000);
+        BOOST_CHECK_EQUAL(tar.close(), libcdoc::OK);
+    }
+    BOOST_TEST(enc.result());
+    BOOST_TEST(encrypted.size() < data.size());
+
+    libcdoc::Crypto::Cipher dec(EVP_chacha20_poly1305(), key, iv, false);
+    libcdoc::VectorSource vsrc(encrypted);
+    libcdoc::DataSource *src = new libcdoc::ReadAheadSource(new libcdoc::CipherSource(&vsrc, false, &dec), true, 2);
+    src = new libcdoc::ReadAheadSource(new libcdoc::ZSource(src, true), true, 2);
+    libcdoc::TarSource tar(src, true);
+    string name;
+    int64_t size;
+    vector<uint8_t> copy;
+    libcdoc::VectorConsumer vcons(copy);
+    BOOST_CHECK_EQUAL(tar.next(name, size), libcdoc::OK);
+    BOOST_CHECK_EQUAL(name, "first");
+    BOOST_CHECK_EQUAL(vcons.writeAll(tar), data.size());
+    BOOST_TEST(copy == data);
+    BOOST_CHECK_EQUAL(tar.next(name, size), libcdoc::OK);
+    BOOST_CHECK_EQUAL(size, 1000);
+    BOOST_CHECK_EQUAL(tar.next(name, size), libcdoc::END_OF_STREAM);
+
+    // Errors of the last stage reach the caller by close at latest
+    struct FailingConsumer : public libcdoc::DataConsumer {
+        libcdoc::result_t write(const uint8_t *src, size_t size) override { return libcdoc::OUTPUT_STREAM_ERROR; }
+        libcdoc::result_t close() override { return libcdoc::OK; }
+        bool isError() override { return true; }
+    } fcons;
+    libcdoc::Crypto::Cipher fenc(EVP_chacha20_poly1305(), key, iv, true);
+    libcdoc::DataConsumer *cons = new libcdoc::CipherConsumer(&fcons, false, &fenc);
+    cons = new libcdoc::WriteBehindConsumer(cons, true, 2);
+    cons = new libcdoc::ZConsumer(cons, true);
+    cons = new libcdoc::WriteBehindConsumer(cons, true, 2);
+    libcdoc::TarConsumer ftar(cons, true);
+    libcdoc::result_t result = ftar.open("first", data.size());
+    if (result == libcdoc::OK) result = ftar.write(data.data(), data.size());
+    if (result >= 0) result = ftar.close();
+    BOOST_CHECK_EQUAL(result, libcdoc::OUTPUT_ERROR);
+}
+
+BOOST_AUTO_TEST_CASE(PrefetchFileList)
+{
+    fs::path dir = TempPath("prefetch");
+    fs::create_directories(dir);
+    vector<string> names;
+    vector<vector<uint8_t>> contents;
+    for (size_t i = 0; i < 20; i++) {
+        names.push_back("file" + to_string(i) + ".bin");
+        contents.emplace_back((i * i * 997) % 20000);
+        for (size_t j = 0; j < contents.back().size(); j++) contents.back()[j] = uint8_t(i + j);
+        ofstream ofs(dir / names.back(), ios_base::binary);
+        ofs.write((const char *) contents.back().data(), contents.back().size());
+    }
+    names.insert(names.begin() + 10, "missing.bin");
+
+    libcdoc::PrefetchFileListSource src(dir.string(), names, 3, 4096);
+    BOOST_CHECK_EQUAL(src.getNumComponents(), names.size());
+    string name;
+    int64_t size;
+    for (size_t i = 0; i < names.size(); i++) {
+        if (i == 10) {
+            BOOST_CHECK_EQUAL(src.next(name, size), libcdoc::IO_ERROR);
+            // Failed file reports its error until the next one is opened
+            uint8_t buf[16];
+            const uint8_t *ptr;
+            BOOST_CHECK_EQUAL(src.read(buf, sizeof(buf)), libcdoc::IO_ERROR);
+            BOOST_CHECK_EQUAL(src.peek(&ptr, sizeof(buf)), libcdoc::IO_ERROR);
+            BOOST_CHECK_EQUAL(src.consume(1), libcdoc::IO_ERROR);
+            BOOST_TEST(src.isError());
+            BOOST_TEST(!src.isEof());
+            continue;
+        }
+        const vector<uint8_t>& expected = contents[(i < 10) ? i : i - 1];
+        BOOST_REQUIRE_EQUAL(src.next(name, size), libcdoc::OK);
+        BOOST_CHECK_EQUAL(name, names[i]);
+        BOOST_CHECK_EQUAL(size, expected.size());
+        vector<uint8_t> data;
+        libcdoc::VectorConsumer vcons(data);
+        BOOST_CHECK_EQUAL(vcons.writeAll(src), expected.size());
+        BOOST_TEST(data == expected, btools::per_element());
+        BOOST_TEST(src.isEof());
+    }
+    BOOST_CHECK_EQUAL(src.next(name, size), libcdoc::END_OF_STREAM);
+
+    // Zero prefetch still uses one helper thread
+    libcdoc::PrefetchFileListSource single(dir.string(), names, 0, 4096);
+    BOOST_REQUIRE_EQUAL(single.next(name, size), libcdoc::OK);
+    BOOST_CHECK_EQUAL(size, contents[0].size());
+}
+
+#ifndef _WIN32
+BOOST_AUTO_TEST_CASE(UringFileRoundTrip)
+{
+    fs::path path = TempPath("uring.bin");
+    vector<uint8_t> data = PatternData(1000003);
+
+    libcdoc::UringFileConsumer cons(path.string(), 3, 65536);
+    BOOST_TEST_MESSAGE("io_uring in use: " << cons.isAsync());
+    for (size_t pos = 0; pos < data.size(); pos += 10000) {
+        size_t len = min<size_t>(10000, data.size() - pos);
+        BOOST_REQUIRE_EQUAL(cons.write(data.data() + pos, len), len);
+    }
+    BOOST_CHECK_EQUAL(cons.close(), libcdoc::OK);
+    BOOST_CHECK_EQUAL(fs::file_size(path), data.size());
+
+    libcdoc::UringFileSource src(path.string(), 3, 65536);
+    BOOST_TEST_REQUIRE(!src.isError());
+    vector<uint8_t> copy(data.size());
+    BOOST_CHECK_EQUAL(src.read(copy.data(), 12345), 12345);
+    BOOST_CHECK_EQUAL(src.read(copy.data() + 12345, copy.size()), copy.size() - 12345);
+    BOOST_TEST(copy == data, btools::per_element());
+    BOOST_TEST(src.isEof());
+
+    uint8_t b[16];
+    BOOST_CHECK_EQUAL(src.seek(500000), libcdoc::OK);
+    BOOST_CHECK_EQUAL(src.read(b, 16), 16);
+    BOOST_TEST(equal(b, b + 16, data.cbegin() + 500000));
+
+    // Buffered data is written if consumer is not closed
+    {
+        libcdoc::UringFileConsumer ucons(path.string(), 3, 65536);
+        BOOST_CHECK_EQUAL(ucons.write(data.data(), 100000), 100000);
+    }
+    BOOST_CHECK_EQUAL(fs::file_size(path), 100000);
+}
+
+BOOST_AUTO_TEST_CASE(DirectFileRoundTrip)
+{
+    fs::path dir = TempPath("direct");
+    fs::create_directories(dir);
+    vector<uint8_t> data = PatternData(300007);
+
+    libcdoc::FileListConsumer files(dir.string(), true);
+    BOOST_CHECK_EQUAL(files.open("sub/direct.bin", data.size()), libcdoc::OK);
+    for (size_t pos = 0; pos < data.size(); pos += 10000) {
+        size_t len = min<size_t>(10000, data.size() - pos);
+        BOOST_REQUIRE_EQUAL(files.write(data.data() + pos, len), len);
+    }
+    BOOST_CHECK_EQUAL(files.close(), libcdoc::OK);
+    fs::path path = dir / "direct.bin";
+    BOOST_CHECK_EQUAL(fs::file_size(path), data.size());
+
+    libcdoc::DirectFileSource src(path.string(), 65536);
+    BOOST_TEST_REQUIRE(!src.isError());
+    BOOST_TEST_MESSAGE("Direct I/O in use: " << src.isDirect());
+    vector<uint8_t> copy(data.size());
+    BOOST_CHECK_EQUAL(src.read(copy.data(), 12345), 12345);
+    BOOST_CHECK_EQUAL(src.read(copy.data() + 12345, copy.size()), copy.size() - 12345);
+    BOOST_TEST(copy == data, btools::per_element());
+    BOOST_TEST(src.isEof());
+
+    uint8_t b[16];
+    BOOST_CHECK_EQUAL(src.seek(200001), libcdoc::OK);
+    BOOST_CHECK_EQUAL(src.read(b, 16), 16);
+    BOOST_TEST(equal(b, b + 16, data.cbegin() + 200001));
+    BOOST_CHECK_EQUAL(src.seek(data.size() + 1), libcdoc::INPUT_STREAM_ERROR);
+}
+
+BOOST_AUTO_TEST_CASE(FdRoundTrip)
+{
+    fs::path path = TempPath("fd.bin");
+    vector<uint8_t> data = PatternData(100003);
+
+    libcdoc::FdConsumer cons(path.string(), 4096);
+    BOOST_REQUIRE_EQUAL(cons.write(data.data(), 100), 100);
+    BOOST_REQUIRE_EQUAL(cons.write(data.data() + 100, 50000), 50000);
+    BOOST_REQUIRE_EQUAL(cons.write(data.data() + 50100, data.size() - 50100), data.size() - 50100);
+    BOOST_CHECK_EQUAL(cons.close(), libcdoc::OK);
+    BOOST_CHECK_EQUAL(fs::file_size(path), data.size());
+
+    libcdoc::FdSource src(path.string(), 4096);
+    BOOST_TEST_REQUIRE(!src.isError());
+    vector<uint8_t> copy(data.size());
+    BOOST_CHECK_EQUAL(src.read(copy.data(), 10), 10);
+    BOOST_CHECK_EQUAL(src.read(copy.data() + 10, copy.size()), copy.size() - 10);
+    BOOST_TEST(copy == data, btools::per_element());
+    BOOST_TEST(src.isEof());
+    uint8_t b[16];
+    BOOST_CHECK_EQUAL(src.seek(70001), libcdoc::OK);
+    BOOST_CHECK_EQUAL(src.read(b, 16), 16);
+    BOOST_TEST(equal(b, b + 16, data.cbegin() + 70001));
+
+    libcdoc::FdSource missing(TempPath("missing.bin").string());
+    BOOST_TEST(missing.isError());
+    BOOST_CHECK_EQUAL(missing.getErrno(), ENOENT);
+
+    // Pipes cannot seek, except within the buffer
+    int fds[2];
+    BOOST_REQUIRE_EQUAL(pipe(fds), 0);
+    libcdoc::FdConsumer pcons(fds[1], true);
+    BOOST_CHECK_EQUAL(pcons.write(data.data(), 1000), 1000);
+    BOOST_CHECK_EQUAL(pcons.close(), libcdoc::OK);
+    libcdoc::FdSource psrc(fds[0], true);
+    BOOST_CHECK_EQUAL(psrc.read(b, 16), 16);
+    BOOST_CHECK_EQUAL(psrc.seek(0), libcdoc::OK);
+    copy.assign(2000, 0);
+    BOOST_CHECK_EQUAL(psrc.read(copy.data(), copy.size()), 1000);
+    BOOST_TEST(equal(data.cbegin(), data.cbegin() + 1000, copy.cbegin()));
+    BOOST_TEST(psrc.isEof());
+
+    // File skips use seek, pipe skips advance through the buffer
+    libcdoc::FdSource fsrc(path.string());
+    BOOST_CHECK_EQUAL(fsrc.skip(80000), 80000);
+    BOOST_CHECK_EQUAL(fsrc.tell(), 80000);
+    BOOST_CHECK_EQUAL(fsrc.skip(30000), data.size() - 80000);
+    BOOST_CHECK_EQUAL(pipe(fds), 0);
+    BOOST_CHECK_EQUAL(::write(fds[1], data.data(), 1000), 1000);
+    ::close(fds[1]);
+    libcdoc::FdSource psrc2(fds[0], true);
+    BOOST_CHECK_EQUAL(psrc2.skip(600), 600);
+    BOOST_CHECK_EQUAL(psrc2.read(b, 16), 16);
+    BOOST_TEST(equal(b, b + 16, data.cbegin() + 600));
+    BOOST_CHECK_EQUAL(psrc2.skip(1000), 384);
+}
+
+BOOST_AUTO_TEST_CASE(BulkFileRoundTrip)
+{
+    fs::path dir = TempPath("bulk");
+    fs::create_directories(dir);
+    // Spans several bulk windows
+    vector<uint8_t> data = PatternData(2 * libcdoc::FdConsumer::BULK_WINDOW + 12345);
+
+    libcdoc::FileListConsumer cons(dir.string(), false, true);
+    BOOST_REQUIRE_EQUAL(cons.open("a.bin", data.size()), libcdoc::OK);
+    for (size_t pos = 0; pos < data.size(); pos += 100000) {
+        size_t len = std::min<size_t>(100000, data.size() - pos);
+        BOOST_REQUIRE_EQUAL(cons.write(data.data() + pos, len), len);
+    }
+    BOOST_CHECK_EQUAL(cons.close(), libcdoc::OK);
+    libcdoc::WritevConsumer wcons((dir / "b.bin").string(), 4096);
+    wcons.setBulk(true);
+    BOOST_REQUIRE_EQUAL(wcons.write(data.data(), data.size()), data.size());
+    BOOST_CHECK_EQUAL(wcons.close(), libcdoc::OK);
+
+    vector<string> files = {"a.bin", "b.bin"};
+    libcdoc::FileListSource src(dir.string(), files, true);
+    string name;
+    int64_t size;
+    vector<uint8_t> copy(data.size());
+    for (int i = 0; i < 2; i++) {
+        BOOST_REQUIRE_EQUAL(src.next(name, size), libcdoc::OK);
+        BOOST_REQUIRE_EQUAL(size, data.size());
+        size_t pos = 0;
+        while (pos < copy.size()) {
+            auto n = src.read(copy.data() + pos, std::min<size_t>(70000, copy.size() - pos));
+            BOOST_REQUIRE_GT(n, 0);
+            pos += n;
+        }
+        BOOST_TEST(copy == data);
+    }
+    BOOST_CHECK_EQUAL(src.next(name, size), libcdoc::END_OF_STREAM);
+}
+
+BOOST_AUTO_TEST_CASE(WritevGather)
+{
+    fs::path path = TempPath("writev.bin");
+    vector<uint8_t> data = PatternData(5000);
+
+    libcdoc::WritevConsumer cons(path.string(), 1024);
+    // Small header-like writes are collected, the large one is gathered with them
+    size_t pos = 0;
+    for (size_t len : {8, 4, 300, 32, 12, 2000, 16}) {
+        BOOST_REQUIRE_EQUAL(cons.write(data.data() + pos, len), len);
+        pos += len;
+    }
+    BOOST_CHECK_EQUAL(cons.getNumCalls(), 1);
+    BOOST_CHECK_EQUAL(cons.close(), libcdoc::OK);
+    BOOST_CHECK_EQUAL(cons.getNumCalls(), 2);
+    BOOST_CHECK_EQUAL(fs::file_size(path), pos);
+
+    // Positioned writes do not move the descriptor
+    libcdoc::WritevConsumer pcons(::open(path.string().c_str(), O_WRONLY), true, 64, 100);
+    BOOST_CHECK_EQUAL(pcons.write(data.data(), 50), 50);
+    BOOST_CHECK_EQUAL(pcons.write(data.data() + 50, 50), 50);
+    BOOST_CHECK_EQUAL(lseek(pcons.getFd(), 0, SEEK_CUR), 0);
+    BOOST_CHECK_EQUAL(pcons.close(), libcdoc::OK);
+
+    libcdoc::FdSource src(path.string());
+    vector<uint8_t> copy(pos);
+    BOOST_CHECK_EQUAL(src.read(copy.data(), copy.size()), pos);
+    BOOST_TEST(equal(copy.cbegin(), copy.cbegin() + 100, data.cbegin()));
+    BOOST_TEST(equal(copy.cbegin() + 100, copy.cbegin() + 200, data.cbegin()));
+    BOOST_TEST(equal(copy.cbegin() + 200, copy.cend(), data.cbegin() + 200));
+}
+
+BOOST_AUTO_TEST_CASE(AtomicFileList)
+{
+    fs::path dir = TempPath("atomic");
+    fs::create_directories(dir);
+    vector<uint8_t> data = PatternData(3000);
+    {
+        ofstream old(dir / "b.bin");
+        old << "old content";
+    }
+
+    auto cons = make_unique<libcdoc::AtomicFileListConsumer>(dir.string(), 2);
+    // Announced size is larger than actual, the file is truncated on close
+    BOOST_REQUIRE_EQUAL(cons->open("x/a.bin", 10000), libcdoc::OK);
+    BOOST_CHECK_EQUAL(cons->write(data.data(), 1000), 1000);
+    BOOST_CHECK(!fs::exists(dir / "a.bin"));
+    BOOST_REQUIRE_EQUAL(cons->open("b.bin", 2000), libcdoc::OK);
+    BOOST_CHECK_EQUAL(cons->getNumPending(), 1);
+    BOOST_CHECK_EQUAL(cons->write(data.data(), 2000), 2000);
+    BOOST_CHECK_EQUAL(fs::file_size(dir / "b.bin"), 11);
+    // Second file completes the group
+    BOOST_REQUIRE_EQUAL(cons->open("c.bin", 3000), libcdoc::OK);
+    BOOST_CHECK_EQUAL(cons->getNumPending(), 0);
+    BOOST_CHECK_EQUAL(fs::file_size(dir / "a.bin"), 1000);
+    BOOST_CHECK_EQUAL(fs::file_size(dir / "b.bin"), 2000);
+    BOOST_CHECK_EQUAL(cons->write(data.data(), 3000), 3000);
+    BOOST_CHECK(!fs::exists(dir / "c.bin"));
+    // Pending file is published on destruction
+    cons.reset();
+    BOOST_CHECK_EQUAL(fs::file_size(dir / "c.bin"), 3000);
+    libcdoc::FdSource src((dir / "c.bin").string());
+    vector<uint8_t> copy(3000);
+    BOOST_CHECK_EQUAL(src.read(copy.data(), copy.size()), 3000);
+    BOOST_TEST(copy == data);
+
+    // Aborted files leave nothing behind
+    libcdoc::AtomicFileListConsumer acons(dir.string());
+    BOOST_REQUIRE_EQUAL(acons.open("d.bin", 100), libcdoc::OK);
+    BOOST_CHECK_EQUAL(acons.write(data.data(), 100), 100);
+    BOOST_CHECK_EQUAL(acons.close(), libcdoc::OK);
+    acons.abort();
+    BOOST_CHECK_EQUAL(acons.finish(), libcdoc::OK);
+    BOOST_CHECK_EQUAL(acons.getFailed().size(), 1);
+    BOOST_CHECK_EQUAL(distance(fs::directory_iterator(dir), fs::directory_iterator()), 3);
+
+    // A file that cannot replace a directory fails and the rest of its group is reported as discarded
+    fs::create_directories(dir / "e.bin" / "sub");
+    libcdoc::AtomicFileListConsumer fcons(dir.string(), 2);
+    BOOST_REQUIRE_EQUAL(fcons.open("e.bin", 100), libcdoc::OK);
+    BOOST_CHECK_EQUAL(fcons.write(data.data(), 100), 100);
+    BOOST_REQUIRE_EQUAL(fcons.open("f.bin", 100), libcdoc::OK);
+    BOOST_CHECK_EQUAL(fcons.write(data.data(), 100), 100);
+    BOOST_CHECK_EQUAL(fcons.close(), libcdoc::OUTPUT_STREAM_ERROR);
+    BOOST_TEST(fcons.isError());
+    BOOST_TEST(fcons.getFailed() == (vector<string>{(dir / "e.bin").string(), (dir / "f.bin").string()}), btools::per_element());
+    BOOST_CHECK(!fs::exists(dir / "f.bin"));
+    BOOST_CHECK_EQUAL(distance(fs::directory_iterator(dir), fs::directory_iterator()), 4);
+}
+
+BOOST_AUTO_TEST_CASE(MmapFileRoundTrip)
+{
+    fs::path path = TempPath("mmap.bin");
+    vector<uint8_t> data = PatternData(10000);
+    {
+        libcdoc::MmapFileConsumer cons(path.string(), 6000);
+        BOOST_REQUIRE(!cons.isError());
+        // Produce directly into the mapping
+        uint8_t *dst;
+        BOOST_REQUIRE_EQUAL(cons.getBuffer(&dst), 6000);
+        std::copy(data.begin(), data.begin() + 4000, dst);
+        BOOST_CHECK_EQUAL(cons.commit(4000), libcdoc::OK);
+        BOOST_CHECK_EQUAL(cons.getBuffer(&dst), 2000);
+        BOOST_CHECK_EQUAL(cons.commit(3000), libcdoc::WRONG_ARGUMENTS);
+        // Writing past the expected size grows the mapping
+        BOOST_CHECK_EQUAL(cons.write(data.data() + 4000, 5000), 5000);
+        BOOST_CHECK_EQUAL(cons.getPos(), 9000);
+        BOOST_CHECK_EQUAL(cons.close(), libcdoc::OK);
+    }
+    BOOST_CHECK_EQUAL(fs::file_size(path), 9000);
+    libcdoc::MmapSource src(path.string());
+    BOOST_TEST(vector<uint8_t>(src.data(), src.data() + src.size()) == vector<uint8_t>(data.begin(), data.begin() + 9000));
+    {
+        // Empty file is not mapped
+        libcdoc::MmapFileConsumer cons(path.string(), 0);
+        BOOST_CHECK_EQUAL(cons.close(), libcdoc::OK);
+    }
+    BOOST_CHECK_EQUAL(fs::file_size(path), 0);
+}
+
+BOOST_AUTO_TEST_CASE(SocketSend)
+{
+    vector<uint8_t> data = PatternData(1000003);
+    auto transfer = [&data](int wfd, int rfd) {
+        vector<uint8_t> received;
+        thread reader([rfd, &received] {
+            uint8_t buf[65536];
+            ssize_t n;
+            while ((n = ::read(rfd, buf, sizeof(buf))) > 0) received.insert(received.end(), buf, buf + n);
+        });
+        {
+            libcdoc::SocketConsumer cons(wfd, true, 3, 16384);
+            BOOST_CHECK_EQUAL(cons.write(data.data(), 100), 100);
+            BOOST_CHECK_EQUAL(cons.write(data.data() + 100, data.size() - 100), data.size() - 100);
+            BOOST_CHECK_EQUAL(cons.close(), libcdoc::OK);
+        }
+        reader.join();
+        ::close(rfd);
+        BOOST_TEST(received == data);
+    };
+
+    int fds[2];
+    BOOST_REQUIRE_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    transfer(fds[0], fds[1]);
+
+    // TCP loopback supports zero-copy on Linux
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if ((lfd < 0) || bind(lfd, (struct sockaddr *) &addr, len) || listen(lfd, 1) || getsockname(lfd, (struct sockaddr *) &addr, &len)) {
+        if (lfd >= 0) ::close(lfd);
+        return;
+    }
+    int cfd = socket(AF_INET, SOCK_STREAM, 0);
+    BOOST_REQUIRE_EQUAL(connect(cfd, (struct sockaddr *) &addr, len), 0);
+    int afd = accept(lfd, nullptr, nullptr);
+    ::close(lfd);
+    BOOST_REQUIRE(afd >= 0);
+    // Non-blocking sender waits for the socket
+    fcntl(cfd, F_SETFL, fcntl(cfd, F_GETFL) | O_NONBLOCK);
+    transfer(cfd, afd);
+
+    // Closed peer is an error, not a signal
+    BOOST_REQUIRE_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    ::close(fds[1]);
+    libcdoc::SocketConsumer cons(fds[0], true, 2, 4096);
+    BOOST_CHECK_EQUAL(cons.write(data.data(), 10000), libcdoc::OUTPUT_STREAM_ERROR);
+    BOOST_CHECK_EQUAL(cons.getErrno(), EPIPE);
+}
+
+BOOST_AUTO_TEST_CASE(MemfdHandoff)
+{
+    vector<uint8_t> data = PatternData(5000);
+    libcdoc::MemfdConsumer cons;
+    auto result = cons.open("dir/a.bin", 8000);
+    if (result == libcdoc::NOT_IMPLEMENTED) return;
+    BOOST_REQUIRE_EQUAL(result, libcdoc::OK);
+    BOOST_CHECK_EQUAL(cons.write(data.data(), 3000), 3000);
+    BOOST_CHECK_EQUAL(cons.write(data.data() + 3000, 2000), 2000);
+    BOOST_REQUIRE_EQUAL(cons.open("b.bin", 0), libcdoc::OK);
+    BOOST_CHECK_EQUAL(cons.close(), libcdoc::OK);
+    vector<libcdoc::MemfdConsumer::File> files = cons.release();
+    BOOST_CHECK(cons.getFiles().empty());
+    BOOST_REQUIRE_EQUAL(files.size(), 2);
+    BOOST_CHECK_EQUAL(files[0].name, "dir/a.bin");
+    BOOST_CHECK_EQUAL(files[0].size, 5000);
+    BOOST_CHECK_EQUAL(files[1].size, 0);
+    // Truncated to written size, rewound and sealed
+    int fd = files[0].fd;
+    struct stat st;
+    BOOST_REQUIRE_EQUAL(fstat(fd, &st), 0);
+    BOOST_CHECK_EQUAL(st.st_size, 5000);
+    BOOST_CHECK_EQUAL(lseek(fd, 0, SEEK_CUR), 0);
+    BOOST_CHECK_EQUAL(::write(fd, data.data(), 1), -1);
+    BOOST_CHECK_EQUAL(ftruncate(fd, 100), -1);
+    libcdoc::FdSource src(fd, true);
+    vector<uint8_t> copy(5000);
+    BOOST_CHECK_EQUAL(src.read(copy.data(), copy.size()), 5000);
+    BOOST_TEST(copy == data);
+    ::close(files[1].fd);
+}
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()